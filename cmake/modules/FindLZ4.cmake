@@ -0,0 +1,25 @@
+# Find LZ4
+# ~~~~~~~~
+# Redistribution and use is allowed according to the terms of the BSD license.
+# For details see the accompanying COPYING-CMAKE-SCRIPTS file.
+#
+# CMake module to search for the LZ4 compression library
+#
+# If it's found it sets LZ4_FOUND to TRUE
+# and following variables are set:
+#    LZ4_INCLUDE_DIR
+#    LZ4_LIBRARY
+#
+
+FIND_PATH(LZ4_INCLUDE_DIR NAMES lz4.h)
+
+FIND_LIBRARY(LZ4_LIBRARY NAMES
+    lz4
+    liblz4
+)
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(LZ4 DEFAULT_MSG LZ4_LIBRARY LZ4_INCLUDE_DIR)
+
+MARK_AS_ADVANCED(CLEAR LZ4_INCLUDE_DIR)
+MARK_AS_ADVANCED(CLEAR LZ4_LIBRARY)
@@ -0,0 +1,25 @@
+# Find ZSTD
+# ~~~~~~~~~
+# Redistribution and use is allowed according to the terms of the BSD license.
+# For details see the accompanying COPYING-CMAKE-SCRIPTS file.
+#
+# CMake module to search for the Zstandard compression library
+#
+# If it's found it sets ZSTD_FOUND to TRUE
+# and following variables are set:
+#    ZSTD_INCLUDE_DIR
+#    ZSTD_LIBRARY
+#
+
+FIND_PATH(ZSTD_INCLUDE_DIR NAMES zstd.h)
+
+FIND_LIBRARY(ZSTD_LIBRARY NAMES
+    zstd
+    libzstd
+)
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(ZSTD DEFAULT_MSG ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
+
+MARK_AS_ADVANCED(CLEAR ZSTD_INCLUDE_DIR)
+MARK_AS_ADVANCED(CLEAR ZSTD_LIBRARY)
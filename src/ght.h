@@ -21,6 +21,12 @@ typedef void* GhtTreePtr;
 typedef void* GhtNodeListPtr;
 typedef void* GhtNodePtr;
 typedef void* GhtAttributePtr;
+typedef void* GhtArchiveWriterPtr;
+typedef void* GhtArchiveReaderPtr;
+typedef void* GhtPredicatePtr;
+typedef void* GhtContextPtr;
+typedef void* GhtPackedTreePtr;
+typedef void* GhtTreeCursorPtr;
 typedef GhtConfig* GhtConfigPtr;
 
 
@@ -39,6 +45,23 @@ void ght_set_handlers(GhtAllocator allocator, GhtReallocator reallocator,
                       GhtDeallocator deallocator, GhtMessageHandler error_handler,
                       GhtMessageHandler info_handler, GhtMessageHandler warn_handler);
 
+/** Create a context of memory and message handlers, NULL handlers come from the default */
+GhtErr ght_context_new(GhtAllocator allocator, GhtReallocator reallocator,
+                       GhtDeallocator deallocator, GhtMessageHandler error_handler,
+                       GhtMessageHandler info_handler, GhtMessageHandler warn_handler,
+                       GhtContextPtr *context);
+
+/** Free a context, once nothing allocated through it is still in use */
+GhtErr ght_context_free(GhtContextPtr context);
+
+/**
+* Use a context for everything the calling thread does from now on, or
+* the handlers set with ght_set_handlers again when it is NULL. Trees,
+* readers and writers keep the context they were created under, and
+* allocate and free through it whichever thread uses them.
+*/
+GhtErr ght_context_set_current(GhtContextPtr context);
+
 /***********************************************************************
 *   NODE
 */
@@ -75,6 +98,12 @@ GhtErr ght_nodelist_get_node(const GhtNodeListPtr nodelist, int index, GhtNodePt
 /** Add a new node to a nodelist */
 GhtErr ght_nodelist_add_node(GhtNodeListPtr nodelist, GhtNodePtr node);
 
+/** Add an array of nodes to a nodelist, growing it at most once */
+GhtErr ght_nodelist_add_nodes(GhtNodeListPtr nodelist, GhtNodePtr *nodes, int num_nodes);
+
+/** Make room in a nodelist for at least capacity nodes */
+GhtErr ght_nodelist_reserve(GhtNodeListPtr nodelist, int capacity);
+
 /** Free a nodelist, and optionally all the nodes referenced by the list */
 GhtErr ght_nodelist_free_deep(GhtNodeListPtr nodelist);
 
@@ -143,12 +172,15 @@ GhtErr ght_schema_get_dimension_by_name(const GhtSchemaPtr schema, const char *n
 /** Free an existing schema */
 GhtErr ght_schema_free(GhtSchemaPtr schema);
 
+/** Free the schemas shared by trees read with embedded schemas */
+GhtErr ght_schema_cache_clear(void);
+
 
 /***********************************************************************
 *   TREE
 */
 
-/** Allocate a new tree and initialize config parameters */
+/** Allocate a new tree and initialize config parameters, the tree keeps the current context for all its memory */
 GhtErr ght_tree_new(const GhtSchemaPtr a, GhtTreePtr *tree);
 
 /** Build a tree from a linear nodelist */
@@ -172,6 +204,9 @@ GhtErr ght_tree_get_schema(const GhtTreePtr tree, GhtSchemaPtr *schema);
 /** Read the point cound from the GhtTree */
 GhtErr ght_tree_get_numpoints(const GhtTreePtr tree, int *numpoints);
 
+/** Measure the depths, fan-outs, hash fragments and memory use of a GhtTree */
+GhtErr ght_tree_get_profile(const GhtTreePtr tree, GhtTreeProfile *profile);
+
 /** Calculate the spatial extent of a GhtTree */
 GhtErr ght_tree_get_extent(const GhtTreePtr tree, GhtArea *area);
 
@@ -187,21 +222,125 @@ GhtErr ght_tree_filter_between(const GhtTreePtr tree, const char *dimname, doubl
 /** Allocate new tree with only nodes that meet the filter condition */
 GhtErr ght_tree_filter_equal(const GhtTreePtr tree, const char *dimname, double value, GhtTreePtr *tree_filtered);
 
+/** Allocate new tree with only nodes that pass the predicate, in a single traversal */
+GhtErr ght_tree_filter_predicate(const GhtTreePtr tree, GhtPredicatePtr predicate, GhtTreePtr *tree_filtered);
+
+/** Add copies of the k points nearest to pt to the nodelist, nearest first */
+GhtErr ght_tree_knn(const GhtTreePtr tree, const GhtCoordinate *pt, int k, GhtNodeListPtr nodelist);
+
+/** Add copies of the points no further than radius from pt to the nodelist */
+GhtErr ght_tree_within_distance(const GhtTreePtr tree, const GhtCoordinate *pt, double radius, GhtNodeListPtr nodelist);
+
+/** Add one representative point per hash cell of resolution characters to the nodelist */
+GhtErr ght_tree_sample(const GhtTreePtr tree, int resolution, GhtSampleMode mode, GhtNodeListPtr nodelist);
+
+/** Cache a representative point on every interior node, so sampling at any resolution stops at the cells */
+GhtErr ght_tree_build_lod(GhtTreePtr tree, GhtSampleMode mode);
+
+/** Fill in stats, an array with one entry per schema dimension, in one traversal */
+GhtErr ght_tree_get_stats(const GhtTreePtr tree, GhtAttributeStats *stats);
+
+/** Call callback with the dimension statistics of every hash cell of resolution characters, stats is scratch space set up like for ght_tree_get_stats */
+GhtErr ght_tree_get_stats_by_prefix(const GhtTreePtr tree, int resolution, GhtAttributeStats *stats, GhtStatsCallback callback, void *data);
+
+/** Aggregate a dimension (any, for GHT_AGG_COUNT) over an nx by ny grid covering extent, into out, row by row from the top */
+GhtErr ght_tree_rasterize(const GhtTreePtr tree, const GhtArea *extent, int nx, int ny, const char *dimname, GhtAggregate agg, double *out);
+
+/** Call callback with the k nearest neighbours of every point, sharing the work between num_threads threads */
+GhtErr ght_tree_knn_all(const GhtTreePtr tree, int k, int num_threads, GhtKnnCallback callback, void *data);
+
+/** Count the points that pass the predicate, without copying anything */
+GhtErr ght_tree_filter_count(const GhtTreePtr tree, GhtPredicatePtr predicate, int *count);
+
+/** Call callback on each point that passes the predicate (all points, if it is NULL), without copying anything */
+GhtErr ght_tree_filter_foreach(const GhtTreePtr tree, GhtPredicatePtr predicate, GhtLeafCallback callback, void *data);
+
+/** Read the full hash of a point passed to a GhtLeafCallback */
+GhtErr ght_leaf_get_hash(const GhtLeaf *leaf, const GhtHash **hash);
+
+/** Read the coordinate of a point passed to a GhtLeafCallback */
+GhtErr ght_leaf_get_coordinate(const GhtLeaf *leaf, GhtCoordinate *coord);
+
+/** Read a dimension value of a point passed to a GhtLeafCallback */
+GhtErr ght_leaf_get_value(const GhtLeaf *leaf, const GhtDimensionPtr dim, double *val);
+
 /** Compact all the attributes from 'Z' onwards */
 GhtErr ght_tree_compact_attributes(GhtTreePtr tree);
 
+/** Compact all the attributes from 'Z' onwards, folding values within a tolerance per dimension (by position) into their parents, and report the largest error introduced per dimension */
+GhtErr ght_tree_compact_attributes_tolerance(GhtTreePtr tree, const double *tolerances, double *max_errors);
+
+/** Pack the tree into one read-only block of memory, safe for any number of concurrent readers, after which changes to it fail */
+GhtErr ght_tree_freeze(GhtTreePtr tree);
+
+/** Keep per-node min/max summaries so range filters can skip whole branches */
+GhtErr ght_tree_set_summaries(GhtTreePtr tree, int summaries);
+
 /** Write a GhtTree to memory or file */
 GhtErr ght_tree_write(const GhtTreePtr tree, GhtWriterPtr writer);
 
 /** Write a GhtTree to memory of file */
 GhtErr ght_tree_read(GhtReaderPtr reader, GhtTreePtr *tree);
 
+/** Read the header and root of a tree, leaving compressed blocks unread */
+GhtErr ght_tree_read_root(GhtReaderPtr reader, GhtTreePtr *tree);
+
+/** Decompress one block and attach it to a tree from ght_tree_read_root */
+GhtErr ght_tree_read_block(GhtReaderPtr reader, GhtTreePtr tree, int block);
+
 /** Set up a tree configuration with defaults */
 GhtErr ght_config_init(GhtConfigPtr config);
 
 /** Take in a tree and output a populated GhtNodeList, creates complete copy of data */
 GhtErr ght_tree_to_nodelist(const GhtTreePtr tree, GhtNodeListPtr nodelist);
 
+/** Start a cursor at the first point of the tree, reading points in hash order without copying them */
+GhtErr ght_tree_cursor_new(const GhtTreePtr tree, GhtTreeCursorPtr *cursor);
+
+/** Free a cursor */
+GhtErr ght_tree_cursor_free(GhtTreeCursorPtr cursor);
+
+/** Read the next point from the cursor, valid until the cursor moves, GHT_DONE once all are read */
+GhtErr ght_tree_cursor_next(GhtTreeCursorPtr cursor, const GhtLeaf **leaf);
+
+/** Move the cursor to the first point whose hash is not less than prefix */
+GhtErr ght_tree_cursor_seek_prefix(GhtTreeCursorPtr cursor, const GhtHash *prefix);
+
+/** Move the cursor to the point numbered rank, counting from zero in hash order */
+GhtErr ght_tree_cursor_seek_rank(GhtTreeCursorPtr cursor, int rank);
+
+/** Read the rank of the point the cursor will return next */
+GhtErr ght_tree_cursor_get_rank(const GhtTreeCursorPtr cursor, int *rank);
+
+
+/***********************************************************************
+*   PACKED TREE
+*/
+
+/** Make a read-only copy of a tree with its nodes in one depth-first array */
+GhtErr ght_packed_tree_from_tree(const GhtTreePtr tree, GhtPackedTreePtr *packed);
+
+/** Free a packed tree */
+GhtErr ght_packed_tree_free(GhtPackedTreePtr packed);
+
+/** Make an ordinary tree from a packed one */
+GhtErr ght_packed_tree_to_tree(const GhtPackedTreePtr packed, GhtTreePtr *tree);
+
+/** Read the point count of a packed tree, without traversal */
+GhtErr ght_packed_tree_get_numpoints(const GhtPackedTreePtr packed, int *numpoints);
+
+/** Calculate the spatial extent of a packed tree */
+GhtErr ght_packed_tree_get_extent(const GhtPackedTreePtr packed, GhtArea *area);
+
+/** Count the points of a packed tree that pass the predicate */
+GhtErr ght_packed_tree_filter_count(const GhtPackedTreePtr packed, GhtPredicatePtr predicate, int *count);
+
+/** Call callback on each point of a packed tree that passes the predicate */
+GhtErr ght_packed_tree_filter_foreach(const GhtPackedTreePtr packed, GhtPredicatePtr predicate, GhtLeafCallback callback, void *data);
+
+/** Write a packed tree, in the same format as ght_tree_write */
+GhtErr ght_packed_tree_write(const GhtPackedTreePtr packed, GhtWriterPtr writer);
+
 
 /***********************************************************************
 *   WRITER
@@ -222,6 +361,15 @@ GhtErr ght_writer_get_bytes(GhtWriterPtr writer, unsigned char *bytes);
 /** Close filehandle if necessary and free all memory along with writer */
 GhtErr ght_writer_free(GhtWriterPtr writer);
 
+/** Write trees as independently compressed blocks, one per root child */
+GhtErr ght_writer_set_codec(GhtWriterPtr writer, GhtCodec codec);
+
+/** Write integer attributes as small deltas from a per-parent reference value */
+GhtErr ght_writer_set_delta(GhtWriterPtr writer, int delta);
+
+/** Embed a binary copy of the schema, so readers can be opened without one */
+GhtErr ght_writer_set_embed_schema(GhtWriterPtr writer, int embed);
+
 
 
 /***********************************************************************
@@ -237,6 +385,97 @@ GhtErr ght_reader_new_mem(const unsigned char *bytes_start, size_t bytes_size, c
 /** Close filehandle if necessary and free all memory along with reader */
 GhtErr ght_reader_free(GhtReaderPtr reader);
 
+/** Number of compressed blocks in a tree stream, after ght_tree_read_root */
+GhtErr ght_reader_get_num_blocks(const GhtReaderPtr reader, int *num_blocks);
+
+/** Spatial extent covered by one block, to decide whether to read it */
+GhtErr ght_reader_get_block_area(const GhtReaderPtr reader, const GhtTreePtr tree, int block, GhtArea *area);
+
+/** Range of values of a dimension within one block, for trees written with summaries */
+GhtErr ght_reader_get_block_range(const GhtReaderPtr reader, int block, const char *dimname, GhtRange *range);
+
+/** Codec from name ("none", "zlib", "zstd", "lz4") */
+GhtErr ght_codec_from_str(const char *str, GhtCodec *codec);
+
+/** Whether a codec was compiled into this build */
+GhtErr ght_codec_available(GhtCodec codec, int *available);
+
+
+
+/***********************************************************************
+*   PREDICATE
+*/
+
+/** Pass values of a dimension greater than value */
+GhtErr ght_predicate_new_greater_than(const char *dimname, double value, GhtPredicatePtr *predicate);
+
+/** Pass values of a dimension less than value */
+GhtErr ght_predicate_new_less_than(const char *dimname, double value, GhtPredicatePtr *predicate);
+
+/** Pass values of a dimension between two values, inclusive */
+GhtErr ght_predicate_new_between(const char *dimname, double value1, double value2, GhtPredicatePtr *predicate);
+
+/** Pass values of a dimension equal to value */
+GhtErr ght_predicate_new_equal(const char *dimname, double value, GhtPredicatePtr *predicate);
+
+/** Pass points inside an area */
+GhtErr ght_predicate_new_area(const GhtArea *area, GhtPredicatePtr *predicate);
+
+/** Pass points that pass every added term */
+GhtErr ght_predicate_new_and(GhtPredicatePtr *predicate);
+
+/** Pass points that pass any added term */
+GhtErr ght_predicate_new_or(GhtPredicatePtr *predicate);
+
+/** Pass points that fail arg, takes ownership of arg */
+GhtErr ght_predicate_new_not(GhtPredicatePtr arg, GhtPredicatePtr *predicate);
+
+/** Add a term to an AND or OR predicate, takes ownership of arg */
+GhtErr ght_predicate_add(GhtPredicatePtr predicate, GhtPredicatePtr arg);
+
+/** Free a predicate and all its terms */
+GhtErr ght_predicate_free(GhtPredicatePtr predicate);
+
+
+/***********************************************************************
+*   ARCHIVE
+*/
+
+/** Create a new archive file, with a schema shared by all its trees */
+GhtErr ght_archive_writer_new(const char *filename, const GhtSchemaPtr schema, GhtArchiveWriterPtr *archive);
+
+/** Compress the trees added to the archive with this codec */
+GhtErr ght_archive_writer_set_codec(GhtArchiveWriterPtr archive, GhtCodec codec);
+
+/** Delta encode the trees added to the archive */
+GhtErr ght_archive_writer_set_delta(GhtArchiveWriterPtr archive, int delta);
+
+/** Append a tree to the archive as a new tile */
+GhtErr ght_archive_writer_add_tree(GhtArchiveWriterPtr archive, const GhtTreePtr tree);
+
+/** Write the tile directory, close the file and free the archive */
+GhtErr ght_archive_writer_close(GhtArchiveWriterPtr archive);
+
+/** Open an archive file and read its schema and tile directory */
+GhtErr ght_archive_reader_new(const char *filename, GhtArchiveReaderPtr *archive);
+
+/** Close the archive file and free the archive, its interned schema lives on until ght_schema_cache_clear */
+GhtErr ght_archive_reader_free(GhtArchiveReaderPtr archive);
+
+/** Read the schema shared by all the trees in the archive */
+GhtErr ght_archive_get_schema(const GhtArchiveReaderPtr archive, GhtSchemaPtr *schema);
+
+/** How many tiles in the archive? */
+GhtErr ght_archive_get_num_tiles(const GhtArchiveReaderPtr archive, int *num_tiles);
+
+/** Read the extent of one tile from the directory */
+GhtErr ght_archive_get_tile_area(const GhtArchiveReaderPtr archive, int tile, GhtArea *area);
+
+/** Find the tiles that intersect an area, returns a newly allocated array of tile numbers */
+GhtErr ght_archive_query_area(const GhtArchiveReaderPtr archive, const GhtArea *area, int **tiles, int *num_tiles);
+
+/** Read one tile of the archive into a tree */
+GhtErr ght_archive_read_tile(GhtArchiveReaderPtr archive, int tile, GhtTreePtr *tree);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,416 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+/**
+* Aggregates over the points of a tree. An attribute stored on an
+* interior node holds for every leaf under it, so it is counted once,
+* weighted by the number of those leaves, rather than once per leaf.
+* The X and Y dimensions come from the hash coordinates of the leaves.
+*/
+
+#include "ght_internal.h"
+#include <float.h>
+#include <math.h>
+
+static void
+ght_attribute_stats_reset(GhtAttributeStats *stats, const GhtSchema *schema)
+{
+    int i;
+    for ( i = 0; i < schema->num_dims; i++ )
+    {
+        GhtAttributeStats *s = &(stats[i]);
+        s->dim = schema->dims[i];
+        s->type = schema->dims[i]->type;
+        s->count = 0;
+        s->sum = 0.0;
+        s->min = DBL_MAX;
+        s->max = -1 * DBL_MAX;
+        if ( s->bins && s->num_bins > 0 )
+            memset(s->bins, 0, s->num_bins * sizeof(int));
+    }
+}
+
+/** Take in weight copies of one value */
+static void
+ght_attribute_stats_add_value(GhtAttributeStats *s, double val, int weight)
+{
+    s->count += weight;
+    s->sum += val * weight;
+    if ( val < s->min ) s->min = val;
+    if ( val > s->max ) s->max = val;
+
+    if ( s->bins && s->num_bins > 0 && s->range.max > s->range.min &&
+         val >= s->range.min && val <= s->range.max )
+    {
+        int bin = floor((val - s->range.min) / (s->range.max - s->range.min) * s->num_bins);
+        /* The top of the range goes in the last bin */
+        if ( bin >= s->num_bins )
+            bin = s->num_bins - 1;
+        s->bins[bin] += weight;
+    }
+}
+
+static GhtErr
+ght_attribute_stats_add_attributes(GhtAttributeStats *stats, const GhtAttribute *attr, int weight)
+{
+    while ( attr )
+    {
+        double val;
+        GHT_TRY(ght_attribute_get_value(attr, &val));
+        ght_attribute_stats_add_value(&(stats[attr->dim->position]), val, weight);
+        attr = attr->next;
+    }
+    return GHT_OK;
+}
+
+/** Recursively take in the subtree under a node, returning the number of leaves in count */
+static GhtErr
+ght_node_get_stats(const GhtNode *node, const GhtHash *hash, int num_dims, GhtAttributeStats *stats, int *count)
+{
+    static const int hash_array_len = GHT_MAX_HASH_LENGTH + 1;
+    GhtHash h[hash_array_len];
+    int n = 0;
+
+    /* Add our part of the hash to the incoming part */
+    memset(h, 0, hash_array_len);
+    strncpy(h, hash, GHT_MAX_HASH_LENGTH);
+    if ( node->hash )
+    {
+        if ( strlen(h) + strlen(node->hash) > GHT_MAX_HASH_LENGTH )
+        {
+            ght_error("%s: tree is deeper than the longest hash", __func__);
+            return GHT_ERROR;
+        }
+        strcat(h, node->hash);
+    }
+
+    if ( (! node->children) || node->children->num_nodes == 0 )
+    {
+        GhtCoordinate coord;
+        GHT_TRY(ght_coordinate_from_hash(h, &coord));
+        if ( num_dims > 1 )
+        {
+            ght_attribute_stats_add_value(&(stats[0]), coord.x, 1);
+            ght_attribute_stats_add_value(&(stats[1]), coord.y, 1);
+        }
+        n = 1;
+    }
+    else
+    {
+        int i;
+        for ( i = 0; i < node->children->num_nodes; i++ )
+        {
+            GHT_TRY(ght_node_get_stats(node->children->nodes[i], h, num_dims, stats, &n));
+        }
+    }
+
+    /* Our attributes hold for all the leaves below */
+    GHT_TRY(ght_attribute_stats_add_attributes(stats, node->attributes, n));
+    *count += n;
+    return GHT_OK;
+}
+
+/**
+* Fill in stats, an array with an entry for each dimension of the
+* schema, with the count, range and sum of the values of each dimension,
+* and the histogram of those with bins set up.
+*/
+GhtErr
+ght_tree_get_stats(const GhtTree *tree, GhtAttributeStats *stats)
+{
+    int count = 0;
+
+    if ( ! tree || ! stats )
+        return GHT_ERROR;
+
+    ght_attribute_stats_reset(stats, tree->schema);
+    if ( ! tree->root )
+        return GHT_OK;
+
+    return ght_node_get_stats(tree->root, "", tree->schema->num_dims, stats, &count);
+}
+
+static GhtErr
+ght_node_get_stats_by_prefix(const GhtNode *node, const GhtSchema *schema, int resolution, GhtLeaf *leaf, GhtAttributeStats *stats, GhtStatsCallback callback, void *data)
+{
+    size_t hash_len = strlen(leaf->hash);
+    GhtErr err = GHT_OK;
+    int i;
+
+    if ( (node->hash && hash_len + strlen(node->hash) > GHT_MAX_HASH_LENGTH) ||
+         leaf->depth >= GHT_LEAF_MAX_DEPTH )
+    {
+        ght_error("%s: tree is deeper than the longest hash", __func__);
+        return GHT_ERROR;
+    }
+
+    if ( hash_len + (node->hash ? strlen(node->hash) : 0) >= (size_t)resolution ||
+         (! node->children) || node->children->num_nodes == 0 )
+    {
+        /* Everything under here is in one cell */
+        GhtHash prefix[GHT_MAX_HASH_LENGTH + 1];
+        int count = 0;
+
+        ght_attribute_stats_reset(stats, schema);
+        GHT_TRY(ght_node_get_stats(node, leaf->hash, schema->num_dims, stats, &count));
+        for ( i = 0; i < leaf->depth; i++ )
+        {
+            GHT_TRY(ght_attribute_stats_add_attributes(stats, leaf->attributes[i], count));
+        }
+
+        strcpy(prefix, leaf->hash);
+        if ( node->hash )
+            strcat(prefix, node->hash);
+        if ( strlen(prefix) > (size_t)resolution )
+            prefix[resolution] = '\0';
+        return callback(prefix, schema->num_dims, stats, data);
+    }
+
+    if ( node->hash )
+        strcat(leaf->hash, node->hash);
+    leaf->attributes[leaf->depth++] = node->attributes;
+    for ( i = 0; err == GHT_OK && i < node->children->num_nodes; i++ )
+    {
+        err = ght_node_get_stats_by_prefix(node->children->nodes[i], schema, resolution, leaf, stats, callback, data);
+    }
+    leaf->depth--;
+    leaf->hash[hash_len] = '\0';
+    return err;
+}
+
+/**
+* Group the points by the first resolution characters of their hashes,
+* and call callback with the prefix and statistics of each group, in
+* tree order. Points with shorter hashes are groups of their own. The
+* stats array is reused for every group, callback may return GHT_DONE
+* to stop early.
+*/
+GhtErr
+ght_tree_get_stats_by_prefix(const GhtTree *tree, int resolution, GhtAttributeStats *stats, GhtStatsCallback callback, void *data)
+{
+    GhtLeaf leaf;
+    GhtErr err;
+
+    if ( ! tree || ! stats || ! callback || resolution < 0 )
+        return GHT_ERROR;
+    if ( ! tree->root )
+        return GHT_OK;
+
+    memset(&leaf, 0, sizeof(GhtLeaf));
+    err = ght_node_get_stats_by_prefix(tree->root, tree->schema, resolution, &leaf, stats, callback, data);
+    return err == GHT_DONE ? GHT_OK : err;
+}
+
+/* A grid being filled, rows run from the top of the extent down */
+typedef struct
+{
+    const GhtSchema *schema;
+    const GhtDimension *dim;
+    GhtAggregate agg;
+    GhtArea extent;
+    int nx;
+    int ny;
+    double *values;
+    double *counts;
+} GhtRaster;
+
+/** Find the pixel holding a coordinate, returns -1 when outside the grid */
+static int
+ght_raster_pixel(const GhtRaster *raster, double x, double y)
+{
+    double fx = floor((x - raster->extent.x.min) / (raster->extent.x.max - raster->extent.x.min) * raster->nx);
+    double fy = floor((raster->extent.y.max - y) / (raster->extent.y.max - raster->extent.y.min) * raster->ny);
+    if ( fx < 0 || fx >= raster->nx || fy < 0 || fy >= raster->ny )
+        return -1;
+    return (int)fy * raster->nx + (int)fx;
+}
+
+/** Take in count points whose values add up to sum and lie within [min, max] */
+static void
+ght_raster_add(GhtRaster *raster, int pixel, int count, double sum, double min, double max)
+{
+    double *v = &(raster->values[pixel]);
+    if ( count <= 0 )
+        return;
+    switch ( raster->agg )
+    {
+        case GHT_AGG_COUNT:
+            *v += count;
+            break;
+        case GHT_AGG_SUM:
+        case GHT_AGG_MEAN:
+            *v += sum;
+            break;
+        case GHT_AGG_MIN:
+            if ( ! raster->counts[pixel] || min < *v ) *v = min;
+            break;
+        case GHT_AGG_MAX:
+            if ( ! raster->counts[pixel] || max > *v ) *v = max;
+            break;
+    }
+    raster->counts[pixel] += count;
+}
+
+/** Take in every point under a node that falls in a single pixel, without visiting them if we can help it */
+static GhtErr
+ght_raster_add_node(GhtRaster *raster, int pixel, const GhtNode *node, const GhtLeaf *leaf, const GhtHash *hash)
+{
+    const GhtSummary *summary = NULL;
+    double val;
+    int count = 0;
+
+    /* Counts, and values held by the whole subtree, only need the number of points */
+    if ( raster->agg == GHT_AGG_COUNT || ght_leaf_get_value(leaf, raster->dim, &val) == GHT_OK )
+    {
+        GHT_TRY(ght_node_count_leaves(node, &count));
+        ght_raster_add(raster, pixel, count, count * val, val, val);
+        return GHT_OK;
+    }
+
+    /* The extremes are in the summary, when the tree keeps them */
+    if ( raster->agg == GHT_AGG_MIN || raster->agg == GHT_AGG_MAX )
+    {
+        if ( ght_summary_get_by_dimension(node->summaries, raster->dim, &summary) == GHT_OK )
+        {
+            ght_raster_add(raster, pixel, 1, 0.0, summary->min, summary->max);
+            return GHT_OK;
+        }
+    }
+
+    /* Otherwise total up the subtree, weighting compacted values */
+    {
+        GhtAttributeStats stats[raster->schema->num_dims];
+        const GhtAttributeStats *s = &(stats[raster->dim->position]);
+        memset(stats, 0, sizeof(stats));
+        ght_attribute_stats_reset(stats, raster->schema);
+        GHT_TRY(ght_node_get_stats(node, hash, raster->schema->num_dims, stats, &count));
+        ght_raster_add(raster, pixel, s->count, s->sum, s->min, s->max);
+    }
+    return GHT_OK;
+}
+
+static GhtErr
+ght_node_rasterize(const GhtNode *node, GhtRaster *raster, GhtLeaf *leaf)
+{
+    GhtHash parent[GHT_MAX_HASH_LENGTH + 1];
+    size_t hash_len = strlen(leaf->hash);
+    GhtErr err = GHT_OK;
+    GhtArea area;
+    int i, pixel;
+
+    /* Add our part of the hash and attributes to the path */
+    if ( leaf->depth >= GHT_LEAF_MAX_DEPTH ||
+         (node->hash && hash_len + strlen(node->hash) > GHT_MAX_HASH_LENGTH) )
+    {
+        ght_error("%s: tree is deeper than the longest hash", __func__);
+        return GHT_ERROR;
+    }
+    strcpy(parent, leaf->hash);
+    if ( node->hash )
+        strcat(leaf->hash, node->hash);
+    leaf->attributes[leaf->depth++] = node->attributes;
+
+    if ( (! node->children) || node->children->num_nodes == 0 )
+    {
+        GhtCoordinate coord;
+        double val;
+        err = ght_coordinate_from_hash(leaf->hash, &coord);
+        pixel = ght_raster_pixel(raster, coord.x, coord.y);
+        if ( err == GHT_OK && pixel >= 0 )
+        {
+            if ( raster->agg == GHT_AGG_COUNT )
+                ght_raster_add(raster, pixel, 1, 0.0, 0.0, 0.0);
+            else if ( ght_leaf_get_value(leaf, raster->dim, &val) == GHT_OK )
+                ght_raster_add(raster, pixel, 1, val, val, val);
+        }
+        goto done;
+    }
+
+    /* Skip cells off the grid, and take cells inside one pixel whole */
+    err = ght_area_from_hash(leaf->hash, &area);
+    if ( err != GHT_OK ||
+         area.x.min > raster->extent.x.max || area.x.max < raster->extent.x.min ||
+         area.y.min > raster->extent.y.max || area.y.max < raster->extent.y.min )
+        goto done;
+    pixel = ght_raster_pixel(raster, area.x.min, area.y.max);
+    if ( pixel >= 0 && pixel == ght_raster_pixel(raster, area.x.max, area.y.min) )
+    {
+        err = ght_raster_add_node(raster, pixel, node, leaf, parent);
+        goto done;
+    }
+
+    for ( i = 0; err == GHT_OK && i < node->children->num_nodes; i++ )
+    {
+        err = ght_node_rasterize(node->children->nodes[i], raster, leaf);
+    }
+
+done:
+    leaf->depth--;
+    leaf->hash[hash_len] = '\0';
+    return err;
+}
+
+/**
+* Aggregate the values of a dimension over an nx by ny grid covering
+* extent, writing nx * ny values into out, row by row from the top
+* (maximum y) down. Points go in the pixel holding their coordinate.
+* Pixels with no values are zero for counts and sums, and NaN for the
+* other aggregates. The dimension is ignored for GHT_AGG_COUNT.
+*/
+GhtErr
+ght_tree_rasterize(const GhtTree *tree, const GhtArea *extent, int nx, int ny, const char *dimname, GhtAggregate agg, double *out)
+{
+    GhtRaster raster;
+    GhtDimension *dim = NULL;
+    GhtLeaf leaf;
+    GhtErr err = GHT_OK;
+    int i;
+
+    if ( ! tree || ! extent || ! out || nx <= 0 || ny <= 0 ||
+         extent->x.max <= extent->x.min || extent->y.max <= extent->y.min )
+    {
+        ght_error("%s: empty raster requested", __func__);
+        return GHT_ERROR;
+    }
+    if ( agg != GHT_AGG_COUNT && ght_schema_get_dimension_by_name(tree->schema, dimname, &dim) != GHT_OK )
+    {
+        ght_error("%s: unable to find dimension '%s'", __func__, dimname ? dimname : "");
+        return GHT_ERROR;
+    }
+
+    memset(&raster, 0, sizeof(GhtRaster));
+    raster.schema = tree->schema;
+    raster.dim = dim;
+    raster.agg = agg;
+    raster.extent = *extent;
+    raster.nx = nx;
+    raster.ny = ny;
+    raster.values = out;
+    raster.counts = ght_malloc(nx * ny * sizeof(double));
+    memset(raster.counts, 0, nx * ny * sizeof(double));
+    for ( i = 0; i < nx * ny; i++ )
+        out[i] = 0.0;
+
+    if ( tree->root )
+    {
+        memset(&leaf, 0, sizeof(GhtLeaf));
+        err = ght_node_rasterize(tree->root, &raster, &leaf);
+    }
+
+    for ( i = 0; i < nx * ny; i++ )
+    {
+        if ( agg == GHT_AGG_MEAN && raster.counts[i] )
+            out[i] /= raster.counts[i];
+        else if ( (agg == GHT_AGG_MEAN || agg == GHT_AGG_MIN || agg == GHT_AGG_MAX) && ! raster.counts[i] )
+            out[i] = NAN;
+    }
+    ght_free(raster.counts);
+    return err;
+}
@@ -0,0 +1,304 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+/**
+* Archives hold many trees sharing one schema in a single file:
+* - magic "GHTA", endianness, archive version
+* - schema, in binary form
+* - tiles, each a complete serialized GhtTree
+* - tile directory: number of tiles, then for each tile the root
+*   hash, extent (xmin, xmax, ymin, ymax), offset and size
+* - trailer: offset of the tile directory, magic "GHTA"
+*/
+
+#include "ght_internal.h"
+
+char machine_endian(void); /* from ght_util.c */
+
+static const char GhtArchiveMagic[4] = { 'G', 'H', 'T', 'A' };
+
+#define GHT_ARCHIVE_TRAILER_SIZE 12
+
+GhtErr
+ght_archive_writer_new(const char *filename, const GhtSchema *schema, GhtArchiveWriter **archive)
+{
+    GhtArchiveWriter *a;
+    GhtWriter *writer;
+    char endian = machine_endian();
+    uint8_t version = GHT_ARCHIVE_VERSION;
+
+    GHT_TRY(ght_writer_new_file(filename, &writer));
+    a = ght_malloc(sizeof(GhtArchiveWriter));
+    memset(a, 0, sizeof(GhtArchiveWriter));
+    a->writer = writer;
+    a->schema = schema;
+
+    GHT_TRY(ght_write(writer, GhtArchiveMagic, 4));
+    GHT_TRY(ght_write(writer, &endian, 1));
+    GHT_TRY(ght_write(writer, &version, 1));
+    GHT_TRY(ght_schema_write(schema, writer));
+
+    *archive = a;
+    return GHT_OK;
+}
+
+GhtErr
+ght_archive_writer_set_codec(GhtArchiveWriter *archive, GhtCodec codec)
+{
+    return ght_writer_set_codec(archive->writer, codec);
+}
+
+GhtErr
+ght_archive_writer_set_delta(GhtArchiveWriter *archive, int delta)
+{
+    return ght_writer_set_delta(archive->writer, delta);
+}
+
+GhtErr
+ght_archive_writer_add_tree(GhtArchiveWriter *archive, const GhtTree *tree)
+{
+    GhtTile *tile;
+    GhtHash *hash;
+    size_t start, end;
+    int same;
+
+    GHT_TRY(ght_schema_same(archive->schema, tree->schema, &same));
+    if ( ! same )
+    {
+        ght_error("%s: tree schema does not match archive schema", __func__);
+        return GHT_ERROR;
+    }
+
+    if ( archive->num_tiles == archive->max_tiles )
+    {
+        archive->max_tiles = archive->max_tiles ? 2 * archive->max_tiles : 16;
+        archive->tiles = ght_realloc(archive->tiles, archive->max_tiles * sizeof(GhtTile));
+    }
+    tile = &(archive->tiles[archive->num_tiles]);
+    memset(tile, 0, sizeof(GhtTile));
+
+    GHT_TRY(ght_writer_get_size(archive->writer, &start));
+    GHT_TRY(ght_tree_write(tree, archive->writer));
+    GHT_TRY(ght_writer_get_size(archive->writer, &end));
+
+    if ( ght_tree_get_hash(tree, &hash) == GHT_OK )
+        GHT_TRY(ght_hash_clone(hash, &(tile->hash)));
+    GHT_TRY(ght_tree_get_extent(tree, &(tile->area)));
+    tile->offset = start;
+    tile->size = end - start;
+    archive->num_tiles++;
+    return GHT_OK;
+}
+
+/** Write out the tile directory and trailer, and free the archive */
+GhtErr
+ght_archive_writer_close(GhtArchiveWriter *archive)
+{
+    int i;
+    size_t directory;
+    uint64_t directory_offset;
+    uint32_t num_tiles = archive->num_tiles;
+
+    GHT_TRY(ght_writer_get_size(archive->writer, &directory));
+    directory_offset = directory;
+
+    GHT_TRY(ght_write(archive->writer, &num_tiles, 4));
+    for ( i = 0; i < archive->num_tiles; i++ )
+    {
+        GhtTile *tile = &(archive->tiles[i]);
+        GHT_TRY(ght_hash_write(tile->hash, archive->writer));
+        GHT_TRY(ght_write(archive->writer, &(tile->area.x.min), 8));
+        GHT_TRY(ght_write(archive->writer, &(tile->area.x.max), 8));
+        GHT_TRY(ght_write(archive->writer, &(tile->area.y.min), 8));
+        GHT_TRY(ght_write(archive->writer, &(tile->area.y.max), 8));
+        GHT_TRY(ght_write(archive->writer, &(tile->offset), 8));
+        GHT_TRY(ght_write(archive->writer, &(tile->size), 8));
+        if ( tile->hash )
+            ght_hash_free(tile->hash);
+    }
+    GHT_TRY(ght_write(archive->writer, &directory_offset, 8));
+    GHT_TRY(ght_write(archive->writer, GhtArchiveMagic, 4));
+
+    GHT_TRY(ght_writer_free(archive->writer));
+    if ( archive->tiles )
+        ght_free(archive->tiles);
+    ght_free(archive);
+    return GHT_OK;
+}
+
+GhtErr
+ght_archive_reader_new(const char *filename, GhtArchiveReader **archive)
+{
+    int i;
+    GhtArchiveReader *a;
+    GhtReader *reader;
+    char magic[4];
+    char endian;
+    uint8_t version;
+    uint32_t num_tiles;
+    uint64_t directory_offset;
+    size_t size;
+
+    GHT_TRY(ght_reader_new_file(filename, NULL, &reader));
+
+    if ( ght_read(reader, magic, 4) != GHT_OK ||
+         ght_read(reader, &endian, 1) != GHT_OK ||
+         ght_read(reader, &version, 1) != GHT_OK )
+    {
+        ght_reader_free(reader);
+        return GHT_ERROR;
+    }
+    if ( memcmp(magic, GhtArchiveMagic, 4) )
+    {
+        ght_reader_free(reader);
+        ght_error("%s: %s is not a GHT archive", __func__, filename);
+        return GHT_ERROR;
+    }
+    if ( endian != machine_endian() )
+    {
+        ght_reader_free(reader);
+        ght_error("%s: %s was written with %s-endian byte order, this machine is %s-endian", __func__, filename,
+                  endian ? "little" : "big", machine_endian() ? "little" : "big");
+        return GHT_ERROR;
+    }
+    if ( version != GHT_ARCHIVE_VERSION )
+    {
+        ght_reader_free(reader);
+        ght_error("%s: unsupported GHT archive version %d", __func__, version);
+        return GHT_ERROR;
+    }
+
+    /* From here on the archive owns the reader, and frees it with everything else */
+    a = ght_malloc(sizeof(GhtArchiveReader));
+    if ( ! a )
+    {
+        ght_reader_free(reader);
+        return GHT_ERROR;
+    }
+    memset(a, 0, sizeof(GhtArchiveReader));
+    a->reader = reader;
+    if ( ght_schema_read_interned(reader, &(a->schema)) != GHT_OK )
+        goto fail;
+    reader->schema = a->schema;
+
+    /* Find the tile directory from the trailer */
+    if ( ght_reader_get_size(reader, &size) != GHT_OK ||
+         ght_reader_seek(reader, size - GHT_ARCHIVE_TRAILER_SIZE) != GHT_OK ||
+         ght_read(reader, &directory_offset, 8) != GHT_OK ||
+         ght_read(reader, magic, 4) != GHT_OK )
+        goto fail;
+    if ( memcmp(magic, GhtArchiveMagic, 4) )
+    {
+        ght_error("%s: %s is truncated, no tile directory", __func__, filename);
+        goto fail;
+    }
+
+    if ( ght_reader_seek(reader, directory_offset) != GHT_OK ||
+         ght_read(reader, &num_tiles, 4) != GHT_OK )
+        goto fail;
+    a->tiles = ght_malloc((num_tiles ? num_tiles : 1) * sizeof(GhtTile));
+    if ( ! a->tiles )
+        goto fail;
+    memset(a->tiles, 0, (num_tiles ? num_tiles : 1) * sizeof(GhtTile));
+    a->num_tiles = num_tiles;
+    for ( i = 0; i < a->num_tiles; i++ )
+    {
+        GhtTile *tile = &(a->tiles[i]);
+        if ( ght_hash_read(reader, &(tile->hash)) != GHT_OK ||
+             ght_read(reader, &(tile->area.x.min), 8) != GHT_OK ||
+             ght_read(reader, &(tile->area.x.max), 8) != GHT_OK ||
+             ght_read(reader, &(tile->area.y.min), 8) != GHT_OK ||
+             ght_read(reader, &(tile->area.y.max), 8) != GHT_OK ||
+             ght_read(reader, &(tile->offset), 8) != GHT_OK ||
+             ght_read(reader, &(tile->size), 8) != GHT_OK )
+            goto fail;
+    }
+
+    *archive = a;
+    return GHT_OK;
+
+fail:
+    ght_archive_reader_free(a);
+    return GHT_ERROR;
+}
+
+GhtErr
+ght_archive_reader_free(GhtArchiveReader *archive)
+{
+    int i;
+    for ( i = 0; i < archive->num_tiles; i++ )
+    {
+        if ( archive->tiles[i].hash )
+            ght_hash_free(archive->tiles[i].hash);
+    }
+    if ( archive->tiles )
+        ght_free(archive->tiles);
+    if ( archive->reader )
+        ght_reader_free(archive->reader);
+    ght_free(archive);
+    return GHT_OK;
+}
+
+GhtErr
+ght_archive_get_schema(const GhtArchiveReader *archive, const GhtSchema **schema)
+{
+    *schema = archive->schema;
+    return GHT_OK;
+}
+
+GhtErr
+ght_archive_get_num_tiles(const GhtArchiveReader *archive, int *num_tiles)
+{
+    *num_tiles = archive->num_tiles;
+    return GHT_OK;
+}
+
+GhtErr
+ght_archive_get_tile_area(const GhtArchiveReader *archive, int tile, GhtArea *area)
+{
+    if ( tile < 0 || tile >= archive->num_tiles )
+        return GHT_ERROR;
+    *area = archive->tiles[tile].area;
+    return GHT_OK;
+}
+
+/** Fill a freshly allocated array with the numbers of the tiles that intersect the area */
+GhtErr
+ght_archive_query_area(const GhtArchiveReader *archive, const GhtArea *area, int **tiles, int *num_tiles)
+{
+    int i, n = 0;
+    int *t = ght_malloc((archive->num_tiles ? archive->num_tiles : 1) * sizeof(int));
+
+    for ( i = 0; i < archive->num_tiles; i++ )
+    {
+        const GhtArea *a = &(archive->tiles[i].area);
+        if ( a->x.min > area->x.max || a->x.max < area->x.min ||
+             a->y.min > area->y.max || a->y.max < area->y.min )
+            continue;
+        t[n++] = i;
+    }
+
+    *tiles = t;
+    *num_tiles = n;
+    return GHT_OK;
+}
+
+/** Read one tile from the archive, the tree uses the shared archive schema */
+GhtErr
+ght_archive_read_tile(GhtArchiveReader *archive, int tile, GhtTree **tree)
+{
+    if ( tile < 0 || tile >= archive->num_tiles )
+    {
+        ght_error("%s: tile %d does not exist", __func__, tile);
+        return GHT_ERROR;
+    }
+    GHT_TRY(ght_reader_seek(archive->reader, archive->tiles[tile].offset));
+    return ght_tree_read(archive->reader, tree);
+}
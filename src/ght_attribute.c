@@ -312,6 +312,124 @@ GhtErr ght_attribute_set_value(GhtAttribute *attr, double val)
     return GHT_OK;
 }
 
+GhtErr ght_attribute_get_integer(const GhtAttribute *attr, int64_t *val)
+{
+    const GhtType type = attr->dim->type;
+    size_t size = GhtTypeSizes[type];
+    switch(type)
+    {
+        case GHT_INT8:
+        {
+            int8_t v;
+            memcpy(&v, attr->val, size);
+            *val = v;
+            return GHT_OK;
+        }
+        case GHT_UINT8:
+        {
+            uint8_t v;
+            memcpy(&v, attr->val, size);
+            *val = v;
+            return GHT_OK;
+        }
+        case GHT_INT16:
+        {
+            int16_t v;
+            memcpy(&v, attr->val, size);
+            *val = v;
+            return GHT_OK;
+        }
+        case GHT_UINT16:
+        {
+            uint16_t v;
+            memcpy(&v, attr->val, size);
+            *val = v;
+            return GHT_OK;
+        }
+        case GHT_INT32:
+        {
+            int32_t v;
+            memcpy(&v, attr->val, size);
+            *val = v;
+            return GHT_OK;
+        }
+        case GHT_UINT32:
+        {
+            uint32_t v;
+            memcpy(&v, attr->val, size);
+            *val = v;
+            return GHT_OK;
+        }
+        case GHT_INT64:
+        case GHT_UINT64:
+        {
+            /* Unsigned values past INT64_MAX wrap, which is harmless for deltas */
+            memcpy(val, attr->val, size);
+            return GHT_OK;
+        }
+        default:
+        {
+            return GHT_ERROR;
+        }
+    }
+}
+
+GhtErr ght_attribute_set_integer(GhtAttribute *attr, int64_t val)
+{
+    const GhtType type = attr->dim->type;
+    size_t size = GhtTypeSizes[type];
+    switch(type)
+    {
+        case GHT_INT8:
+        {
+            int8_t v = val;
+            memcpy(attr->val, &v, size);
+            return GHT_OK;
+        }
+        case GHT_UINT8:
+        {
+            uint8_t v = val;
+            memcpy(attr->val, &v, size);
+            return GHT_OK;
+        }
+        case GHT_INT16:
+        {
+            int16_t v = val;
+            memcpy(attr->val, &v, size);
+            return GHT_OK;
+        }
+        case GHT_UINT16:
+        {
+            uint16_t v = val;
+            memcpy(attr->val, &v, size);
+            return GHT_OK;
+        }
+        case GHT_INT32:
+        {
+            int32_t v = val;
+            memcpy(attr->val, &v, size);
+            return GHT_OK;
+        }
+        case GHT_UINT32:
+        {
+            uint32_t v = val;
+            memcpy(attr->val, &v, size);
+            return GHT_OK;
+        }
+        case GHT_INT64:
+        case GHT_UINT64:
+        {
+            memcpy(attr->val, &val, size);
+            return GHT_OK;
+        }
+        default:
+        {
+            ght_error("%s: attribute type %d is not an integer", __func__, type);
+            return GHT_ERROR;
+        }
+    }
+}
+
 GhtErr ght_attribute_to_string(const GhtAttribute *attr, stringbuffer_t *sb)
 {
     double d;
@@ -326,15 +444,40 @@ GhtErr ght_attribute_get_size(const GhtAttribute *attr, size_t *sz)
     return GHT_OK;
 }
 
+/* Map signed deltas onto unsigned ones, so small negatives stay small */
+static uint64_t
+ght_zigzag_encode(int64_t val)
+{
+    return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+}
+
+static int64_t
+ght_zigzag_decode(uint64_t val)
+{
+    return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
 GhtErr ght_attribute_write(const GhtAttribute *attr, GhtWriter *writer)
 {
     uint8_t position;
     size_t attrsize;
     uint8_t buffer[128];
     uint8_t *ptr = buffer;
+    GhtAttribute ref;
     GHT_TRY(ght_dimension_get_position(attr->dim, &position));
     GHT_TRY(ght_attribute_get_size(attr, &attrsize));
 
+    /* Delta against the reference value the parent node wrote out */
+    if ( (writer->flags & GHT_FLAG_DELTA) && 
+         ght_attribute_get_by_dimension(writer->refs, attr->dim, &ref) == GHT_OK )
+    {
+        int64_t v, refv;
+        GHT_TRY(ght_attribute_get_integer(attr, &v));
+        GHT_TRY(ght_attribute_get_integer(&ref, &refv));
+        GHT_TRY(ght_write(writer, &position, 1));
+        return ght_write_varint(writer, ght_zigzag_encode((int64_t)((uint64_t)v - (uint64_t)refv)));
+    }
+
     /* Write in dimension position number */
     memcpy(ptr, &position, 1);
     ptr++;
@@ -351,6 +494,7 @@ GhtErr ght_attribute_read(GhtReader *reader, GhtAttribute **attr)
     uint8_t dimnum;
     GhtDimension *dim;
     GhtAttribute *a;
+    GhtAttribute ref;
     const GhtSchema *schema = reader->schema;
 
     ght_read(reader, &dimnum, 1);
@@ -366,7 +510,21 @@ GhtErr ght_attribute_read(GhtReader *reader, GhtAttribute **attr)
     memset(a, 0, sizeof(GhtAttribute));
     a->dim = dim;
     a->next = NULL;
-    ght_read(reader, a->val, GhtTypeSizes[dim->type]);
+    
+    /* Delta against the reference value the parent node read in */
+    if ( (reader->flags & GHT_FLAG_DELTA) && 
+         ght_attribute_get_by_dimension(reader->refs, dim, &ref) == GHT_OK )
+    {
+        int64_t refv;
+        uint64_t delta;
+        GHT_TRY(ght_attribute_get_integer(&ref, &refv));
+        GHT_TRY(ght_read_varint(reader, &delta));
+        GHT_TRY(ght_attribute_set_integer(a, (int64_t)((uint64_t)refv + (uint64_t)ght_zigzag_decode(delta))));
+    }
+    else
+    {
+        ght_read(reader, a->val, GhtTypeSizes[dim->type]);
+    }
     *attr = a;
     return GHT_OK;
 }
@@ -0,0 +1,188 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+#include "ght_internal.h"
+#include <strings.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+static char *GhtCodecStrings[] =
+{
+    "none", "zlib", "zstd", "lz4"
+};
+
+#define GHT_NUM_CODECS 4
+
+GhtErr
+ght_codec_from_str(const char *str, GhtCodec *codec)
+{
+    int i;
+    for ( i = 0; i < GHT_NUM_CODECS; i++ )
+    {
+        if ( strcasecmp(str, GhtCodecStrings[i]) == 0 )
+        {
+            *codec = i;
+            return GHT_OK;
+        }
+    }
+    return GHT_ERROR;
+}
+
+GhtErr
+ght_codec_available(GhtCodec codec, int *available)
+{
+    switch ( codec )
+    {
+        case GHT_CODEC_NONE:
+        case GHT_CODEC_ZLIB:
+            *available = 1;
+            break;
+#ifdef HAVE_ZSTD
+        case GHT_CODEC_ZSTD:
+            *available = 1;
+            break;
+#endif
+#ifdef HAVE_LZ4
+        case GHT_CODEC_LZ4:
+            *available = 1;
+            break;
+#endif
+        default:
+            *available = 0;
+    }
+    return GHT_OK;
+}
+
+GhtErr
+ght_codec_compress(GhtCodec codec, const uint8_t *bytes, size_t bytes_size, uint8_t **out, size_t *out_size)
+{
+    uint8_t *buf = NULL;
+    size_t buf_size = 0;
+
+    switch ( codec )
+    {
+        case GHT_CODEC_NONE:
+        {
+            buf_size = bytes_size;
+            buf = ght_malloc(buf_size ? buf_size : 1);
+            memcpy(buf, bytes, bytes_size);
+            break;
+        }
+        case GHT_CODEC_ZLIB:
+        {
+            uLongf zsize = compressBound(bytes_size);
+            buf = ght_malloc(zsize);
+            if ( compress2(buf, &zsize, bytes, bytes_size, Z_DEFAULT_COMPRESSION) != Z_OK )
+            {
+                ght_free(buf);
+                ght_error("%s: zlib compression failed", __func__);
+                return GHT_ERROR;
+            }
+            buf_size = zsize;
+            break;
+        }
+#ifdef HAVE_ZSTD
+        case GHT_CODEC_ZSTD:
+        {
+            size_t zsize = ZSTD_compressBound(bytes_size);
+            buf = ght_malloc(zsize);
+            buf_size = ZSTD_compress(buf, zsize, bytes, bytes_size, 3);
+            if ( ZSTD_isError(buf_size) )
+            {
+                ght_free(buf);
+                ght_error("%s: zstd compression failed, %s", __func__, ZSTD_getErrorName(buf_size));
+                return GHT_ERROR;
+            }
+            break;
+        }
+#endif
+#ifdef HAVE_LZ4
+        case GHT_CODEC_LZ4:
+        {
+            int zsize = LZ4_compressBound(bytes_size);
+            int csize;
+            buf = ght_malloc(zsize);
+            csize = LZ4_compress_default((const char*)bytes, (char*)buf, bytes_size, zsize);
+            if ( csize <= 0 )
+            {
+                ght_free(buf);
+                ght_error("%s: lz4 compression failed", __func__);
+                return GHT_ERROR;
+            }
+            buf_size = csize;
+            break;
+        }
+#endif
+        default:
+        {
+            ght_error("%s: codec %d is not available in this build", __func__, codec);
+            return GHT_ERROR;
+        }
+    }
+
+    *out = buf;
+    *out_size = buf_size;
+    return GHT_OK;
+}
+
+GhtErr
+ght_codec_decompress(GhtCodec codec, const uint8_t *bytes, size_t bytes_size, uint8_t *out, size_t out_size)
+{
+    switch ( codec )
+    {
+        case GHT_CODEC_NONE:
+        {
+            if ( bytes_size != out_size )
+                break;
+            memcpy(out, bytes, bytes_size);
+            return GHT_OK;
+        }
+        case GHT_CODEC_ZLIB:
+        {
+            uLongf zsize = out_size;
+            if ( uncompress(out, &zsize, bytes, bytes_size) != Z_OK || zsize != out_size )
+                break;
+            return GHT_OK;
+        }
+#ifdef HAVE_ZSTD
+        case GHT_CODEC_ZSTD:
+        {
+            size_t zsize = ZSTD_decompress(out, out_size, bytes, bytes_size);
+            if ( ZSTD_isError(zsize) || zsize != out_size )
+                break;
+            return GHT_OK;
+        }
+#endif
+#ifdef HAVE_LZ4
+        case GHT_CODEC_LZ4:
+        {
+            int zsize = LZ4_decompress_safe((const char*)bytes, (char*)out, bytes_size, out_size);
+            if ( zsize < 0 || zsize != out_size )
+                break;
+            return GHT_OK;
+        }
+#endif
+        default:
+        {
+            ght_error("%s: codec %d is not available in this build", __func__, codec);
+            return GHT_ERROR;
+        }
+    }
+
+    ght_error("%s: corrupt %s block", __func__, GhtCodecStrings[codec]);
+    return GHT_ERROR;
+}
@@ -9,7 +9,7 @@
 ******************************************************************************/
 
 #define GHT_MAX_HASH_LENGTH    18
-#define GHT_FORMAT_VERSION      1
+#define GHT_FORMAT_VERSION      2
 
 
 /***********************************************************************
@@ -36,6 +36,32 @@ typedef enum
     GHT_DOUBLE  = 9,  GHT_FLOAT  = 10
 } GhtType;
 
+typedef enum
+{
+    GHT_CODEC_NONE = 0,
+    GHT_CODEC_ZLIB = 1,
+    GHT_CODEC_ZSTD = 2,
+    GHT_CODEC_LZ4  = 3
+} GhtCodec;
+
+/* How a hash cell is reduced to one point when sampling */
+typedef enum
+{
+    GHT_SAMPLE_FIRST = 0,     /* the first point in the cell */
+    GHT_SAMPLE_CENTROID = 1,  /* the centroid, with the values of the first point */
+    GHT_SAMPLE_AVERAGE = 2    /* the centroid, with the mean of each dimension */
+} GhtSampleMode;
+
+/* How the values falling in one raster cell are combined */
+typedef enum
+{
+    GHT_AGG_COUNT = 0,
+    GHT_AGG_SUM = 1,
+    GHT_AGG_MIN = 2,
+    GHT_AGG_MAX = 3,
+    GHT_AGG_MEAN = 4
+} GhtAggregate;
+
 #define GHT_TRY(functioncall) { if ( (functioncall) == GHT_ERROR ) { return GHT_ERROR; } }
 
 typedef struct
@@ -62,14 +88,99 @@ typedef struct
     unsigned char  max_hash_length;
     unsigned char  version;
     unsigned char  endian;
+    unsigned char  summaries;
 } GhtConfig;
 
+/*
+* Statistics of one dimension over a set of points. To also get a
+* histogram, point bins at num_bins counters and set the range they
+* divide evenly before asking, values outside the range are not binned.
+*/
+typedef struct
+{
+    double min;
+    double max;
+    double sum;
+    int count;
+    GhtType type;
+    const struct GhtDimension_t *dim;
+    GhtRange range;
+    int num_bins;
+    int *bins;
+} GhtAttributeStats;
+
+/*
+* Work done by the calling thread since the last reset, counted only
+* by libraries built with GHT_ENABLE_STATS.
+*/
+typedef struct
+{
+    size_t nodes_allocated;
+    size_t splits;
+    size_t descents;
+    size_t duplicates;
+    size_t bytes_read;
+    size_t bytes_written;
+    size_t attributes_compacted;
+    double hash_seconds;
+    double insert_seconds;
+    double compact_seconds;
+    double write_seconds;
+    double read_seconds;
+} GhtStats;
+
+/* Deepest level and widest fan-out a tree profile tells apart */
+#define GHT_PROFILE_MAX_DEPTH  (GHT_MAX_HASH_LENGTH + 2)
+#define GHT_PROFILE_MAX_FANOUT 32
+
+/*
+* Shape and memory use of a tree. Histograms count nodes, by depth
+* (the root is at zero), by number of children (the last bin holds
+* that many or more) and by length of their own hash fragment. Proxy
+* nodes hold duplicate points and have no hash. Bytes are as asked of
+* the allocator, without its own overhead.
+*/
+typedef struct
+{
+    int num_nodes;
+    int num_leaves;
+    int num_proxies;
+    int num_attributes;
+    int max_depth;
+    int depth[GHT_PROFILE_MAX_DEPTH];
+    int depth_attributes[GHT_PROFILE_MAX_DEPTH];
+    int fanout[GHT_PROFILE_MAX_FANOUT + 1];
+    int fragment_length[GHT_MAX_HASH_LENGTH + 1];
+    size_t node_bytes;
+    size_t hash_bytes;
+    size_t attribute_bytes;
+    size_t nodelist_bytes;
+    size_t summary_bytes;
+    size_t sample_bytes;
+} GhtTreeProfile;
+
 /* So we can alias char* to GhtHash* */
 typedef char GhtHash;
 
+/* One point of a tree, visited in place without copying */
+typedef struct GhtLeaf_t GhtLeaf;
+
+/* Called for each point visited, return GHT_DONE to stop early */
+typedef GhtErr (*GhtLeafCallback)(const GhtLeaf *leaf, void *data);
+
+/* Called with each point of a tree and its nearest neighbours, numbered in tree order */
+typedef GhtErr (*GhtKnnCallback)(int point, const GhtCoordinate *coord, int num_neighbours, const int *neighbours, const double *distances, void *data);
+
+/* Called with the statistics of each dimension for the points of one hash cell */
+typedef GhtErr (*GhtStatsCallback)(const GhtHash *prefix, int num_dims, const GhtAttributeStats *stats, void *data);
+
 /* Access version information */
 int ght_version_major(void);
 int ght_version_minor(void);
 int ght_version_patch(void);
 char * ght_version(void);
 
+/* Read and clear the counters of the calling thread, GHT_ERROR if they are not built in */
+GhtErr ght_stats_get(GhtStats *stats);
+GhtErr ght_stats_reset(void);
+
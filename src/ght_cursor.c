@@ -0,0 +1,287 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+/**
+* Cursors read the points of a tree one at a time, in hash order,
+* without copying them. The only state is the path from the root to
+* the current point, so a cursor costs the same for any size of tree.
+* Siblings never share a first hash character, so visiting children by
+* that character gives hash order. Duplicates have no hash, and come
+* in the order they were added. The leaf counts on the nodes let a
+* cursor jump straight to any rank.
+*/
+
+#include "ght_internal.h"
+#include <limits.h>
+
+/** Ordering of a child amongst its siblings */
+static int
+ght_cursor_key(const GhtNode *node)
+{
+    return node->hash ? (unsigned char)(node->hash[0]) : 0;
+}
+
+/** Child of node after child i in hash order, the first if i is -1, or -1 after the last */
+static int
+ght_cursor_next_child(const GhtNode *node, int i)
+{
+    const GhtNodeList *children = node->children;
+    int key = i < 0 ? -1 : ght_cursor_key(children->nodes[i]);
+    int best = -1, best_key = INT_MAX;
+    int j;
+
+    /* Runs of duplicates are already in order */
+    if ( key == 0 && i + 1 < children->num_nodes && ght_cursor_key(children->nodes[i+1]) == 0 )
+        return i + 1;
+
+    for ( j = 0; j < children->num_nodes; j++ )
+    {
+        int k = ght_cursor_key(children->nodes[j]);
+        if ( (k > key || (k == key && j > i)) && k < best_key )
+        {
+            best = j;
+            best_key = k;
+        }
+    }
+    return best;
+}
+
+/** Add a node to the end of the path */
+static GhtErr
+ght_cursor_push(GhtTreeCursor *cursor, const GhtNode *node, int index)
+{
+    GhtLeaf *leaf = &(cursor->leaf);
+    size_t hash_len = strlen(leaf->hash);
+
+    if ( leaf->depth >= GHT_LEAF_MAX_DEPTH ||
+         (node->hash && hash_len + strlen(node->hash) > GHT_MAX_HASH_LENGTH) )
+    {
+        ght_error("%s: tree is deeper than the longest hash", __func__);
+        return GHT_ERROR;
+    }
+    if ( node->hash )
+        strcat(leaf->hash, node->hash);
+    cursor->nodes[leaf->depth] = node;
+    cursor->index[leaf->depth] = index;
+    cursor->hash_len[leaf->depth] = hash_len;
+    leaf->attributes[leaf->depth++] = node->attributes;
+    return GHT_OK;
+}
+
+static void
+ght_cursor_pop(GhtTreeCursor *cursor)
+{
+    GhtLeaf *leaf = &(cursor->leaf);
+    leaf->depth--;
+    leaf->hash[cursor->hash_len[leaf->depth]] = '\0';
+}
+
+/** Follow the first children down from the end of the path to a leaf */
+static GhtErr
+ght_cursor_descend(GhtTreeCursor *cursor)
+{
+    const GhtNode *node = cursor->nodes[cursor->leaf.depth - 1];
+    while ( ! ght_node_is_leaf(node) )
+    {
+        int i = ght_cursor_next_child(node, -1);
+        node = node->children->nodes[i];
+        GHT_TRY(ght_cursor_push(cursor, node, i));
+    }
+    return GHT_OK;
+}
+
+/** Pass over the subtree at the end of the path, moving to the root of the next one */
+static GhtErr
+ght_cursor_skip(GhtTreeCursor *cursor)
+{
+    cursor->rank += cursor->nodes[cursor->leaf.depth - 1]->num_leaves;
+    while ( cursor->leaf.depth > 1 )
+    {
+        const GhtNode *parent = cursor->nodes[cursor->leaf.depth - 2];
+        int i = ght_cursor_next_child(parent, cursor->index[cursor->leaf.depth - 1]);
+        ght_cursor_pop(cursor);
+        if ( i >= 0 )
+            return ght_cursor_push(cursor, parent->children->nodes[i], i);
+    }
+    cursor->done = 1;
+    return GHT_OK;
+}
+
+/** Empty the path, and start it again at the root */
+static GhtErr
+ght_cursor_reset(GhtTreeCursor *cursor)
+{
+    memset(&(cursor->leaf), 0, sizeof(GhtLeaf));
+    cursor->rank = 0;
+    cursor->started = 0;
+    cursor->done = 0;
+    if ( ! cursor->tree->root )
+    {
+        cursor->done = 1;
+        return GHT_OK;
+    }
+    return ght_cursor_push(cursor, cursor->tree->root, 0);
+}
+
+/**
+* Start a cursor at the first point of the tree. The tree must not
+* change while the cursor is in use.
+*/
+GhtErr
+ght_tree_cursor_new(const GhtTree *tree, GhtTreeCursor **cursor)
+{
+    GhtTreeCursor *c;
+
+    if ( ! tree || ! cursor )
+        return GHT_ERROR;
+
+    c = ght_malloc(sizeof(GhtTreeCursor));
+    memset(c, 0, sizeof(GhtTreeCursor));
+    c->tree = tree;
+    c->context = ght_context_get_current();
+    if ( ght_cursor_reset(c) != GHT_OK || (! c->done && ght_cursor_descend(c) != GHT_OK) )
+    {
+        ght_free(c);
+        return GHT_ERROR;
+    }
+    *cursor = c;
+    return GHT_OK;
+}
+
+GhtErr
+ght_tree_cursor_free(GhtTreeCursor *cursor)
+{
+    GhtContext *context;
+    if ( ! cursor )
+        return GHT_ERROR;
+    context = ght_context_swap(cursor->context);
+    ght_free(cursor);
+    ght_context_swap(context);
+    return GHT_OK;
+}
+
+/**
+* Read the next point, which stays valid until the cursor moves again.
+* Returns GHT_DONE once every point has been read.
+*/
+GhtErr
+ght_tree_cursor_next(GhtTreeCursor *cursor, const GhtLeaf **leaf)
+{
+    if ( ! cursor || ! leaf )
+        return GHT_ERROR;
+
+    /* Move off the point handed out last time */
+    if ( cursor->started && ! cursor->done )
+    {
+        GHT_TRY(ght_cursor_skip(cursor));
+        if ( ! cursor->done )
+            GHT_TRY(ght_cursor_descend(cursor));
+    }
+    cursor->started = 1;
+
+    if ( cursor->done )
+        return GHT_DONE;
+    *leaf = &(cursor->leaf);
+    return GHT_OK;
+}
+
+/**
+* Move the cursor so the next point read is the first one whose hash
+* is not less than prefix, which is the first point inside prefix if
+* there are any.
+*/
+GhtErr
+ght_tree_cursor_seek_prefix(GhtTreeCursor *cursor, const GhtHash *prefix)
+{
+    size_t prefix_len;
+
+    if ( ! cursor || ! prefix )
+        return GHT_ERROR;
+
+    prefix_len = strlen(prefix);
+    GHT_TRY(ght_cursor_reset(cursor));
+    while ( ! cursor->done )
+    {
+        const GhtNode *node = cursor->nodes[cursor->leaf.depth - 1];
+        size_t hash_len = strlen(cursor->leaf.hash);
+        int cmp = strncmp(cursor->leaf.hash, prefix, hash_len < prefix_len ? hash_len : prefix_len);
+
+        /* Everything under here sorts after the prefix, or inside it */
+        if ( cmp > 0 || (cmp == 0 && hash_len >= prefix_len) )
+            return ght_cursor_descend(cursor);
+
+        /* Everything under here sorts before it */
+        if ( cmp < 0 || ght_node_is_leaf(node) )
+        {
+            GHT_TRY(ght_cursor_skip(cursor));
+            continue;
+        }
+
+        /* The prefix continues below here */
+        {
+            int i = ght_cursor_next_child(node, -1);
+            GHT_TRY(ght_cursor_push(cursor, node->children->nodes[i], i));
+        }
+    }
+    return GHT_OK;
+}
+
+/**
+* Move the cursor so the next point read is the one numbered rank,
+* counting from zero in hash order. Ranks past the end leave nothing
+* more to read.
+*/
+GhtErr
+ght_tree_cursor_seek_rank(GhtTreeCursor *cursor, int rank)
+{
+    const GhtNode *node;
+
+    if ( ! cursor || rank < 0 )
+        return GHT_ERROR;
+
+    GHT_TRY(ght_cursor_reset(cursor));
+    if ( cursor->done )
+        return GHT_OK;
+
+    node = cursor->tree->root;
+    if ( rank >= node->num_leaves )
+    {
+        cursor->rank = node->num_leaves;
+        cursor->done = 1;
+        return GHT_OK;
+    }
+
+    /* Step over whole subtrees until the one holding the rank */
+    cursor->rank = rank;
+    while ( ! ght_node_is_leaf(node) )
+    {
+        int i = ght_cursor_next_child(node, -1);
+        while ( rank >= node->children->nodes[i]->num_leaves )
+        {
+            rank -= node->children->nodes[i]->num_leaves;
+            i = ght_cursor_next_child(node, i);
+        }
+        node = node->children->nodes[i];
+        GHT_TRY(ght_cursor_push(cursor, node, i));
+    }
+    return GHT_OK;
+}
+
+/** Read the rank of the point the next call to ght_tree_cursor_next will return */
+GhtErr
+ght_tree_cursor_get_rank(const GhtTreeCursor *cursor, int *rank)
+{
+    if ( ! cursor || ! rank )
+        return GHT_ERROR;
+    *rank = cursor->rank;
+    if ( cursor->started && ! cursor->done )
+        *rank += 1;
+    return GHT_OK;
+}
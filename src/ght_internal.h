@@ -38,6 +38,21 @@
 /* Up to double/int64 */
 #define GHT_ATTRIBUTE_MAX_SIZE  8
 
+/* Child lists start with room for this many, most nodes never need more */
+#define GHT_NODELIST_CHILD_CAPACITY 4
+
+/* Multi-tree archive file format version */
+#define GHT_ARCHIVE_VERSION 2
+
+/* Feature flags, carried in the header of version 2+ streams */
+#define GHT_FLAG_BLOCKS     0x01
+#define GHT_FLAG_SUMMARIES  0x02
+#define GHT_FLAG_DELTA      0x04
+#define GHT_FLAG_SCHEMA     0x08
+
+
+/* Memory and message handlers, see ght_mem.c */
+typedef struct GhtContext_t GhtContext;
 
 typedef enum
 {   
@@ -88,7 +103,7 @@ static size_t GhtTypeSizes[] =
     sizeof(double),  sizeof(float)      /* GHT_DOUBLE, GHT_FLOAT */
 };
 
-typedef struct
+typedef struct GhtDimension_t
 {
     int position;
     char *name;
@@ -112,8 +127,25 @@ typedef struct
     char *filename;
     size_t filesize;
     bytebuffer_t *bytebuffer;
+    GhtCodec codec;
+    int delta;
+    int embed_schema;
+    uint8_t flags;
+    const struct GhtAttribute_t *refs;
+    GhtContext *context;
 } GhtWriter;
 
+/* One independently compressed top-level subtree of a blocked stream */
+typedef struct
+{
+    GhtHash *hash;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t raw_size;
+    struct GhtSummary_t *summaries;
+    int loaded;
+} GhtBlock;
+
 typedef struct 
 {
     GhtIoType type;
@@ -125,15 +157,67 @@ typedef struct
     const GhtSchema *schema;
     uint8_t endian;
     uint8_t version;
+    uint8_t flags;
+    GhtCodec codec;
+    int num_blocks;
+    GhtBlock *blocks;
+    size_t blocks_start;
+    const struct GhtAttribute_t *refs;
+    GhtContext *context;
 } GhtReader;
 
-typedef struct
+struct GhtFilter_t;
+struct GhtAttribute_t;
+
+/* Comparator for one attribute type, chosen when a filter is prepared */
+typedef int (*GhtFilterTest)(const struct GhtFilter_t *filter, const struct GhtAttribute_t *attr);
+
+typedef struct GhtFilter_t
 {
     GhtRange range;
     GhtFilterMode mode;
     const GhtDimension *dim;
+    /* Inclusive range of stored integer values that pass */
+    int64_t storage_min;
+    int64_t storage_max;
+    GhtFilterTest test;
 } GhtFilter;
 
+typedef enum
+{
+    GHT_PREDICATE_AND,
+    GHT_PREDICATE_OR,
+    GHT_PREDICATE_NOT,
+    GHT_PREDICATE_FILTER,
+    GHT_PREDICATE_AREA
+} GhtPredicateType;
+
+/* Three-valued outcome of a predicate over a subtree */
+typedef enum
+{
+    GHT_PREDICATE_FALSE = 0,
+    GHT_PREDICATE_TRUE = 1,
+    GHT_PREDICATE_UNKNOWN = 2
+} GhtPredicateValue;
+
+/*
+* Boolean expression over dimension filters and areas. Filters name
+* their dimension, which is looked up in the schema of the tree being
+* filtered, and each filter or area term gets a slot in the per-node
+* state array when the predicate is prepared.
+*/
+typedef struct GhtPredicate_t
+{
+    GhtPredicateType type;
+    char *dimname;
+    GhtFilter filter;
+    GhtArea area;
+    int term;
+    int num_args;
+    int max_args;
+    struct GhtPredicate_t **args;
+} GhtPredicate;
+
 typedef struct GhtAttribute_t
 {
     const GhtDimension *dim;
@@ -141,23 +225,28 @@ typedef struct GhtAttribute_t
     char val[GHT_ATTRIBUTE_MAX_SIZE];
 } GhtAttribute;
 
-typedef struct
+/* Range of values of one dimension over all the leaves under a node */
+typedef struct GhtSummary_t
 {
+    const GhtDimension *dim;
+    struct GhtSummary_t *next;
     double min;
     double max;
-    double sum;
-    int count;
-    GhtType type;
-    const GhtDimension *dim;
-} GhtAttributeStats;
+    int count; /* leaves the range was taken from, some may lack the dimension */
+} GhtSummary;
 
 struct GhtNodeList_t;
 
-typedef struct
+typedef struct GhtNode_t
 {
     GhtHash *hash;
     struct GhtNodeList_t *children;
     GhtAttribute *attributes;
+    GhtSummary *summaries;
+    /* Cached level-of-detail representative of the subtree, if built */
+    struct GhtNode_t *sample;
+    /* Points in the subtree, one for a leaf */
+    int num_leaves;
 } GhtNode;
 
 typedef struct GhtNodeList_t
@@ -171,14 +260,129 @@ typedef struct
 {
     const GhtSchema *schema;
     GhtNode *root;
-    int num_nodes;
     GhtConfig config;
+    /* Interior nodes carry samples made with lod_mode */
+    int lod;
+    GhtSampleMode lod_mode;
+    /* Handlers the tree allocates and frees with */
+    GhtContext *context;
+    /* Frozen trees are read-only, their nodes all live in the arena */
+    int frozen;
+    void *arena;
 } GhtTree;
 
+/* Marks a packed node without a hash of its own */
+#define GHT_PACKED_NO_HASH UINT32_MAX
+
+/* Node of a packed tree, its children follow it up to end */
+typedef struct
+{
+    uint32_t hash;
+    uint32_t end;
+    uint32_t num_leaves;
+    uint32_t attributes;
+    uint32_t summaries;
+    uint16_t num_children;
+    uint8_t num_attributes;
+    uint8_t num_summaries;
+} GhtPackedNode;
+
+/* Read-only tree with all its nodes in one depth-first array */
+typedef struct
+{
+    const GhtSchema *schema;
+    GhtConfig config;
+    uint32_t num_nodes;
+    uint32_t num_points;
+    uint32_t num_attributes;
+    uint32_t num_summaries;
+    GhtPackedNode *nodes;
+    char *hashes;
+    GhtAttribute *attributes;
+    GhtSummary *summaries;
+    GhtContext *context;
+} GhtPackedTree;
+
+/* Room for a node per hash character, plus the root and a duplicate */
+#define GHT_LEAF_MAX_DEPTH (GHT_MAX_HASH_LENGTH + 2)
+
+/* Full hash of a point, and the attribute lists on the path down to it */
+struct GhtLeaf_t
+{
+    GhtHash hash[GHT_MAX_HASH_LENGTH + 1];
+    int depth;
+    const struct GhtAttribute_t *attributes[GHT_LEAF_MAX_DEPTH];
+};
+
+/* Position in a tree, as the path from the root down to a point */
+typedef struct GhtTreeCursor_t
+{
+    const GhtTree *tree;
+    const GhtNode *nodes[GHT_LEAF_MAX_DEPTH];
+    int index[GHT_LEAF_MAX_DEPTH];
+    size_t hash_len[GHT_LEAF_MAX_DEPTH];
+    GhtLeaf leaf;
+    /* Rank of the point at the end of the path */
+    int rank;
+    int started;
+    int done;
+    GhtContext *context;
+} GhtTreeCursor;
+
+/* One tree stored in an archive, and where to find it */
+typedef struct
+{
+    GhtHash *hash;
+    GhtArea area;
+    uint64_t offset;
+    uint64_t size;
+} GhtTile;
+
+typedef struct
+{
+    GhtWriter *writer;
+    const GhtSchema *schema;
+    int num_tiles;
+    int max_tiles;
+    GhtTile *tiles;
+} GhtArchiveWriter;
 
+typedef struct
+{
+    GhtReader *reader;
+    const GhtSchema *schema;
+    int num_tiles;
+    GhtTile *tiles;
+} GhtArchiveReader;
+
+/*
+* Counters for the hot paths, which compile away to nothing unless
+* GHT_ENABLE_STATS is set. Each thread counts its own work.
+*/
+#ifdef GHT_ENABLE_STATS
+#ifdef HAVE_TLS
+extern __thread GhtStats ght_stats;
+#else
+extern GhtStats ght_stats;
+#endif
+/** Seconds on a monotonic clock, for timing phases */
+double ght_stats_clock(void);
+#define GHT_STATS_ADD(counter, n) (ght_stats.counter += (n))
+#define GHT_STATS_START(phase) double ght_stats_##phase##_start = ght_stats_clock()
+#define GHT_STATS_STOP(phase) (ght_stats.phase##_seconds += ght_stats_clock() - ght_stats_##phase##_start)
+#else
+#define GHT_STATS_ADD(counter, n)
+#define GHT_STATS_START(phase)
+#define GHT_STATS_STOP(phase)
+#endif
 
 
 
+
+/** Context of the calling thread, NULL when it uses the default */
+GhtContext* ght_context_get_current(void);
+/** Make context current for the calling thread, returning the one it replaces */
+GhtContext* ght_context_swap(GhtContext *context);
 /** Initialize memory/message handling with defaults (malloc/free/printf) */
 void   ght_init(void);
 
@@ -250,9 +454,18 @@ GhtErr ght_hash_leaf_parts(const GhtHash *a, const GhtHash *b, int maxlen, GhtHa
 /** Free a node and all its children and attributes */
 GhtErr ght_node_free(GhtNode *node);
 
+/** True when the node has no children */
+int ght_node_is_leaf(const GhtNode *node);
+
 /** Add node_to_insert to a tree of nodes headed by node */
 GhtErr ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates duplicates);
 
+/** Add node_to_insert to a tree of nodes headed by node, widening the summaries along the way */
+GhtErr ght_node_insert_node_summarized(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates duplicates);
+
+/** Recursively rebuild the summaries of all the interior nodes in a tree of nodes */
+GhtErr ght_node_summarize(GhtNode *node);
+
 /** Set the hash string on a node, takes ownership of hash */
 GhtErr ght_node_set_hash(GhtNode *node, GhtHash *hash);
 
@@ -274,6 +487,9 @@ GhtErr ght_node_to_string(GhtNode *node, stringbuffer_t *sb, int level);
 /** How many leaf nodes in this tree? */
 GhtErr ght_node_count_leaves(const GhtNode *node, int *count);
 
+/** Add the shape and memory use of the tree under node, which is at depth, to profile */
+GhtErr ght_node_profile(const GhtNode *node, int depth, GhtTreeProfile *profile);
+
 /** How many attributes on this node? */
 GhtErr ght_node_count_attributes(const GhtNode *node, uint8_t *count);
 
@@ -286,14 +502,23 @@ GhtErr ght_node_add_attribute(GhtNode *node, GhtAttribute *attribute);
 /** Move attributes to the highest level in the tree at which they apply to all children */
 GhtErr ght_node_compact_attribute(GhtNode *node, const GhtDimension *dim, GhtAttribute *attr);
 
+/** Compact all the attributes from 'Z' onwards in one pass, folding values within the per-dimension tolerances */
+GhtErr ght_node_compact_attributes(GhtNode *node, const GhtSchema *schema, const double *tolerances, double *max_errors);
+
 /** Recursively build a GhtNodeList from a tree of GhtNode */
 GhtErr ght_node_to_nodelist(const GhtNode *node, GhtNodeList *nodelist, GhtAttribute *attr, GhtHash *hash);
 
+/** Free the cached sample of a node, which no longer represents its subtree */
+GhtErr ght_node_clear_sample(GhtNode *node);
+
 /** Recursively calculate the extent GhtArea of a tree of GhtNode */
 GhtErr ght_node_get_extent(const GhtNode *node, const GhtHash *hash, GhtArea *area);
 
-/** Recursively filter out sub-elements of the tree that don't pass the filter, returns a freshly allocated tree that corresponds to the filter */
-GhtErr ght_node_filter_by_attribute(const GhtNode *node, const GhtFilter *filter, GhtNode **filtered_node);
+/** Recursively visit the leaves that pass a prepared predicate (or all, when NULL), counting them and calling callback (if not NULL) on each */
+GhtErr ght_node_visit_by_predicate(const GhtNode *node, const GhtPredicate *predicate, const uint8_t *state, int num_terms, GhtLeaf *leaf, GhtLeafCallback callback, void *data, int *count);
+
+/** Recursively copy the sub-elements of the tree that pass a prepared predicate, given the hash and term states of the parent */
+GhtErr ght_node_filter_by_predicate(const GhtNode *node, const GhtPredicate *predicate, const GhtHash *hash, const uint8_t *state, int num_terms, GhtNode **filtered_node);
 
 /** Write a byte representation of a node tree */
 GhtErr ght_node_write(const GhtNode *node, GhtWriter *writer);
@@ -301,6 +526,18 @@ GhtErr ght_node_write(const GhtNode *node, GhtWriter *writer);
 /** Write a byte representation of a node tree */
 GhtErr ght_node_read(GhtReader *reader, GhtNode **node);
 
+/** Write the hash and attributes of a node, but not its children */
+GhtErr ght_node_write_head(const GhtNode *node, GhtWriter *writer);
+
+/** Read the hash and attributes of a node, but not its children */
+GhtErr ght_node_read_head(GhtReader *reader, GhtNode **node);
+
+/** Append a child node to the node */
+GhtErr ght_node_add_child(GhtNode *parent, GhtNode *child);
+
+/** Make a deep copy of a node, its attributes, summaries and children */
+GhtErr ght_node_clone(const GhtNode *node, GhtNode **node_out);
+
 /** Create an empty nodelist */
 GhtErr ght_nodelist_new(int capacity, GhtNodeList **nodelist);
 
@@ -313,13 +550,19 @@ GhtErr ght_nodelist_get_node(const GhtNodeList *nodelist, int index, GhtNode **n
 /** Add a new node to a nodelist */
 GhtErr ght_nodelist_add_node(GhtNodeList *nl, GhtNode *node);
 
+/** Add an array of nodes to a nodelist, growing it at most once */
+GhtErr ght_nodelist_add_nodes(GhtNodeList *nl, GhtNode **nodes, int num_nodes);
+
+/** Make room in a nodelist for at least capacity nodes */
+GhtErr ght_nodelist_reserve(GhtNodeList *nl, int capacity);
+
 /** Free a nodelist, and optionally all the nodes referenced by the list */
 GhtErr ght_nodelist_free_deep(GhtNodeList *nl);
 
 /** Free a nodelist, but not the nodes it holds */
 GhtErr ght_nodelist_free_shallow(GhtNodeList *nl);
 
-/** Allocate a new tree and initialize config parameters */
+/** Allocate a new tree and initialize config parameters, the tree keeps the current context for all its memory */
 GhtErr ght_tree_new(const GhtSchema *schema, GhtTree **tree);
 
 /** Build a tree from a linear nodelist */
@@ -343,18 +586,84 @@ GhtErr ght_tree_get_schema(const GhtTree *tree, const GhtSchema **schema);
 /** Read the point count from the GhtTree */
 GhtErr ght_tree_get_numpoints(const GhtTree *tree, int *numpoints);
 
+/** Measure the shape and memory use of the GhtTree */
+GhtErr ght_tree_get_profile(const GhtTree *tree, GhtTreeProfile *profile);
+
 /** Compact all the attributes from 'Z' onwards */
 GhtErr ght_tree_compact_attributes(GhtTree *tree);
 
+/** Compact all the attributes from 'Z' onwards, folding values within a tolerance per dimension, and report the largest error per dimension */
+GhtErr ght_tree_compact_attributes_tolerance(GhtTree *tree, const double *tolerances, double *max_errors);
+
 /** Write a GhtTree to memory or file */
 GhtErr ght_tree_write(const GhtTree *tree, GhtWriter *writer);
 
 /** Write a GhtTree to memory of file */
 GhtErr ght_tree_read(GhtReader *reader, GhtTree **tree);
 
+/** Read the header and root node, leaving the subtrees of a blocked stream unread */
+GhtErr ght_tree_read_root(GhtReader *reader, GhtTree **tree);
+
+/** Decompress one block of a blocked stream and attach it under the root */
+GhtErr ght_tree_read_block(GhtReader *reader, GhtTree *tree, int block);
+
 /** Take in a tree and output a populated GhtNodeList, creates complete copy of data */
 GhtErr ght_tree_to_nodelist(const GhtTree *tree, GhtNodeList *nodelist);
 
+/** Move the tree into one depth-first block of memory, after which it is read-only and safe for concurrent readers */
+GhtErr ght_tree_freeze(GhtTree *tree);
+
+/** GHT_ERROR, with a message naming func, if the tree is frozen */
+GhtErr ght_tree_check_mutable(const GhtTree *tree, const char *func);
+
+/** Start a cursor at the first point of the tree, in hash order */
+GhtErr ght_tree_cursor_new(const GhtTree *tree, GhtTreeCursor **cursor);
+
+/** Free a cursor */
+GhtErr ght_tree_cursor_free(GhtTreeCursor *cursor);
+
+/** Read the next point from the cursor, GHT_DONE once all are read */
+GhtErr ght_tree_cursor_next(GhtTreeCursor *cursor, const GhtLeaf **leaf);
+
+/** Move the cursor to the first point whose hash is not less than prefix */
+GhtErr ght_tree_cursor_seek_prefix(GhtTreeCursor *cursor, const GhtHash *prefix);
+
+/** Move the cursor to the point numbered rank in hash order */
+GhtErr ght_tree_cursor_seek_rank(GhtTreeCursor *cursor, int rank);
+
+/** Read the rank of the point the cursor will return next */
+GhtErr ght_tree_cursor_get_rank(const GhtTreeCursor *cursor, int *rank);
+
+/** Write the stream header, settling the feature flags for the writer */
+GhtErr ght_tree_write_header(const GhtSchema *schema, const GhtConfig *config, GhtWriter *writer);
+
+/** Make a read-only copy of a tree with its nodes in one depth-first array */
+GhtErr ght_packed_tree_from_tree(const GhtTree *tree, GhtPackedTree **packed);
+
+/** Free a packed tree */
+GhtErr ght_packed_tree_free(GhtPackedTree *packed);
+
+/** Make an ordinary tree from a packed one */
+GhtErr ght_packed_tree_to_tree(const GhtPackedTree *packed, GhtTree **tree);
+
+/** Read the point count of a packed tree */
+GhtErr ght_packed_tree_get_numpoints(const GhtPackedTree *packed, int *numpoints);
+
+/** Calculate the spatial extent of a packed tree */
+GhtErr ght_packed_tree_get_extent(const GhtPackedTree *packed, GhtArea *area);
+
+/** Count the points of a packed tree that pass the predicate */
+GhtErr ght_packed_tree_filter_count(const GhtPackedTree *packed, GhtPredicate *predicate, int *count);
+
+/** Call callback on each point of a packed tree that passes the predicate */
+GhtErr ght_packed_tree_filter_foreach(const GhtPackedTree *packed, GhtPredicate *predicate, GhtLeafCallback callback, void *data);
+
+/** Write a packed tree, in the same format as ght_tree_write */
+GhtErr ght_packed_tree_write(const GhtPackedTree *packed, GhtWriter *writer);
+
+/** Turn on per-node value summaries, building them for any nodes already in the tree */
+GhtErr ght_tree_set_summaries(GhtTree *tree, int summaries);
+
 /** Calculate the spatial extent of a GhtTree */
 GhtErr ght_tree_get_extent(const GhtTree *tree, GhtArea *area);
 
@@ -370,6 +679,48 @@ GhtErr ght_tree_filter_between(const GhtTree *tree, const char *dimname, double
 /** Allocate new tree with only nodes that meet the filter condition */
 GhtErr ght_tree_filter_equal(const GhtTree *tree, const char *dimname, double value, GhtTree **tree_filtered);
 
+/** Allocate new tree with only nodes that pass the predicate, in a single traversal */
+GhtErr ght_tree_filter_predicate(const GhtTree *tree, GhtPredicate *predicate, GhtTree **tree_filtered);
+
+/** Add copies of the k points nearest to pt to the nodelist, nearest first */
+GhtErr ght_tree_knn(const GhtTree *tree, const GhtCoordinate *pt, int k, GhtNodeList *nodelist);
+
+/** Add copies of the points no further than radius from pt to the nodelist */
+GhtErr ght_tree_within_distance(const GhtTree *tree, const GhtCoordinate *pt, double radius, GhtNodeList *nodelist);
+
+/** Add one representative point per hash cell of resolution characters to the nodelist */
+GhtErr ght_tree_sample(const GhtTree *tree, int resolution, GhtSampleMode mode, GhtNodeList *nodelist);
+
+/** Cache a representative point on every interior node, for fast sampling at any resolution */
+GhtErr ght_tree_build_lod(GhtTree *tree, GhtSampleMode mode);
+
+/** Fill in the statistics of every dimension of the schema, in one traversal */
+GhtErr ght_tree_get_stats(const GhtTree *tree, GhtAttributeStats *stats);
+
+/** Call callback with the statistics of every hash cell of resolution characters */
+GhtErr ght_tree_get_stats_by_prefix(const GhtTree *tree, int resolution, GhtAttributeStats *stats, GhtStatsCallback callback, void *data);
+
+/** Aggregate the values of a dimension over an nx by ny grid covering extent, into out */
+GhtErr ght_tree_rasterize(const GhtTree *tree, const GhtArea *extent, int nx, int ny, const char *dimname, GhtAggregate agg, double *out);
+
+/** Call callback with the k nearest neighbours of every point, sharing the work between num_threads threads */
+GhtErr ght_tree_knn_all(const GhtTree *tree, int k, int num_threads, GhtKnnCallback callback, void *data);
+
+/** Count the points that pass the predicate, without copying anything */
+GhtErr ght_tree_filter_count(const GhtTree *tree, GhtPredicate *predicate, int *count);
+
+/** Call callback on each point that passes the predicate (all points, if it is NULL), without copying anything */
+GhtErr ght_tree_filter_foreach(const GhtTree *tree, GhtPredicate *predicate, GhtLeafCallback callback, void *data);
+
+/** Read the full hash of a visited point */
+GhtErr ght_leaf_get_hash(const GhtLeaf *leaf, const GhtHash **hash);
+
+/** Read the coordinate of a visited point */
+GhtErr ght_leaf_get_coordinate(const GhtLeaf *leaf, GhtCoordinate *coord);
+
+/** Read the value of a dimension for a visited point, GHT_ERROR if it has none */
+GhtErr ght_leaf_get_value(const GhtLeaf *leaf, const GhtDimension *dim, double *val);
+
 /** Allocate a new attribute and fill in the value from a double */
 GhtErr ght_attribute_new_from_double(const GhtDimension *dim, double val, GhtAttribute **attr);
 
@@ -397,6 +748,12 @@ GhtErr ght_attribute_get_by_dimension(const GhtAttribute *attr, const GhtDimensi
 /** Set the packed attribute value */
 GhtErr ght_attribute_set_value(GhtAttribute *attr, double val);
 
+/** Read the packed value of an integer attribute, widened to 64 bits */
+GhtErr ght_attribute_get_integer(const GhtAttribute *attr, int64_t *val);
+
+/** Set the packed value of an integer attribute, truncating to the dimension type */
+GhtErr ght_attribute_set_integer(GhtAttribute *attr, int64_t val);
+
 /** Write an appropriately formatted value into the stringbuffer_t */
 GhtErr ght_attribute_to_string(const GhtAttribute *attr, stringbuffer_t *sb);
 
@@ -412,6 +769,75 @@ GhtErr ght_attribute_write(const GhtAttribute *attr, GhtWriter *writer);
 /** Read attribute from byte representation */
 GhtErr ght_attribute_read(GhtReader *reader, GhtAttribute **attr);
 
+/** Allocate a new summary entry for one dimension */
+GhtErr ght_summary_new(const GhtDimension *dim, double min, double max, int count, GhtSummary **summary);
+
+/** Free a summary and all linked siblings */
+GhtErr ght_summary_free(GhtSummary *summary);
+
+/** Copy a summary and all linked siblings */
+GhtErr ght_summary_clone(const GhtSummary *summary, GhtSummary **summary_out);
+
+/** Find the summary entry for a dimension, if there is one */
+GhtErr ght_summary_get_by_dimension(const GhtSummary *summary, const GhtDimension *dim, const GhtSummary **found);
+
+/** Widen the summary to take in [min, max] on a dimension, from count more leaves */
+GhtErr ght_summary_extend(GhtSummary **summary, const GhtDimension *dim, double min, double max, int count);
+
+/** Widen the summary to take in all the ranges of another summary */
+GhtErr ght_summary_extend_by_summary(GhtSummary **summary, const GhtSummary *other);
+
+/** Widen the summary to take in all the values of an attribute list, held by count leaves */
+GhtErr ght_summary_extend_by_attribute(GhtSummary **summary, const GhtAttribute *attr, int count);
+
+/** Widen the summary to take in everything carried by a node and its subtree */
+GhtErr ght_summary_extend_by_node(GhtSummary **summary, const GhtNode *node);
+
+/** Write byte representation of summary into writer */
+GhtErr ght_summary_write(const GhtSummary *summary, GhtWriter *writer);
+
+/** Read summary from byte representation */
+GhtErr ght_summary_read(GhtReader *reader, GhtSummary **summary);
+
+/** Create a predicate that passes values of a dimension greater than value */
+GhtErr ght_predicate_new_greater_than(const char *dimname, double value, GhtPredicate **predicate);
+
+/** Create a predicate that passes values of a dimension less than value */
+GhtErr ght_predicate_new_less_than(const char *dimname, double value, GhtPredicate **predicate);
+
+/** Create a predicate that passes values of a dimension between two values, inclusive */
+GhtErr ght_predicate_new_between(const char *dimname, double value1, double value2, GhtPredicate **predicate);
+
+/** Create a predicate that passes values of a dimension equal to value */
+GhtErr ght_predicate_new_equal(const char *dimname, double value, GhtPredicate **predicate);
+
+/** Create a predicate that passes points inside an area */
+GhtErr ght_predicate_new_area(const GhtArea *area, GhtPredicate **predicate);
+
+/** Create an empty AND predicate, which passes everything until terms are added */
+GhtErr ght_predicate_new_and(GhtPredicate **predicate);
+
+/** Create an empty OR predicate, which passes nothing until terms are added */
+GhtErr ght_predicate_new_or(GhtPredicate **predicate);
+
+/** Create a predicate negating another, takes ownership of arg */
+GhtErr ght_predicate_new_not(GhtPredicate *arg, GhtPredicate **predicate);
+
+/** Add a term to an AND or OR predicate, takes ownership of arg */
+GhtErr ght_predicate_add(GhtPredicate *predicate, GhtPredicate *arg);
+
+/** Free a predicate and all its terms */
+GhtErr ght_predicate_free(GhtPredicate *predicate);
+
+/** Bind the predicate dimensions to a schema and number its terms */
+GhtErr ght_predicate_prepare(GhtPredicate *predicate, const GhtSchema *schema, int *num_terms);
+
+/** Decide the undecided terms that hold for the whole subtree under a node with this full hash */
+GhtErr ght_predicate_update(const GhtPredicate *predicate, const GhtNode *node, const GhtHash *hash, int is_leaf, uint8_t *state);
+
+/** Combine term states into a true, false or unknown result */
+GhtErr ght_predicate_eval(const GhtPredicate *predicate, const uint8_t *state, GhtPredicateValue *value);
+
 /** Give a type string (eg "uint16_t"), return the GhtType number */
 GhtErr ght_type_from_str(const char *str, GhtType *type);
 
@@ -487,6 +913,24 @@ GhtErr ght_schema_to_xml_file(const GhtSchema *schema, const char *filename);
 /** Write out an XML representation of a GhtSchema */
 GhtErr ght_schema_from_xml_file(const char *filename, GhtSchema **schema);
 
+/** Write a compact binary representation of a GhtSchema */
+GhtErr ght_schema_write(const GhtSchema *schema, GhtWriter *writer);
+
+/** Read a binary GhtSchema */
+GhtErr ght_schema_read(GhtReader *reader, GhtSchema **schema);
+
+/** Read a binary GhtSchema and return the shared cached equivalent */
+GhtErr ght_schema_read_interned(GhtReader *reader, const GhtSchema **schema);
+
+/** Hash of the dimension names, types, scales and offsets of a schema */
+GhtErr ght_schema_hash(const GhtSchema *schema, uint64_t *hash);
+
+/** Hand a schema to the process-wide cache, receiving the shared equivalent */
+GhtErr ght_schema_intern(GhtSchema *schema, const GhtSchema **interned);
+
+/** Free all the schemas in the process-wide cache */
+GhtErr ght_schema_cache_clear(void);
+
 /** Close filehandle if necessary and free all memory along with writer */
 GhtErr ght_writer_free(GhtWriter *writer);
 
@@ -505,6 +949,18 @@ GhtErr ght_writer_get_bytes(GhtWriter *writer, uint8_t *bytes);
 /** Write bytes out to the target */
 GhtErr ght_write(GhtWriter *writer, const void *bytes, size_t bytesize);
 
+/** Write an unsigned integer in variable length (7 bits per byte) form */
+GhtErr ght_write_varint(GhtWriter *writer, uint64_t val);
+
+/** Compress subsequent tree writes into blocks with this codec */
+GhtErr ght_writer_set_codec(GhtWriter *writer, GhtCodec codec);
+
+/** Write integer attributes of subsequent trees as deltas from a per-parent reference */
+GhtErr ght_writer_set_delta(GhtWriter *writer, int delta);
+
+/** Embed the tree schema in the header of subsequent tree writes */
+GhtErr ght_writer_set_embed_schema(GhtWriter *writer, int embed);
+
 /** Create a new file-based reader */
 GhtErr ght_reader_new_file(const char *filename, const GhtSchema *schema, GhtReader **reader);
 
@@ -517,6 +973,78 @@ GhtErr ght_reader_free(GhtReader *reader);
 /** Read bytes in from a reader */
 GhtErr ght_read(GhtReader *reader, void *bytes, size_t read_size);
 
+/** Read an unsigned integer in variable length (7 bits per byte) form */
+GhtErr ght_read_varint(GhtReader *reader, uint64_t *val);
+
+/** Current read position, in bytes from the start of the input */
+GhtErr ght_reader_tell(GhtReader *reader, size_t *position);
+
+/** Move the read position, in bytes from the start of the input */
+GhtErr ght_reader_seek(GhtReader *reader, size_t position);
+
+/** Total size of the input, in bytes */
+GhtErr ght_reader_get_size(GhtReader *reader, size_t *size);
+
+/** Release the block index of the last blocked tree read */
+GhtErr ght_reader_free_blocks(GhtReader *reader);
+
+/** How many independently readable blocks are in this (blocked) stream? */
+GhtErr ght_reader_get_num_blocks(const GhtReader *reader, int *num_blocks);
+
+/** Calculate the area covered by one block of a blocked stream */
+GhtErr ght_reader_get_block_area(const GhtReader *reader, const GhtTree *tree, int block, GhtArea *area);
+
+/** Read the range of values of a dimension within one block of a summarized blocked stream */
+GhtErr ght_reader_get_block_range(const GhtReader *reader, int block, const char *dimname, GhtRange *range);
+
+/** Is this codec compiled into the library? */
+GhtErr ght_codec_available(GhtCodec codec, int *available);
+
+/** Give a codec name (eg "zlib"), return the GhtCodec number */
+GhtErr ght_codec_from_str(const char *str, GhtCodec *codec);
+
+/** Compress a byte buffer into a newly allocated buffer */
+GhtErr ght_codec_compress(GhtCodec codec, const uint8_t *bytes, size_t bytes_size, uint8_t **out, size_t *out_size);
+
+/** Decompress a byte buffer into a buffer of the known uncompressed size */
+GhtErr ght_codec_decompress(GhtCodec codec, const uint8_t *bytes, size_t bytes_size, uint8_t *out, size_t out_size);
+
+/** Create a new archive file, with a schema shared by all its trees */
+GhtErr ght_archive_writer_new(const char *filename, const GhtSchema *schema, GhtArchiveWriter **archive);
+
+/** Compress the trees added to the archive with this codec */
+GhtErr ght_archive_writer_set_codec(GhtArchiveWriter *archive, GhtCodec codec);
+
+/** Delta encode the trees added to the archive */
+GhtErr ght_archive_writer_set_delta(GhtArchiveWriter *archive, int delta);
+
+/** Append a tree to the archive as a new tile */
+GhtErr ght_archive_writer_add_tree(GhtArchiveWriter *archive, const GhtTree *tree);
+
+/** Write the tile directory, close the file and free the archive */
+GhtErr ght_archive_writer_close(GhtArchiveWriter *archive);
+
+/** Open an archive file and read its schema and tile directory */
+GhtErr ght_archive_reader_new(const char *filename, GhtArchiveReader **archive);
+
+/** Close the archive file and free the archive, its interned schema lives on until ght_schema_cache_clear */
+GhtErr ght_archive_reader_free(GhtArchiveReader *archive);
+
+/** Read the schema shared by all the trees in the archive */
+GhtErr ght_archive_get_schema(const GhtArchiveReader *archive, const GhtSchema **schema);
+
+/** How many tiles in the archive? */
+GhtErr ght_archive_get_num_tiles(const GhtArchiveReader *archive, int *num_tiles);
+
+/** Read the extent of one tile from the directory */
+GhtErr ght_archive_get_tile_area(const GhtArchiveReader *archive, int tile, GhtArea *area);
+
+/** Find the tiles that intersect an area, returns a newly allocated array of tile numbers */
+GhtErr ght_archive_query_area(const GhtArchiveReader *archive, const GhtArea *area, int **tiles, int *num_tiles);
+
+/** Read one tile of the archive into a tree */
+GhtErr ght_archive_read_tile(GhtArchiveReader *archive, int tile, GhtTree **tree);
+
 /** Set up a tree configuration with defaults */
 GhtErr ght_config_init(GhtConfig *config);
 
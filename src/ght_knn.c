@@ -0,0 +1,825 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+/**
+* Proximity queries. Every node bounds its subtree by the cell its
+* full hash defines, so a best-first walk ordered by the distance to
+* those cells reaches the nearest points first. Distances are planar,
+* in the units of the hash coordinates.
+*/
+
+#include "ght_internal.h"
+#include <math.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* A node waiting to be visited, with the entry of its parent */
+typedef struct
+{
+    const GhtNode *node;
+    int parent;
+    double distance;
+    GhtHash hash[GHT_MAX_HASH_LENGTH + 1];
+} GhtKnnEntry;
+
+typedef struct
+{
+    GhtKnnEntry *entries;
+    int num_entries;
+    int max_entries;
+    int *heap;
+    int heap_size;
+    int max_heap;
+} GhtKnnQueue;
+
+static int
+ght_knn_is_leaf(const GhtNode *node)
+{
+    return (! node->children) || (node->children->num_nodes == 0);
+}
+
+/** Squared distance from a point to the nearest edge of an area, zero inside */
+static double
+ght_knn_area_distance(const GhtCoordinate *pt, const GhtArea *area)
+{
+    double dx = 0.0, dy = 0.0;
+    if ( pt->x < area->x.min ) dx = area->x.min - pt->x;
+    else if ( pt->x > area->x.max ) dx = pt->x - area->x.max;
+    if ( pt->y < area->y.min ) dy = area->y.min - pt->y;
+    else if ( pt->y > area->y.max ) dy = pt->y - area->y.max;
+    return dx*dx + dy*dy;
+}
+
+/**
+* Squared distance from the point to the subtree under a node with
+* this full hash: exact for a leaf, a lower bound for anything else.
+*/
+static GhtErr
+ght_knn_node_distance(const GhtCoordinate *pt, const GhtNode *node, const GhtHash *hash, double *distance)
+{
+    if ( ght_knn_is_leaf(node) )
+    {
+        GhtCoordinate coord;
+        double dx, dy;
+        GHT_TRY(ght_coordinate_from_hash(hash, &coord));
+        dx = coord.x - pt->x;
+        dy = coord.y - pt->y;
+        *distance = dx*dx + dy*dy;
+    }
+    else
+    {
+        GhtArea area;
+        GHT_TRY(ght_area_from_hash(hash, &area));
+        *distance = ght_knn_area_distance(pt, &area);
+    }
+    return GHT_OK;
+}
+
+static void
+ght_knn_queue_free(GhtKnnQueue *queue)
+{
+    if ( queue->entries )
+        ght_free(queue->entries);
+    if ( queue->heap )
+        ght_free(queue->heap);
+    memset(queue, 0, sizeof(GhtKnnQueue));
+}
+
+static int
+ght_knn_heap_less(const GhtKnnQueue *queue, int a, int b)
+{
+    return queue->entries[queue->heap[a]].distance < queue->entries[queue->heap[b]].distance;
+}
+
+static void
+ght_knn_heap_swap(GhtKnnQueue *queue, int a, int b)
+{
+    int tmp = queue->heap[a];
+    queue->heap[a] = queue->heap[b];
+    queue->heap[b] = tmp;
+}
+
+/** Add a node under a parent entry to the queue, keyed by its distance */
+static GhtErr
+ght_knn_queue_push(GhtKnnQueue *queue, const GhtCoordinate *pt, const GhtNode *node, int parent)
+{
+    GhtKnnEntry *e;
+    int i;
+
+    if ( queue->num_entries == queue->max_entries )
+    {
+        queue->max_entries = queue->max_entries ? 2 * queue->max_entries : 64;
+        queue->entries = ght_realloc(queue->entries, queue->max_entries * sizeof(GhtKnnEntry));
+    }
+    e = &(queue->entries[queue->num_entries]);
+    e->node = node;
+    e->parent = parent;
+    e->hash[0] = '\0';
+    if ( parent >= 0 )
+        strcpy(e->hash, queue->entries[parent].hash);
+    if ( node->hash )
+    {
+        if ( strlen(e->hash) + strlen(node->hash) > GHT_MAX_HASH_LENGTH )
+        {
+            ght_error("%s: tree is deeper than the longest hash", __func__);
+            return GHT_ERROR;
+        }
+        strcat(e->hash, node->hash);
+    }
+    GHT_TRY(ght_knn_node_distance(pt, node, e->hash, &(e->distance)));
+
+    if ( queue->heap_size == queue->max_heap )
+    {
+        queue->max_heap = queue->max_heap ? 2 * queue->max_heap : 64;
+        queue->heap = ght_realloc(queue->heap, queue->max_heap * sizeof(int));
+    }
+    i = queue->heap_size++;
+    queue->heap[i] = queue->num_entries++;
+    while ( i > 0 && ght_knn_heap_less(queue, i, (i-1)/2) )
+    {
+        ght_knn_heap_swap(queue, i, (i-1)/2);
+        i = (i-1)/2;
+    }
+    return GHT_OK;
+}
+
+/** Take the nearest entry off the queue */
+static int
+ght_knn_queue_pop(GhtKnnQueue *queue)
+{
+    int top = queue->heap[0];
+    int i = 0;
+
+    queue->heap[0] = queue->heap[--queue->heap_size];
+    while ( 1 )
+    {
+        int l = 2*i + 1, r = 2*i + 2, m = i;
+        if ( l < queue->heap_size && ght_knn_heap_less(queue, l, m) ) m = l;
+        if ( r < queue->heap_size && ght_knn_heap_less(queue, r, m) ) m = r;
+        if ( m == i ) break;
+        ght_knn_heap_swap(queue, i, m);
+        i = m;
+    }
+    return top;
+}
+
+/** Make a standalone copy of a leaf, with the attributes of all its ancestors */
+static GhtErr
+ght_knn_leaf_copy(const GhtKnnQueue *queue, int entry, GhtNode **node)
+{
+    GhtAttribute *attr = NULL;
+    GhtHash *hash = (GhtHash*)(queue->entries[entry].hash);
+    int e;
+
+    for ( e = entry; e >= 0; e = queue->entries[e].parent )
+    {
+        GhtAttribute *a;
+        GHT_TRY(ght_attribute_union(queue->entries[e].node->attributes, attr, &a));
+        if ( attr )
+            ght_attribute_free(attr);
+        attr = a;
+    }
+    GHT_TRY(ght_node_new_from_hash(hash, node));
+    if ( attr )
+        GHT_TRY(ght_node_add_attribute(*node, attr));
+    return GHT_OK;
+}
+
+/**
+* Add copies of the k points nearest to pt to the nodelist, nearest
+* first. Trees with fewer than k points add all of them.
+*/
+GhtErr
+ght_tree_knn(const GhtTree *tree, const GhtCoordinate *pt, int k, GhtNodeList *nodelist)
+{
+    GhtKnnQueue queue;
+    int found = 0;
+    GhtErr err = GHT_OK;
+
+    if ( ! tree || ! pt || ! nodelist )
+        return GHT_ERROR;
+    if ( ! tree->root || k <= 0 )
+        return GHT_OK;
+
+    memset(&queue, 0, sizeof(GhtKnnQueue));
+    err = ght_knn_queue_push(&queue, pt, tree->root, -1);
+
+    while ( err == GHT_OK && found < k && queue.heap_size > 0 )
+    {
+        int e = ght_knn_queue_pop(&queue);
+        const GhtNode *node = queue.entries[e].node;
+
+        /* Nothing left in the queue can be nearer than this point */
+        if ( ght_knn_is_leaf(node) )
+        {
+            GhtNode *copy;
+            err = ght_knn_leaf_copy(&queue, e, &copy);
+            if ( err == GHT_OK )
+                err = ght_nodelist_add_node(nodelist, copy);
+            found++;
+        }
+        else
+        {
+            int i;
+            for ( i = 0; err == GHT_OK && i < node->children->num_nodes; i++ )
+            {
+                err = ght_knn_queue_push(&queue, pt, node->children->nodes[i], e);
+            }
+        }
+    }
+
+    ght_knn_queue_free(&queue);
+    return err;
+}
+
+static GhtErr
+ght_node_within_distance(const GhtNode *node, const GhtCoordinate *pt, double radius2, GhtAttribute *attr, const GhtHash *hash, GhtNodeList *nodelist)
+{
+    static const int hash_array_len = GHT_MAX_HASH_LENGTH + 1;
+    GhtHash h[hash_array_len];
+    GhtAttribute *a;
+    double distance;
+
+    /* Add our part of the hash to the incoming part */
+    memset(h, 0, hash_array_len);
+    strncpy(h, hash, GHT_MAX_HASH_LENGTH);
+    if ( node->hash )
+    {
+        if ( strlen(h) + strlen(node->hash) > GHT_MAX_HASH_LENGTH )
+        {
+            ght_error("%s: tree is deeper than the longest hash", __func__);
+            return GHT_ERROR;
+        }
+        strcat(h, node->hash);
+    }
+
+    /* Skip the cells too far away to hold anything of interest */
+    GHT_TRY(ght_knn_node_distance(pt, node, h, &distance));
+    if ( distance > radius2 )
+        return GHT_OK;
+
+    GHT_TRY(ght_attribute_union(node->attributes, attr, &a));
+    if ( ght_knn_is_leaf(node) )
+    {
+        GhtNode *n;
+        GHT_TRY(ght_node_new_from_hash(h, &n));
+        if ( a )
+            GHT_TRY(ght_node_add_attribute(n, a));
+        GHT_TRY(ght_nodelist_add_node(nodelist, n));
+    }
+    else
+    {
+        int i;
+        GhtErr err = GHT_OK;
+        for ( i = 0; err == GHT_OK && i < node->children->num_nodes; i++ )
+        {
+            err = ght_node_within_distance(node->children->nodes[i], pt, radius2, a, h, nodelist);
+        }
+        if ( a )
+            ght_attribute_free(a);
+        return err;
+    }
+    return GHT_OK;
+}
+
+/**
+* Add copies of every point no further than radius from pt to the
+* nodelist, in tree order.
+*/
+GhtErr
+ght_tree_within_distance(const GhtTree *tree, const GhtCoordinate *pt, double radius, GhtNodeList *nodelist)
+{
+    if ( ! tree || ! pt || ! nodelist || radius < 0 )
+        return GHT_ERROR;
+    if ( ! tree->root )
+        return GHT_OK;
+    return ght_node_within_distance(tree->root, pt, radius*radius, NULL, "", nodelist);
+}
+
+/******************************************************************************/
+/* All-points neighbourhoods */
+
+/*
+* Flat copy of the tree built in one traversal, with every cell
+* worked out once. The children of each node sit together, and
+* leaves are numbered in tree order.
+*/
+typedef struct
+{
+    const GhtNode *node;
+    GhtArea cell;
+    GhtCoordinate coord;
+    int first_child;
+    int num_children;
+    int leaf;
+} GhtKnnCell;
+
+typedef struct
+{
+    GhtKnnCell *cells;
+    int num_cells;
+    int num_leaves;
+    int k;
+    GhtKnnCallback callback;
+    void *data;
+    int next_subtree;
+    GhtErr err;
+    GhtContext *context;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+} GhtKnnJoin;
+
+/* Per-worker scratch space, reused from one group of siblings to the next */
+typedef struct
+{
+    int *heap;
+    double *heap_distance;
+    int heap_size;
+    int max_heap;
+    int *candidates;
+    int num_candidates;
+    int max_candidates;
+    double *distances;
+    int *order;
+    int *neighbours;
+    double *neighbour_distances;
+} GhtKnnWorker;
+
+static GhtErr
+ght_knn_cells_build(GhtKnnJoin *join, int cell, const GhtHash *hash)
+{
+    static const int hash_array_len = GHT_MAX_HASH_LENGTH + 1;
+    GhtHash h[hash_array_len];
+    GhtKnnCell *c = &(join->cells[cell]);
+    const GhtNode *node = c->node;
+    int i, first;
+
+    memset(h, 0, hash_array_len);
+    strncpy(h, hash, GHT_MAX_HASH_LENGTH);
+    if ( node->hash )
+    {
+        if ( strlen(h) + strlen(node->hash) > GHT_MAX_HASH_LENGTH )
+        {
+            ght_error("%s: tree is deeper than the longest hash", __func__);
+            return GHT_ERROR;
+        }
+        strcat(h, node->hash);
+    }
+    GHT_TRY(ght_area_from_hash(h, &(c->cell)));
+    c->coord.x = (c->cell.x.min + c->cell.x.max) / 2.0;
+    c->coord.y = (c->cell.y.min + c->cell.y.max) / 2.0;
+    c->leaf = -1;
+    c->num_children = 0;
+
+    if ( ght_knn_is_leaf(node) )
+    {
+        c->leaf = join->num_leaves++;
+        return GHT_OK;
+    }
+
+    /* Reserve a run of cells for the children, then fill each in */
+    first = join->num_cells;
+    join->num_cells += node->children->num_nodes;
+    c->first_child = first;
+    c->num_children = node->children->num_nodes;
+    for ( i = 0; i < node->children->num_nodes; i++ )
+    {
+        join->cells[first + i].node = node->children->nodes[i];
+        GHT_TRY(ght_knn_cells_build(join, first + i, h));
+    }
+    return GHT_OK;
+}
+
+static int
+ght_knn_count_nodes(const GhtNode *node)
+{
+    int i, count = 1;
+    if ( node->children )
+    {
+        for ( i = 0; i < node->children->num_nodes; i++ )
+            count += ght_knn_count_nodes(node->children->nodes[i]);
+    }
+    return count;
+}
+
+/** Squared distance between two areas, zero if they touch */
+static double
+ght_knn_area_area_distance(const GhtArea *a, const GhtArea *b)
+{
+    double dx = 0.0, dy = 0.0;
+    if ( a->x.max < b->x.min ) dx = b->x.min - a->x.max;
+    else if ( b->x.max < a->x.min ) dx = a->x.min - b->x.max;
+    if ( a->y.max < b->y.min ) dy = b->y.min - a->y.max;
+    else if ( b->y.max < a->y.min ) dy = a->y.min - b->y.max;
+    return dx*dx + dy*dy;
+}
+
+static void
+ght_knn_worker_push(GhtKnnWorker *w, int cell, double distance)
+{
+    int i;
+    if ( w->heap_size == w->max_heap )
+    {
+        w->max_heap = w->max_heap ? 2 * w->max_heap : 64;
+        w->heap = ght_realloc(w->heap, w->max_heap * sizeof(int));
+        w->heap_distance = ght_realloc(w->heap_distance, w->max_heap * sizeof(double));
+    }
+    i = w->heap_size++;
+    while ( i > 0 && distance < w->heap_distance[(i-1)/2] )
+    {
+        w->heap[i] = w->heap[(i-1)/2];
+        w->heap_distance[i] = w->heap_distance[(i-1)/2];
+        i = (i-1)/2;
+    }
+    w->heap[i] = cell;
+    w->heap_distance[i] = distance;
+}
+
+static int
+ght_knn_worker_pop(GhtKnnWorker *w, double *distance)
+{
+    int top = w->heap[0];
+    int last = w->heap[--w->heap_size];
+    double last_distance = w->heap_distance[w->heap_size];
+    int i = 0;
+
+    *distance = w->heap_distance[0];
+    while ( 1 )
+    {
+        int c = 2*i + 1;
+        if ( c >= w->heap_size ) break;
+        if ( c + 1 < w->heap_size && w->heap_distance[c+1] < w->heap_distance[c] ) c++;
+        if ( last_distance <= w->heap_distance[c] ) break;
+        w->heap[i] = w->heap[c];
+        w->heap_distance[i] = w->heap_distance[c];
+        i = c;
+    }
+    if ( w->heap_size > 0 )
+    {
+        w->heap[i] = last;
+        w->heap_distance[i] = last_distance;
+    }
+    return top;
+}
+
+static void
+ght_knn_worker_add_candidate(GhtKnnWorker *w, int cell)
+{
+    if ( w->num_candidates == w->max_candidates )
+    {
+        w->max_candidates = w->max_candidates ? 2 * w->max_candidates : 64;
+        w->candidates = ght_realloc(w->candidates, w->max_candidates * sizeof(int));
+        w->distances = ght_realloc(w->distances, w->max_candidates * sizeof(double));
+        w->order = ght_realloc(w->order, w->max_candidates * sizeof(int));
+    }
+    w->candidates[w->num_candidates++] = cell;
+}
+
+static void
+ght_knn_worker_free(GhtKnnWorker *w)
+{
+    if ( w->heap ) ght_free(w->heap);
+    if ( w->heap_distance ) ght_free(w->heap_distance);
+    if ( w->candidates ) ght_free(w->candidates);
+    if ( w->distances ) ght_free(w->distances);
+    if ( w->order ) ght_free(w->order);
+    if ( w->neighbours ) ght_free(w->neighbours);
+    if ( w->neighbour_distances ) ght_free(w->neighbour_distances);
+}
+
+static double
+ght_knn_point_distance(const GhtCoordinate *a, const GhtCoordinate *b)
+{
+    double dx = a->x - b->x;
+    double dy = a->y - b->y;
+    return dx*dx + dy*dy;
+}
+
+/**
+* Sort the n nearest of the num candidates listed in order to the
+* front of it. A partial insertion sort, since k is small next to
+* the number of candidates.
+*/
+static void
+ght_knn_select(GhtKnnWorker *w, int num, int n)
+{
+    int i, j;
+    for ( i = 0; i < num; i++ )
+    {
+        int o = w->order[i];
+        double d = w->distances[o];
+        if ( i >= n )
+        {
+            if ( d >= w->distances[w->order[n-1]] )
+                continue;
+            j = n - 1;
+        }
+        else
+        {
+            j = i;
+        }
+        while ( j > 0 && w->distances[w->order[j-1]] > d )
+        {
+            w->order[j] = w->order[j-1];
+            j--;
+        }
+        w->order[j] = o;
+    }
+}
+
+/**
+* Find the neighbours of all the leaf children of one cell. One
+* best-first walk from the box around those leaves gathers k+1 points,
+* which bound how far any leaf in the group must look. The rest of the
+* walk collects every point within that bound, and each leaf then
+* picks its k nearest from those shared candidates.
+*/
+static GhtErr
+ght_knn_group(GhtKnnJoin *join, GhtKnnWorker *w, int parent)
+{
+    const GhtKnnCell *p = &(join->cells[parent]);
+    GhtArea box;
+    double bound = -1.0;
+    int i, j, num_group = 0;
+    int k = join->k;
+
+    /* Box around the leaves of the group */
+    for ( i = p->first_child; i < p->first_child + p->num_children; i++ )
+    {
+        const GhtKnnCell *c = &(join->cells[i]);
+        if ( c->leaf < 0 ) continue;
+        if ( num_group == 0 )
+        {
+            box.x.min = box.x.max = c->coord.x;
+            box.y.min = box.y.max = c->coord.y;
+        }
+        else
+        {
+            if ( c->coord.x < box.x.min ) box.x.min = c->coord.x;
+            if ( c->coord.x > box.x.max ) box.x.max = c->coord.x;
+            if ( c->coord.y < box.y.min ) box.y.min = c->coord.y;
+            if ( c->coord.y > box.y.max ) box.y.max = c->coord.y;
+        }
+        num_group++;
+    }
+    if ( ! num_group )
+        return GHT_OK;
+
+    /* Gather candidates nearest the box first */
+    w->heap_size = 0;
+    w->num_candidates = 0;
+    ght_knn_worker_push(w, 0, 0.0);
+    while ( w->heap_size > 0 )
+    {
+        double distance;
+        int cell = ght_knn_worker_pop(w, &distance);
+        const GhtKnnCell *c = &(join->cells[cell]);
+
+        if ( bound >= 0.0 && distance > bound )
+            break;
+
+        if ( c->leaf >= 0 )
+        {
+            ght_knn_worker_add_candidate(w, cell);
+            /* Every point in the group has k others within the bound */
+            if ( bound < 0.0 && w->num_candidates == k + 1 )
+            {
+                bound = 0.0;
+                for ( i = p->first_child; i < p->first_child + p->num_children; i++ )
+                {
+                    if ( join->cells[i].leaf < 0 ) continue;
+                    for ( j = 0; j < w->num_candidates; j++ )
+                    {
+                        double d = ght_knn_point_distance(&(join->cells[i].coord), &(join->cells[w->candidates[j]].coord));
+                        if ( d > bound ) bound = d;
+                    }
+                }
+            }
+        }
+        else
+        {
+            for ( i = c->first_child; i < c->first_child + c->num_children; i++ )
+            {
+                const GhtKnnCell *child = &(join->cells[i]);
+                if ( child->leaf >= 0 )
+                {
+                    GhtArea pt;
+                    pt.x.min = pt.x.max = child->coord.x;
+                    pt.y.min = pt.y.max = child->coord.y;
+                    ght_knn_worker_push(w, i, ght_knn_area_area_distance(&pt, &box));
+                }
+                else
+                {
+                    ght_knn_worker_push(w, i, ght_knn_area_area_distance(&(child->cell), &box));
+                }
+            }
+        }
+    }
+
+    /* Each leaf takes its nearest k from the shared candidates */
+    for ( i = p->first_child; i < p->first_child + p->num_children; i++ )
+    {
+        const GhtKnnCell *q = &(join->cells[i]);
+        int num = 0, n;
+        GhtErr err;
+
+        if ( q->leaf < 0 ) continue;
+        for ( j = 0; j < w->num_candidates; j++ )
+        {
+            const GhtKnnCell *c = &(join->cells[w->candidates[j]]);
+            if ( c->leaf == q->leaf ) continue;
+            w->distances[j] = ght_knn_point_distance(&(q->coord), &(c->coord));
+            w->order[num++] = j;
+        }
+        n = num < k ? num : k;
+        if ( n > 0 )
+            ght_knn_select(w, num, n);
+        for ( j = 0; j < n; j++ )
+        {
+            w->neighbours[j] = join->cells[w->candidates[w->order[j]]].leaf;
+            w->neighbour_distances[j] = sqrt(w->distances[w->order[j]]);
+        }
+        err = join->callback(q->leaf, &(q->coord), n, w->neighbours, w->neighbour_distances, join->data);
+        if ( err != GHT_OK )
+            return err;
+    }
+    return GHT_OK;
+}
+
+/** Visit every group of sibling leaves in the subtree under a cell */
+static GhtErr
+ght_knn_subtree(GhtKnnJoin *join, GhtKnnWorker *w, int cell)
+{
+    const GhtKnnCell *c = &(join->cells[cell]);
+    GhtErr err;
+    int i;
+
+    if ( c->leaf >= 0 )
+        return GHT_OK;
+
+    err = ght_knn_group(join, w, cell);
+    if ( err != GHT_OK )
+        return err;
+    for ( i = c->first_child; i < c->first_child + c->num_children; i++ )
+    {
+        err = ght_knn_subtree(join, w, i);
+        if ( err != GHT_OK )
+            return err;
+    }
+    return GHT_OK;
+}
+
+/** Work through the top-level subtrees until none are left */
+static void *
+ght_knn_worker(void *arg)
+{
+    GhtKnnJoin *join = arg;
+    const GhtKnnCell *root = &(join->cells[0]);
+    GhtContext *context;
+    GhtKnnWorker w;
+
+    /* Each thread has its own current context, so take up the tree's */
+    context = ght_context_swap(join->context);
+    memset(&w, 0, sizeof(GhtKnnWorker));
+    w.neighbours = ght_malloc((join->k ? join->k : 1) * sizeof(int));
+    w.neighbour_distances = ght_malloc((join->k ? join->k : 1) * sizeof(double));
+
+    while ( 1 )
+    {
+        int subtree;
+        GhtErr err;
+
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&(join->lock));
+#endif
+        subtree = join->next_subtree++;
+        err = join->err;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&(join->lock));
+#endif
+        if ( err != GHT_OK || subtree >= root->num_children )
+            break;
+
+        err = ght_knn_subtree(join, &w, root->first_child + subtree);
+        if ( err != GHT_OK )
+        {
+#ifdef HAVE_PTHREAD
+            pthread_mutex_lock(&(join->lock));
+#endif
+            if ( join->err == GHT_OK )
+                join->err = err;
+#ifdef HAVE_PTHREAD
+            pthread_mutex_unlock(&(join->lock));
+#endif
+        }
+    }
+
+    ght_knn_worker_free(&w);
+    ght_context_swap(context);
+    return NULL;
+}
+
+/**
+* Find the k nearest neighbours of every point in the tree, passing
+* each point (numbered in tree order) and its neighbours, nearest
+* first, to the callback. The tree is flattened in one traversal and
+* sibling leaves share one candidate search. With pthreads, the
+* top-level subtrees are shared out between num_threads workers, so
+* the callback must then be safe to call from several threads.
+* A callback can return GHT_DONE to stop early. All the scratch
+* space, in every thread, comes from the tree's context.
+*/
+GhtErr
+ght_tree_knn_all(const GhtTree *tree, int k, int num_threads, GhtKnnCallback callback, void *data)
+{
+    GhtKnnJoin join;
+    GhtContext *context;
+    GhtErr err;
+
+    if ( ! tree || ! callback || k < 0 )
+        return GHT_ERROR;
+    if ( ! tree->root )
+        return GHT_OK;
+
+    memset(&join, 0, sizeof(GhtKnnJoin));
+    join.k = k;
+    join.callback = callback;
+    join.data = data;
+    join.err = GHT_OK;
+    join.context = tree->context;
+    context = ght_context_swap(tree->context);
+    join.cells = ght_malloc(ght_knn_count_nodes(tree->root) * sizeof(GhtKnnCell));
+    join.cells[0].node = tree->root;
+    join.num_cells = 1;
+    err = ght_knn_cells_build(&join, 0, "");
+
+    /* A root that is itself the only point, or has points of its own */
+    if ( err == GHT_OK && join.cells[0].leaf >= 0 )
+    {
+        err = callback(0, &(join.cells[0].coord), 0, NULL, NULL, data);
+    }
+    else if ( err == GHT_OK )
+    {
+        GhtKnnWorker w;
+        memset(&w, 0, sizeof(GhtKnnWorker));
+        w.neighbours = ght_malloc((k ? k : 1) * sizeof(int));
+        w.neighbour_distances = ght_malloc((k ? k : 1) * sizeof(double));
+        err = ght_knn_group(&join, &w, 0);
+        ght_knn_worker_free(&w);
+    }
+
+    if ( err == GHT_OK && join.cells[0].leaf < 0 )
+    {
+#ifdef HAVE_PTHREAD
+        if ( num_threads > 1 )
+        {
+            pthread_t *threads;
+            int i, started = 0;
+
+            pthread_mutex_init(&(join.lock), NULL);
+            threads = ght_malloc(num_threads * sizeof(pthread_t));
+            for ( i = 0; i < num_threads; i++ )
+            {
+                if ( pthread_create(&(threads[i]), NULL, ght_knn_worker, &join) == 0 )
+                    started++;
+                else
+                    break;
+            }
+            /* Carry on in this thread if no workers could start */
+            if ( ! started )
+                ght_knn_worker(&join);
+            for ( i = 0; i < started; i++ )
+                pthread_join(threads[i], NULL);
+            ght_free(threads);
+            pthread_mutex_destroy(&(join.lock));
+        }
+        else
+        {
+            pthread_mutex_init(&(join.lock), NULL);
+            ght_knn_worker(&join);
+            pthread_mutex_destroy(&(join.lock));
+        }
+#else
+        ght_knn_worker(&join);
+#endif
+        err = join.err;
+    }
+
+    ght_free(join.cells);
+    ght_context_swap(context);
+
+    /* Stopping early is not a failure */
+    if ( err == GHT_DONE )
+        return GHT_OK;
+    return err;
+}
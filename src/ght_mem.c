@@ -21,8 +21,18 @@ struct GhtContext_t
     GhtMessageHandler info;
 };
 
+/* Process-wide default, set up by ght_init and ght_set_handlers */
 static struct GhtContext_t ght_context;
 
+/* Context of the calling thread, the default when NULL */
+#ifdef HAVE_TLS
+static __thread GhtContext *ght_thread_context = NULL;
+#else
+static GhtContext *ght_thread_context = NULL;
+#endif
+
+#define GHT_CONTEXT (ght_thread_context ? ght_thread_context : &ght_context)
+
 
 static void *
 default_allocator(size_t size)
@@ -118,6 +128,63 @@ void ght_set_handlers(GhtAllocator allocator, GhtReallocator reallocator,
     );
 }
 
+GhtErr
+ght_context_new(GhtAllocator allocator, GhtReallocator reallocator,
+                GhtDeallocator deallocator, GhtMessageHandler error_handler,
+                GhtMessageHandler info_handler, GhtMessageHandler warn_handler,
+                GhtContext **context)
+{
+    GhtContext *ctx;
+    GhtAllocator alloc = allocator ? allocator : ght_context.alloc;
+
+    ctx = alloc(sizeof(GhtContext));
+    if ( ! ctx )
+        return GHT_ERROR;
+    memset(ctx, 0, sizeof(GhtContext));
+
+    /* Anything not given comes from the process default */
+    ctx->alloc   = alloc;
+    ctx->realloc = reallocator ? reallocator : ght_context.realloc;
+    ctx->free    = deallocator ? deallocator : ght_context.free;
+    ctx->err     = error_handler ? error_handler : ght_context.err;
+    ctx->info    = info_handler ? info_handler : ght_context.info;
+    ctx->warn    = warn_handler ? warn_handler : ght_context.warn;
+    *context = ctx;
+    return GHT_OK;
+}
+
+GhtErr
+ght_context_free(GhtContext *context)
+{
+    if ( ! context )
+        return GHT_ERROR;
+    if ( ght_thread_context == context )
+        ght_thread_context = NULL;
+    context->free(context);
+    return GHT_OK;
+}
+
+GhtErr
+ght_context_set_current(GhtContext *context)
+{
+    ght_thread_context = context;
+    return GHT_OK;
+}
+
+GhtContext *
+ght_context_get_current(void)
+{
+    return ght_thread_context;
+}
+
+GhtContext *
+ght_context_swap(GhtContext *context)
+{
+    GhtContext *old = ght_thread_context;
+    ght_thread_context = context;
+    return old;
+}
+
 void ght_set_allocator(GhtAllocator allocator)
 {
     ght_context.alloc = allocator;
@@ -131,7 +198,7 @@ void ght_set_deallocator(GhtDeallocator deallocator)
 void *
 ght_malloc(size_t size)
 {
-    void *mem = ght_context.alloc(size);
+    void *mem = GHT_CONTEXT->alloc(size);
     if ( ! mem )
     {
         ght_error("%s: unable to allocate %zu bytes", __func__, size);
@@ -158,7 +225,7 @@ ght_strdup(const char *str)
 void *
 ght_realloc(void * mem, size_t size)
 {
-    void *newmem = ght_context.realloc(mem, size);
+    void *newmem = GHT_CONTEXT->realloc(mem, size);
     if ( ! newmem )
     {
         ght_error("%s: unable to reallocate %zu bytes", __func__, size);
@@ -170,7 +237,7 @@ ght_realloc(void * mem, size_t size)
 void
 ght_free(void * mem)
 {
-    ght_context.free(mem);
+    GHT_CONTEXT->free(mem);
 }
 
 void
@@ -178,7 +245,7 @@ ght_error(const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    (*ght_context.err)(fmt, ap);
+    (*GHT_CONTEXT->err)(fmt, ap);
     va_end(ap);
 }
 
@@ -187,7 +254,7 @@ ght_info(const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    (*ght_context.info)(fmt, ap);
+    (*GHT_CONTEXT->info)(fmt, ap);
     va_end(ap);
 }
 
@@ -196,7 +263,7 @@ ght_warn(const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    (*ght_context.warn)(fmt, ap);
+    (*GHT_CONTEXT->warn)(fmt, ap);
     va_end(ap);
 }
 
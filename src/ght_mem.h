@@ -23,4 +23,16 @@ void   ght_set_allocator(GhtAllocator allocator);
 /** Set the free handler */
 void   ght_set_deallocator(GhtDeallocator deallocator);
 
+/** Create a context of memory and message handlers, NULL handlers come from the default */
+GhtErr ght_context_new(GhtAllocator allocator, GhtReallocator reallocator,
+                       GhtDeallocator deallocator, GhtMessageHandler error_handler,
+                       GhtMessageHandler info_handler, GhtMessageHandler warn_handler,
+                       GhtContext **context);
+
+/** Free a context, nothing allocated through it may be used afterwards */
+GhtErr ght_context_free(GhtContext *context);
+
+/** Use a context for everything the calling thread does, NULL for the default */
+GhtErr ght_context_set_current(GhtContext *context);
+
 #endif /* _GHT_MEM_H */
\ No newline at end of file
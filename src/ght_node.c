@@ -81,28 +81,45 @@ ght_nodelist_free_deep(GhtNodeList *nl)
     return ght_nodelist_free_shallow(nl);
 }
 
-/** Add node, adding memory space as necessary. */
+/** Make room for at least capacity nodes, without changing the contents */
 GhtErr
-ght_nodelist_add_node(GhtNodeList *nl, GhtNode *node)
+ght_nodelist_reserve(GhtNodeList *nl, int capacity)
 {
+    GhtNode **nodes;
 
-    /* First time, initialize */
-    if ( nl->max_nodes == 0 )
-    {
-        nl->nodes = ght_malloc(sizeof(GhtNode*) * 8);
-        nl->max_nodes = 8;
-    }
+    if ( capacity <= nl->max_nodes )
+        return GHT_OK;
 
-    /* Node list is full, so expand it */
-    if ( nl->num_nodes == nl->max_nodes )
-    {
-        nl->max_nodes *= 2;
-        nl->nodes = ght_realloc(nl->nodes, sizeof(GhtNode*) * nl->max_nodes);
-        if ( ! nl->nodes ) return GHT_ERROR;
-    }
+    if ( nl->nodes )
+        nodes = ght_realloc(nl->nodes, sizeof(GhtNode*) * capacity);
+    else
+        nodes = ght_malloc(sizeof(GhtNode*) * capacity);
 
     /* Something wrong with memory? */
-    if ( ! nl->nodes ) return GHT_ERROR;
+    if ( ! nodes ) return GHT_ERROR;
+
+    nl->nodes = nodes;
+    nl->max_nodes = capacity;
+    return GHT_OK;
+}
+
+/** Room for needed nodes, doubling up from 8 so appends stay cheap */
+static GhtErr
+ght_nodelist_grow(GhtNodeList *nl, int needed)
+{
+    int capacity = nl->max_nodes ? nl->max_nodes : 8;
+    if ( needed <= nl->max_nodes )
+        return GHT_OK;
+    while ( capacity < needed )
+        capacity *= 2;
+    return ght_nodelist_reserve(nl, capacity);
+}
+
+/** Add node, adding memory space as necessary. */
+GhtErr
+ght_nodelist_add_node(GhtNodeList *nl, GhtNode *node)
+{
+    GHT_TRY(ght_nodelist_grow(nl, nl->num_nodes + 1));
 
     /* Add the node to list */
     nl->nodes[nl->num_nodes] = node;
@@ -110,6 +127,19 @@ ght_nodelist_add_node(GhtNodeList *nl, GhtNode *node)
     return GHT_OK;
 }
 
+/** Add num_nodes nodes in one go, growing the list at most once */
+GhtErr
+ght_nodelist_add_nodes(GhtNodeList *nl, GhtNode **nodes, int num_nodes)
+{
+    if ( num_nodes <= 0 )
+        return num_nodes ? GHT_ERROR : GHT_OK;
+
+    GHT_TRY(ght_nodelist_grow(nl, nl->num_nodes + num_nodes));
+    memcpy(nl->nodes + nl->num_nodes, nodes, sizeof(GhtNode*) * num_nodes);
+    nl->num_nodes += num_nodes;
+    return GHT_OK;
+}
+
 
 
 /******************************************************************************
@@ -117,7 +147,7 @@ ght_nodelist_add_node(GhtNodeList *nl, GhtNode *node)
 ******************************************************************************/
 
 /** Some nodelist utility functions */
-static int
+int
 ght_node_is_leaf(const GhtNode *node)
 {
     return (! node->children) || (node->children->num_nodes == 0);
@@ -136,10 +166,12 @@ ght_node_new(GhtNode **node)
 {
     GhtNode *n = ght_malloc(sizeof(GhtNode));
     if ( ! n ) return GHT_ERROR;
+    GHT_STATS_ADD(nodes_allocated, 1);
     memset(n, 0, sizeof(GhtNode));
     n->children = NULL;
     n->attributes = NULL;
     n->hash = NULL;
+    n->num_leaves = 1;
     *node = n;
     return GHT_OK;
 }
@@ -190,21 +222,31 @@ GhtErr
 ght_node_new_from_coordinate(const GhtCoordinate *coord, unsigned int resolution, GhtNode **node)
 {
     GhtHash *hash;
+    GhtErr err;
     assert(node != NULL);
     assert(coord != NULL);
-    GHT_TRY(ght_hash_from_coordinate(coord, resolution, &hash));
+    GHT_STATS_START(hash);
+    err = ght_hash_from_coordinate(coord, resolution, &hash);
+    GHT_STATS_STOP(hash);
+    GHT_TRY(err);
     GHT_TRY(ght_node_new(node));
     GHT_TRY(ght_node_set_hash(*node, hash));
     return GHT_OK;
 }
 
-static GhtErr
+GhtErr
 ght_node_add_child(GhtNode *parent, GhtNode *child)
 {
+    GHT_TRY(ght_node_clear_sample(parent));
     if ( ! parent->children )
     {
-        ght_nodelist_new(1, &(parent->children));
+        GHT_TRY(ght_nodelist_new(GHT_NODELIST_CHILD_CAPACITY, &(parent->children)));
     }
+    /* A leaf taking its first child only counts what is under it */
+    if ( parent->children->num_nodes == 0 )
+        parent->num_leaves = child->num_leaves;
+    else
+        parent->num_leaves += child->num_leaves;
     return ght_nodelist_add_node(parent->children, child);
 }
 
@@ -227,15 +269,24 @@ ght_node_transfer_attributes(GhtNode *node_from, GhtNode *node_to)
     return GHT_OK;
 }
 
+/** Widen the summaries of node to cover everything carried by another node */
+static GhtErr
+ght_node_extend_summary(GhtNode *node, const GhtNode *from)
+{
+    return ght_summary_extend_by_node(&(node->summaries), from);
+}
+
 /**
 * Recursive function, walk down from parent node, looking for
 * appropriate insertion point for node_to_insert. If duplicates,
 * and duplicate leaf, insert as hash-less "attribute only" node.
 * ["abcdefg", "abcdeff", "abcdddd", "abbbeee"] becomes
 * "ab"->["c"->["d"->["ddd","ef"->["g","f"]]],"b"]
+* When summarizing, every interior node on the insertion path has
+* its summaries widened to take in the attributes of the new node.
 */
-GhtErr
-ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates duplicates)
+static GhtErr
+ght_node_insert(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates duplicates, int summarize)
 {
     GhtHash *node_leaf, *node_to_insert_leaf;
     GhtErr err;
@@ -256,14 +307,31 @@ ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates dupli
     if ( matchtype == GHT_CHILD || matchtype == GHT_GLOBAL )
     {
         int i;
+        /* This node is about to gain a point, so its sample is stale */
+        GHT_TRY(ght_node_clear_sample(node));
         ght_node_set_hash(node_to_insert, ght_strdup(node_to_insert_leaf));
+        /* A leaf about to become an interior node starts with its own values, */
+        /* which settle its filters directly and so count no leaves */
+        if ( summarize && ght_node_is_leaf(node) )
+            GHT_TRY(ght_summary_extend_by_attribute(&(node->summaries), node->attributes, 0));
         for ( i = 0; i < ght_node_num_children(node); i++ )
         {
-            err = ght_node_insert_node(node->children->nodes[i], node_to_insert, duplicates);
-            /* Node added to one of the children */
-            if ( err == GHT_OK ) return GHT_OK;
+            GhtNode *child = node->children->nodes[i];
+            int num_leaves = child->num_leaves;
+            err = ght_node_insert(child, node_to_insert, duplicates, summarize);
+            /* Node added to one of the children, which may have dropped it as a duplicate */
+            if ( err == GHT_OK )
+            {
+                GHT_STATS_ADD(descents, 1);
+                if ( summarize && child->num_leaves > num_leaves )
+                    GHT_TRY(ght_node_extend_summary(node, node_to_insert));
+                node->num_leaves += child->num_leaves - num_leaves;
+                return GHT_OK;
+            }
         }
         /* Node didn't fit any of the children, so add it at this level */
+        if ( summarize )
+            GHT_TRY(ght_node_extend_summary(node, node_to_insert));
         return ght_node_add_child(node, node_to_insert);
     }
 
@@ -272,8 +340,10 @@ ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates dupli
         /* New node is duplicate of this node. We insert an */
         /* empty node (no hash) underneath, to hang attributes off of */
         /* and use this node as the parent */
+        GHT_STATS_ADD(duplicates, 1);
         if ( duplicates )
         {
+            GHT_TRY(ght_node_clear_sample(node));
             /* If this is the first duplicate, add a copy of the parent */
             /* To serve as a proxy leaf for this value */
             if ( ( ! node->children ) || ( node->children->num_nodes == 0 ) )
@@ -282,7 +352,11 @@ ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates dupli
                 GHT_TRY(ght_node_new(&parent_leaf));
                 GHT_TRY(ght_node_transfer_attributes(node, parent_leaf));
                 GHT_TRY(ght_node_add_child(node, parent_leaf));
+                if ( summarize )
+                    GHT_TRY(ght_node_extend_summary(node, parent_leaf));
             }
+            if ( summarize )
+                GHT_TRY(ght_node_extend_summary(node, node_to_insert));
             
             /* Add the new node under the parent, stripping the hash */
             ght_free(node_to_insert->hash);
@@ -304,6 +378,8 @@ ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates dupli
     {
         /* We need a new node to hold that part of the parent that is not shared */
         GhtNode *another_node_to_insert;
+        GHT_STATS_ADD(splits, 1);
+        GHT_TRY(ght_node_clear_sample(node));
         GHT_TRY(ght_node_new_from_hash(node_leaf, &another_node_to_insert));
         /* Move attributes to the new child */
         GHT_TRY(ght_node_transfer_attributes(node, another_node_to_insert));
@@ -314,6 +390,15 @@ ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates dupli
             another_node_to_insert->children = node->children;
             node->children = NULL;
         }
+        /* Along with the summaries and count of those children */
+        another_node_to_insert->summaries = node->summaries;
+        node->summaries = NULL;
+        another_node_to_insert->num_leaves = node->num_leaves;
+        if ( summarize )
+        {
+            GHT_TRY(ght_node_extend_summary(node, another_node_to_insert));
+            GHT_TRY(ght_node_extend_summary(node, node_to_insert));
+        }
         /* Null-terminate parent hash at end of shared part */
         *node_leaf = '\0';
         /* Pull the non-shared part of insert node hash to the front */
@@ -331,6 +416,48 @@ ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates dupli
 
 }
 
+GhtErr
+ght_node_insert_node(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates duplicates)
+{
+    return ght_node_insert(node, node_to_insert, duplicates, 0);
+}
+
+GhtErr
+ght_node_insert_node_summarized(GhtNode *node, GhtNode *node_to_insert, GhtDuplicates duplicates)
+{
+    return ght_node_insert(node, node_to_insert, duplicates, 1);
+}
+
+/**
+* Bottom-up rebuild of summaries, for trees that were built
+* without them. Each interior node covers its own attributes and
+* everything carried by its children, counting only the leaves
+* of the children, as its own attributes hold for all of them.
+*/
+GhtErr
+ght_node_summarize(GhtNode *node)
+{
+    int i;
+
+    if ( node->summaries )
+    {
+        GHT_TRY(ght_summary_free(node->summaries));
+        node->summaries = NULL;
+    }
+
+    if ( ght_node_is_leaf(node) )
+        return GHT_OK;
+
+    GHT_TRY(ght_summary_extend_by_attribute(&(node->summaries), node->attributes, 0));
+    for ( i = 0; i < node->children->num_nodes; i++ )
+    {
+        GhtNode *child = node->children->nodes[i];
+        GHT_TRY(ght_node_summarize(child));
+        GHT_TRY(ght_node_extend_summary(node, child));
+    }
+    return GHT_OK;
+}
+
 
 GhtErr
 ght_node_to_string(GhtNode *node, stringbuffer_t *sb, int level)
@@ -366,24 +493,82 @@ ght_node_to_string(GhtNode *node, stringbuffer_t *sb, int level)
 }
 
 
+/** Add the points under node to count, kept up to date as children are added */
 GhtErr
 ght_node_count_leaves(const GhtNode *node, int *count)
 {
-    int i;
-    GhtErr err;
-    
     /* No-op on empty */
     if ( ! node ) return GHT_OK;
-    
-    if ( ght_node_is_leaf(node) )
+    *count += node->num_leaves;
+    return GHT_OK;
+}
+
+/** Bytes held by one node, its hash and attributes, but not its children */
+static size_t
+ght_node_profile_bytes(const GhtNode *node, GhtTreeProfile *profile)
+{
+    const GhtAttribute *attr;
+    size_t hash_bytes = node->hash ? strlen(node->hash) + 1 : 0;
+    size_t attribute_bytes = 0;
+
+    for ( attr = node->attributes; attr; attr = attr->next )
+        attribute_bytes += sizeof(GhtAttribute);
+
+    if ( profile )
     {
-        *count += 1;
-        return GHT_OK;
+        profile->node_bytes += sizeof(GhtNode);
+        profile->hash_bytes += hash_bytes;
+        profile->attribute_bytes += attribute_bytes;
     }
-    for ( i = 0; i < ght_node_num_children(node); i++ )
+    return sizeof(GhtNode) + hash_bytes + attribute_bytes;
+}
+
+GhtErr
+ght_node_profile(const GhtNode *node, int depth, GhtTreeProfile *profile)
+{
+    const GhtAttribute *attr;
+    const GhtSummary *summary;
+    int i, level, num_children = ght_node_num_children(node);
+
+    /* Anything deeper than we expect goes in with the deepest */
+    level = depth < GHT_PROFILE_MAX_DEPTH ? depth : GHT_PROFILE_MAX_DEPTH - 1;
+    profile->num_nodes++;
+    profile->depth[level]++;
+    if ( depth > profile->max_depth )
+        profile->max_depth = depth;
+
+    if ( node->hash )
+    {
+        size_t len = strlen(node->hash);
+        profile->fragment_length[len < GHT_MAX_HASH_LENGTH ? len : GHT_MAX_HASH_LENGTH]++;
+    }
+    else
+    {
+        profile->num_proxies++;
+    }
+
+    for ( attr = node->attributes; attr; attr = attr->next )
     {
-        GHT_TRY(ght_node_count_leaves(node->children->nodes[i], count));
+        profile->num_attributes++;
+        profile->depth_attributes[level]++;
     }
+    ght_node_profile_bytes(node, profile);
+
+    for ( summary = node->summaries; summary; summary = summary->next )
+        profile->summary_bytes += sizeof(GhtSummary);
+    if ( node->sample )
+        profile->sample_bytes += ght_node_profile_bytes(node->sample, NULL);
+
+    profile->fanout[num_children < GHT_PROFILE_MAX_FANOUT ? num_children : GHT_PROFILE_MAX_FANOUT]++;
+    if ( ! num_children )
+    {
+        profile->num_leaves++;
+        return GHT_OK;
+    }
+
+    profile->nodelist_bytes += sizeof(GhtNodeList) + node->children->max_nodes * sizeof(GhtNode*);
+    for ( i = 0; i < num_children; i++ )
+        GHT_TRY(ght_node_profile(node->children->nodes[i], depth + 1, profile));
     return GHT_OK;
 }
 
@@ -403,10 +588,51 @@ ght_node_free(GhtNode *node)
     if ( node->hash )
         GHT_TRY(ght_hash_free(node->hash));
 
+    if ( node->summaries )
+        GHT_TRY(ght_summary_free(node->summaries));
+
+    if ( node->sample )
+        GHT_TRY(ght_node_free(node->sample));
+
     ght_free(node);
 	return GHT_OK;
 }
 
+GhtErr
+ght_node_clear_sample(GhtNode *node)
+{
+    if ( node->sample )
+    {
+        GHT_TRY(ght_node_free(node->sample));
+        node->sample = NULL;
+    }
+    return GHT_OK;
+}
+
+
+GhtErr
+ght_node_clone(const GhtNode *node, GhtNode **node_out)
+{
+    int i;
+    GhtNode *n;
+
+    GHT_TRY(ght_node_new(&n));
+    GHT_TRY(ght_hash_clone(node->hash, &(n->hash)));
+    GHT_TRY(ght_attribute_clone(node->attributes, &(n->attributes)));
+    GHT_TRY(ght_summary_clone(node->summaries, &(n->summaries)));
+    if ( node->children && node->children->num_nodes > 0 )
+    {
+        GHT_TRY(ght_nodelist_new(node->children->num_nodes, &(n->children)));
+        for ( i = 0; i < node->children->num_nodes; i++ )
+        {
+            GhtNode *child;
+            GHT_TRY(ght_node_clone(node->children->nodes[i], &child));
+            GHT_TRY(ght_node_add_child(n, child));
+        }
+    }
+    *node_out = n;
+    return GHT_OK;
+}
 
 GhtErr
 ght_node_add_attribute(GhtNode *node, GhtAttribute *attribute)
@@ -485,91 +711,236 @@ ght_node_delete_attribute(GhtNode *node, const GhtDimension *dim)
     return GHT_OK;
 }
 
-/* 
-* Recursive compaction routine. Pulls attribute up to the highest node such that
-* all children share the attribute value.
+/* Settings for one compaction pass, and the errors it has introduced */
+typedef struct
+{
+    int num_dims;
+    const uint8_t *active;
+    const double *tolerances;
+    double *max_errors;
+} GhtCompaction;
+
+/* Values closer than this are the same value */
+#define GHT_COMPACT_EPSILON 10e-8
+
+/**
+* Bottom-up compaction of any number of dimensions in one pass. Each
+* node reports the range of the values under it in every active
+* dimension, if every point under it has one. Where that range is
+* within tolerance, the node takes over the midpoint, in the attribute
+* it already has or else the one of its first child, and the others
+* are dropped. Ranges are of the values below rather than of their
+* midpoints, so errors do not build up from level to level.
 */
 static GhtErr
-ght_node_compact_attribute_with_delta(GhtNode *node, 
-                                      const GhtDimension *dim, 
-                                      double delta, 
-                                      GhtAttribute *compacted_attribute)
+ght_node_compact_attributes_in_pass(GhtNode *node, GhtCompaction *pass, double *los, double *his, uint8_t *has)
 {
-    int i;
-    
-    /* This is an internal node, see if all the children share a value in this dimension */
-    if ( node->children && node->children->num_nodes > 0 )
+    int num_dims = pass->num_dims;
+    int i, d, num_children, num_compact = 0;
+    GhtAttribute *attr;
+
+    memset(has, 0, num_dims);
+
+    /* This is a leaf node, send the attribute values up to the caller */
+    if ( ! node->children || node->children->num_nodes == 0 )
     {
-        double minval = DBL_MAX;
-        double maxval = -1 * DBL_MAX;
-        double totval = 0.0;
-        int node_count = 0;
-        
-        /* Figure out the range of values for this dimension in child nodes */
-        for ( i = 0; i < node->children->num_nodes; i++ )
+        for ( attr = node->attributes; attr; attr = attr->next )
         {
-            GhtAttribute attr;
-            GhtErr err;
-            err = ght_node_compact_attribute_with_delta(node->children->nodes[i], dim, delta, &attr);
-            if ( err == GHT_OK )
+            d = attr->dim->position;
+            if ( d < num_dims && pass->active[d] && ! has[d] )
             {
-                double d;
-                GHT_TRY(ght_attribute_get_value(&attr, &d));
-                (d < minval) ? (minval = d) : 0;
-                (d > maxval) ? (maxval = d) : 0;
-                totval += d;
-                node_count++;
+                GHT_TRY(ght_attribute_get_value(attr, &(los[d])));
+                his[d] = los[d];
+                has[d] = 1;
             }
-            else
+        }
+        return GHT_OK;
+    }
+
+    num_children = node->children->num_nodes;
+    {
+        double child_los[num_dims], child_his[num_dims];
+        uint8_t child_has[num_dims], compact[num_dims];
+        int counts[num_dims];
+        GhtAttribute *own[num_dims], *moved[num_dims];
+        GhtAttribute **tail;
+
+        memset(counts, 0, num_dims * sizeof(int));
+
+        /* Values carried here reach any children that do not carry their own */
+        memset(own, 0, num_dims * sizeof(GhtAttribute*));
+        for ( attr = node->attributes; attr; attr = attr->next )
+        {
+            d = attr->dim->position;
+            if ( d < num_dims && pass->active[d] && ! own[d] )
+                own[d] = attr;
+        }
+
+        /* Figure out the range of values in each dimension of the children */
+        for ( i = 0; i < num_children; i++ )
+        {
+            GHT_TRY(ght_node_compact_attributes_in_pass(node->children->nodes[i], pass, child_los, child_his, child_has));
+            for ( d = 0; d < num_dims; d++ )
             {
-                continue;
+                if ( ! child_has[d] )
+                    continue;
+                if ( ! counts[d] || child_los[d] < los[d] ) los[d] = child_los[d];
+                if ( ! counts[d] || child_his[d] > his[d] ) his[d] = child_his[d];
+                counts[d]++;
             }
         }
-        
-        /* If the range is narrow, and we got values from all our children, compact them */
-        if ( (maxval-minval) < delta && node_count == node->children->num_nodes )
+
+        /* If the range is narrow, and every child has a value, compact them */
+        for ( d = 0; d < num_dims; d++ )
         {
-            double val = (minval+maxval)/2.0;
-            GhtAttribute *myattr;
-            for ( i = 0; i < node->children->num_nodes; i++ )
+            double tolerance = pass->tolerances ? pass->tolerances[d] : 0.0;
+            has[d] = 0;
+            compact[d] = 0;
+            moved[d] = NULL;
+            if ( own[d] && counts[d] < num_children )
             {
-                ght_node_delete_attribute(node->children->nodes[i], dim);
+                double val;
+                GHT_TRY(ght_attribute_get_value(own[d], &val));
+                if ( ! counts[d] || val < los[d] ) los[d] = val;
+                if ( ! counts[d] || val > his[d] ) his[d] = val;
             }
-            ght_attribute_new_from_double(dim, val, &myattr);
-            memcpy(compacted_attribute, myattr, sizeof(GhtAttribute));
-            ght_node_add_attribute(node, myattr);
+            else if ( counts[d] < num_children )
+            {
+                continue;
+            }
+            has[d] = (his[d] - los[d]) < tolerance + GHT_COMPACT_EPSILON;
+            compact[d] = has[d] && counts[d] > 0;
+            num_compact += compact[d];
+        }
+        if ( ! num_compact )
             return GHT_OK;
+
+        /* Unhook the first attribute of each compacted dimension from every child */
+        for ( i = 0; i < num_children; i++ )
+        {
+            GhtAttribute **link = &(node->children->nodes[i]->attributes);
+            memset(child_has, 0, num_dims);
+            while ( (attr = *link) )
+            {
+                d = attr->dim->position;
+                if ( d < num_dims && compact[d] && ! child_has[d] )
+                {
+                    child_has[d] = 1;
+                    *link = attr->next;
+                    attr->next = NULL;
+                    if ( ! own[d] && ! moved[d] )
+                    {
+                        moved[d] = attr;
+                    }
+                    else
+                    {
+                        ght_free(attr);
+                        GHT_STATS_ADD(attributes_compacted, 1);
+                    }
+                }
+                else
+                {
+                    link = &(attr->next);
+                }
+            }
+        }
+
+        /* and keep the midpoints here, in our own attribute or one hung off the end of our list */
+        for ( tail = &(node->attributes); *tail; tail = &((*tail)->next) );
+        for ( d = 0; d < num_dims; d++ )
+        {
+            GhtAttribute *kept;
+            double val;
+            if ( ! compact[d] )
+                continue;
+            kept = own[d] ? own[d] : moved[d];
+            GHT_TRY(ght_attribute_set_value(kept, (los[d] + his[d]) / 2.0));
+            if ( ! own[d] )
+            {
+                *tail = kept;
+                tail = &(kept->next);
+            }
+
+            /* Storage rounds the midpoint, so measure the error from what was kept */
+            if ( pass->max_errors )
+            {
+                GHT_TRY(ght_attribute_get_value(kept, &val));
+                if ( val - los[d] > pass->max_errors[d] ) pass->max_errors[d] = val - los[d];
+                if ( his[d] - val > pass->max_errors[d] ) pass->max_errors[d] = his[d] - val;
+            }
         }
-        return GHT_ERROR;
     }
-    /* This is a leaf node, send the attribute value up to the caller */
-    else
+    return GHT_OK;
+}
+
+/**
+* Compact all the attributes of the schema from 'Z' onwards, folding
+* values up wherever all those under a node lie within the tolerance
+* for their dimension. Tolerances and max_errors are indexed by
+* dimension position. NULL tolerances only fold equal values. Any
+* max_errors entry smaller than the largest difference between an
+* original value and the value now carried for it is raised to it.
+*/
+GhtErr
+ght_node_compact_attributes(GhtNode *node, const GhtSchema *schema, const double *tolerances, double *max_errors)
+{
+    int num_dims = schema->num_dims;
+    double los[num_dims ? num_dims : 1], his[num_dims ? num_dims : 1];
+    uint8_t has[num_dims ? num_dims : 1], active[num_dims ? num_dims : 1];
+    GhtCompaction pass;
+    int d;
+
+    if ( ! node )
+        return GHT_OK;
+    for ( d = 0; d < num_dims; d++ )
     {
-        if ( ! node->attributes ) return GHT_ERROR;
-        return ght_attribute_get_by_dimension(node->attributes, dim, compacted_attribute);
+        active[d] = d >= 2;
+        if ( tolerances && tolerances[d] < 0.0 )
+        {
+            ght_error("%s: negative tolerance for dimension '%s'", __func__, schema->dims[d]->name);
+            return GHT_ERROR;
+        }
     }
+
+    pass.num_dims = num_dims;
+    pass.active = active;
+    pass.tolerances = tolerances;
+    pass.max_errors = max_errors;
+    return ght_node_compact_attributes_in_pass(node, &pass, los, his, has);
 }
 
+/** Compact a single dimension, copying the attribute that reaches node into attr */
 GhtErr
 ght_node_compact_attribute(GhtNode *node, const GhtDimension *dim, GhtAttribute *attr)
 {
-    return ght_node_compact_attribute_with_delta(node, dim, 10e-8, attr);
+    int num_dims = dim->position + 1;
+    double los[num_dims], his[num_dims];
+    uint8_t has[num_dims], active[num_dims];
+    GhtCompaction pass;
+
+    memset(active, 0, num_dims);
+    active[dim->position] = 1;
+    pass.num_dims = num_dims;
+    pass.active = active;
+    pass.tolerances = NULL;
+    pass.max_errors = NULL;
+    GHT_TRY(ght_node_compact_attributes_in_pass(node, &pass, los, his, has));
+    if ( ! has[dim->position] )
+        return GHT_ERROR;
+    return ght_attribute_get_by_dimension(node->attributes, dim, attr);
 }
 
 /**
-* Recursive node serialization: 
+* Node head serialization, everything but the children:
 * - length of GhtHash
 * - GhtHash (no null terminator)
 * - number of GhtAttributes
 * - GhtAttribute[]
-* - number of child GhtNodes
-* - GhtNode[]
 */
 GhtErr 
-ght_node_write(const GhtNode *node, GhtWriter *writer)
+ght_node_write_head(const GhtNode *node, GhtWriter *writer)
 {
     uint8_t attrcount = 0;
-    uint8_t childcount = 0;
     GhtAttribute *attr = node->attributes;
 
     /* Write the hash */
@@ -583,32 +954,159 @@ ght_node_write(const GhtNode *node, GhtWriter *writer)
         ght_attribute_write(attr, writer); 
         attr = attr->next;
     }
+    return GHT_OK;
+}
+
+/**
+* Choose the reference values that the children of a node will be 
+* delta encoded against: the midpoint of the children's values, for
+* every integer dimension carried by at least two children.
+*/
+static GhtErr
+ght_node_delta_references(const GhtNode *node, GhtAttribute **refs)
+{
+    int i, d, num_dims = 0;
+    int64_t *mins = NULL, *maxs = NULL;
+    int *counts = NULL;
+    const GhtDimension **dims = NULL;
+    GhtAttribute *attr;
+    GhtErr err = GHT_ERROR;
+
+    *refs = NULL;
+
+    /* How wide do the per-dimension arrays need to be? */
+    for ( i = 0; i < node->children->num_nodes; i++ )
+    {
+        for ( attr = node->children->nodes[i]->attributes; attr; attr = attr->next )
+        {
+            uint8_t position;
+            GHT_TRY(ght_dimension_get_position(attr->dim, &position));
+            if ( position + 1 > num_dims )
+                num_dims = position + 1;
+        }
+    }
+    if ( ! num_dims )
+        return GHT_OK;
+
+    mins = ght_malloc(num_dims * sizeof(int64_t));
+    maxs = ght_malloc(num_dims * sizeof(int64_t));
+    counts = ght_malloc(num_dims * sizeof(int));
+    dims = ght_malloc(num_dims * sizeof(GhtDimension*));
+    if ( ! mins || ! maxs || ! counts || ! dims )
+        goto done;
+    memset(counts, 0, num_dims * sizeof(int));
+
+    for ( i = 0; i < node->children->num_nodes; i++ )
+    {
+        for ( attr = node->children->nodes[i]->attributes; attr; attr = attr->next )
+        {
+            int64_t v;
+            uint8_t position;
+            /* Floating point dimensions are always written raw */
+            if ( ght_attribute_get_integer(attr, &v) != GHT_OK )
+                continue;
+            if ( ght_dimension_get_position(attr->dim, &position) != GHT_OK )
+                goto done;
+            if ( ! counts[position] || v < mins[position] ) mins[position] = v;
+            if ( ! counts[position] || v > maxs[position] ) maxs[position] = v;
+            dims[position] = attr->dim;
+            counts[position]++;
+        }
+    }
+
+    /* Build the reference list, last dimension first so it comes out in order */
+    for ( d = num_dims - 1; d >= 0; d-- )
+    {
+        GhtAttribute *ref;
+        if ( counts[d] < 2 )
+            continue;
+        if ( ght_attribute_new_from_double(dims[d], 0.0, &ref) != GHT_OK )
+            goto done;
+        ref->next = *refs;
+        *refs = ref;
+        if ( ght_attribute_set_integer(ref, (int64_t)((uint64_t)mins[d] + ((uint64_t)maxs[d] - (uint64_t)mins[d]) / 2)) != GHT_OK )
+            goto done;
+    }
+    err = GHT_OK;
+
+done:
+    if ( err != GHT_OK )
+    {
+        ght_attribute_free(*refs);
+        *refs = NULL;
+    }
+    if ( mins ) ght_free(mins);
+    if ( maxs ) ght_free(maxs);
+    if ( counts ) ght_free(counts);
+    if ( dims ) ght_free(dims);
+    return err;
+}
+
+/**
+* Recursive node serialization: 
+* - node head (hash and attributes)
+* - number of child GhtNodes
+* - GhtSummary[] (only for interior nodes of summarized streams)
+* - number of reference GhtAttributes, GhtAttribute[] (only for
+*   interior nodes of delta encoded streams)
+* - GhtNode[]
+*/
+GhtErr 
+ght_node_write(const GhtNode *node, GhtWriter *writer)
+{
+    uint8_t childcount = 0;
+    int i;
+
+    /* Write the hash and attributes */
+    GHT_TRY(ght_node_write_head(node, writer));
 
     /* Write the children */
     if ( node->children )
         childcount = node->children->num_nodes;
     
-    ght_write(writer, &childcount, 1);
-    if ( childcount )
+    GHT_TRY(ght_write(writer, &childcount, 1));
+    if ( childcount && (writer->flags & GHT_FLAG_SUMMARIES) )
     {
-        int i;
-        for ( i = 0; i < node->children->num_nodes; i++ )
+        GHT_TRY(ght_summary_write(node->summaries, writer));
+    }
+    if ( childcount && (writer->flags & GHT_FLAG_DELTA) )
+    {
+        GhtAttribute *refs, *ref;
+        const GhtAttribute *parent_refs = writer->refs;
+        uint8_t refcount = 0;
+        GhtErr err;
+
+        /* References are written raw, then the children are written against them */
+        GHT_TRY(ght_node_delta_references(node, &refs));
+        for ( ref = refs; ref; ref = ref->next )
+            refcount++;
+        writer->refs = NULL;
+        err = ght_write(writer, &refcount, 1);
+        for ( ref = refs; err == GHT_OK && ref; ref = ref->next )
+            err = ght_attribute_write(ref, writer);
+        writer->refs = refs;
+        for ( i = 0; err == GHT_OK && i < node->children->num_nodes; i++ )
         {
-            ght_node_write(node->children->nodes[i], writer);
+            err = ght_node_write(node->children->nodes[i], writer);
         }
+        writer->refs = parent_refs;
+        ght_attribute_free(refs);
+        return err;
+    }
+    for ( i = 0; i < childcount; i++ )
+    {
+        GHT_TRY(ght_node_write(node->children->nodes[i], writer));
     }
     return GHT_OK;
 }
 
 /** 
-* Recursive node deserialization 
+* Node head deserialization, hash and attributes only
 */
 GhtErr 
-ght_node_read(GhtReader *reader, GhtNode **node)
+ght_node_read_head(GhtReader *reader, GhtNode **node)
 {
-    int i;
     uint8_t attrcount;
-    uint8_t childcount;
     GhtHash *hash = NULL;
     GhtNode *n = NULL;
     GhtAttribute *attr = NULL;
@@ -618,6 +1116,7 @@ ght_node_read(GhtReader *reader, GhtNode **node)
     if ( hash )
     {
         GHT_TRY(ght_node_new_from_hash(hash, &n));
+        ght_hash_free(hash);
     }
     else
     {
@@ -625,31 +1124,96 @@ ght_node_read(GhtReader *reader, GhtNode **node)
     }
 
     /* Read the attributes */
-    ght_read(reader, &attrcount, 1);
+    if ( ght_read(reader, &attrcount, 1) != GHT_OK )
+    {
+        ght_node_free(n);
+        return GHT_ERROR;
+    }
     while ( attrcount )
     {
-        GHT_TRY(ght_attribute_read(reader, &attr));
+        if ( ght_attribute_read(reader, &attr) != GHT_OK )
+        {
+            ght_node_free(n);
+            return GHT_ERROR;
+        }
         GHT_TRY(ght_node_add_attribute(n, attr));
         attrcount--;
     }
+
+    *node = n;
+    return GHT_OK;
+}
+
+/** 
+* Recursive node deserialization 
+*/
+GhtErr 
+ght_node_read(GhtReader *reader, GhtNode **node)
+{
+    int i;
+    uint8_t childcount;
+    GhtNode *n = NULL;
+    GhtAttribute *refs = NULL;
+    const GhtAttribute *parent_refs = reader->refs;
+    int delta = 0;
+    GhtErr err = GHT_ERROR;
+    
+    /* Read the hash string and attributes */
+    GHT_TRY(ght_node_read_head(reader, &n));
     
     /* Read the children */
-    ght_read(reader, &childcount, 1);
+    if ( ght_read(reader, &childcount, 1) != GHT_OK )
+        goto done;
     /* Set up an exactly sized node list to hold the children */
-    if ( childcount > 0 )
+    if ( childcount > 0 && ght_nodelist_new(childcount, &(n->children)) != GHT_OK )
+        goto done;
+    if ( childcount > 0 && (reader->flags & GHT_FLAG_SUMMARIES) &&
+         ght_summary_read(reader, &(n->summaries)) != GHT_OK )
+        goto done;
+    if ( childcount > 0 && (reader->flags & GHT_FLAG_DELTA) )
     {
-        GHT_TRY(ght_nodelist_new(childcount, &(n->children)));
+        uint8_t refcount;
+        /* References are read raw, then the children are read against them */
+        delta = 1;
+        reader->refs = NULL;
+        if ( ght_read(reader, &refcount, 1) != GHT_OK )
+            goto done;
+        while ( refcount )
+        {
+            GhtAttribute *ref;
+            if ( ght_attribute_read(reader, &ref) != GHT_OK )
+                goto done;
+            ref->next = refs;
+            refs = ref;
+            refcount--;
+        }
+        reader->refs = refs;
     }
     for ( i = 0; i < childcount; i++ )
     {
         GhtNode *nc = NULL;
-        GHT_TRY(ght_node_read(reader, &nc));
-        if ( nc )
+        if ( ght_node_read(reader, &nc) != GHT_OK )
+            goto done;
+        if ( nc && ght_node_add_child(n, nc) != GHT_OK )
         {
-            GHT_TRY(ght_node_add_child(n, nc));
+            ght_node_free(nc);
+            goto done;
         }
     }
-    
+    err = GHT_OK;
+
+done:
+    /* Put back the references of the parent, for its remaining children */
+    if ( delta )
+    {
+        ght_attribute_free(refs);
+        reader->refs = parent_refs;
+    }
+    if ( err != GHT_OK )
+    {
+        ght_node_free(n);
+        return err;
+    }
     *node = n;
     return GHT_OK;
 }
@@ -658,7 +1222,7 @@ ght_node_read(GhtReader *reader, GhtNode **node)
 GhtErr
 ght_node_to_nodelist(const GhtNode *node, GhtNodeList *nodelist, GhtAttribute *attr, GhtHash *hash)
 {
-    static int hash_array_len = GHT_MAX_HASH_LENGTH+1;
+    static const int hash_array_len = GHT_MAX_HASH_LENGTH+1;
     GhtHash h[hash_array_len];
     GhtAttribute *a;
     
@@ -701,7 +1265,7 @@ ght_node_to_nodelist(const GhtNode *node, GhtNodeList *nodelist, GhtAttribute *a
 GhtErr
 ght_node_get_extent(const GhtNode *node, const GhtHash *hash, GhtArea *area)
 {
-    static int hash_array_len = GHT_MAX_HASH_LENGTH + 1;    
+    static const int hash_array_len = GHT_MAX_HASH_LENGTH + 1;    
     GhtHash h[hash_array_len];
     GhtCoordinate coord;
     
@@ -734,89 +1298,171 @@ ght_node_get_extent(const GhtNode *node, const GhtHash *hash, GhtArea *area)
     return GHT_OK;
 }
     
-GhtErr 
-ght_node_filter_by_attribute(const GhtNode *node, const GhtFilter *filter, GhtNode **filtered_node)
+/**
+* Copy the parts of the tree that pass the predicate. Each node
+* settles what it can of the predicate terms for its subtree, so
+* passing subtrees are copied whole and failing ones are skipped.
+*/
+GhtErr
+ght_node_filter_by_predicate(const GhtNode *node, const GhtPredicate *predicate, const GhtHash *hash, const uint8_t *state, int num_terms, GhtNode **filtered_node)
 {
-    int i;
-    double val;
-    int keep = 1;
-    GhtAttribute *attr; 
+    static const int hash_array_len = GHT_MAX_HASH_LENGTH + 1;
+    GhtHash h[hash_array_len];
+    uint8_t node_state[num_terms ? num_terms : 1];
+    GhtPredicateValue value;
     GhtNode *node_copy = NULL;
+    int i;
 
     /* Our default position is nothing is getting returned */
     *filtered_node = NULL;
-    
+
     /* No-op on an empty input */
     if ( ! node )
         return GHT_OK;
-    
-    attr = node->attributes;
-    while ( attr )
+
+    /* Add our part of the hash to the incoming part */
+    memset(h, 0, hash_array_len);
+    strncpy(h, hash, hash_array_len);
+    if ( node->hash )
+        strcat(h, node->hash);
+
+    memcpy(node_state, state, num_terms);
+    GHT_TRY(ght_predicate_update(predicate, node, h, ght_node_is_leaf(node), node_state));
+    GHT_TRY(ght_predicate_eval(predicate, node_state, &value));
+
+    if ( value == GHT_PREDICATE_FALSE )
+        return GHT_OK;
+    if ( value == GHT_PREDICATE_TRUE )
+        return ght_node_clone(node, filtered_node);
+
+    /* Undecided, so take copies of any children that pass */
+    for ( i = 0; i < ght_node_num_children(node); i++ )
     {
-        /* Only filter on the attribute of interest */
-        if ( attr->dim != filter->dim )
-        {
-            attr = attr->next;
-        }
-        else
+        GhtNode *child_copy;
+        GHT_TRY(ght_node_filter_by_predicate(node->children->nodes[i], predicate, h, node_state, num_terms, &child_copy));
+        /* Child survived the filtering */
+        if ( child_copy )
         {
-            GHT_TRY(ght_attribute_get_value(attr, &val));
-            switch ( filter->mode )
+            if ( ! node_copy )
             {
-                case GHT_GREATER_THAN:
-                    keep = (val > filter->range.min);
-                    break;
-                case GHT_LESS_THAN:
-                    keep = (val < filter->range.max);
-                    break;
-                case GHT_BETWEEN:
-                    keep = ((val <= filter->range.max) && (val >= filter->range.min));
-                    break;
-                case GHT_EQUAL:
-                    keep = (val == filter->range.min);
-                    break;
-                default:
-                    ght_error("%s: invalid GhtFilterMode (%d)", __func__, filter->mode);
+                GHT_TRY(ght_node_new(&node_copy));
+                GHT_TRY(ght_hash_clone(node->hash, &(node_copy->hash)));
+                GHT_TRY(ght_attribute_clone(node->attributes, &(node_copy->attributes)));
+                if ( node->summaries )
+                    GHT_TRY(ght_summary_extend_by_attribute(&(node_copy->summaries), node_copy->attributes, 0));
             }
-            break;
+            GHT_TRY(ght_node_add_child(node_copy, child_copy));
+            /* Summaries shrink to cover just the surviving children */
+            if ( node->summaries )
+                GHT_TRY(ght_node_extend_summary(node_copy, child_copy));
         }
     }
-    
-    /* We found a relevant attribute, and it failed the filter test. */
-    /* So, this node (and all it's children) can be excluded! */
-    if ( ! keep )
-    {
+
+    /* Done, return the structure */
+    *filtered_node = node_copy;
+    return GHT_OK;
+}
+
+/**
+* Visit the leaves that pass the predicate, keeping the full hash and
+* the attribute lists of the path in the leaf as we go, so nothing is
+* copied. Once a subtree is known to pass, the predicate is dropped,
+* and subtrees that are only being counted are not visited at all.
+*/
+GhtErr
+ght_node_visit_by_predicate(const GhtNode *node, const GhtPredicate *predicate, const uint8_t *state, int num_terms, GhtLeaf *leaf, GhtLeafCallback callback, void *data, int *count)
+{
+    uint8_t node_state[num_terms ? num_terms : 1];
+    size_t hash_len;
+    GhtErr err = GHT_OK;
+    int i;
+
+    /* No-op on an empty input */
+    if ( ! node )
         return GHT_OK;
+
+    /* Add our part of the hash and attributes to the path */
+    hash_len = strlen(leaf->hash);
+    if ( leaf->depth >= GHT_LEAF_MAX_DEPTH ||
+         (node->hash && hash_len + strlen(node->hash) > GHT_MAX_HASH_LENGTH) )
+    {
+        ght_error("%s: tree is deeper than the longest hash", __func__);
+        return GHT_ERROR;
     }
-    
-    /* Also take copies of any children that pass the filter */
-    if ( node->children )
+    if ( node->hash )
+        strcat(leaf->hash, node->hash);
+    leaf->attributes[leaf->depth++] = node->attributes;
+
+    if ( predicate )
     {
-        for ( i = 0; i < node->children->num_nodes; i++ )
-        {
-            GhtNode *child_copy;
-            GHT_TRY(ght_node_filter_by_attribute(node->children->nodes[i], filter, &child_copy));
-            /* Child survived the filtering */
-            if ( child_copy )
-            {
-                if ( ! node_copy )
-                {
-                    GHT_TRY(ght_node_new(&node_copy));
-                    GHT_TRY(ght_hash_clone(node->hash, &(node_copy->hash)));
-                    GHT_TRY(ght_attribute_clone(node->attributes, &(node_copy->attributes)));
-                }
-                GHT_TRY(ght_node_add_child(node_copy, child_copy));
-            }
-        }
+        GhtPredicateValue value;
+        memcpy(node_state, state, num_terms);
+        err = ght_predicate_update(predicate, node, leaf->hash, ght_node_is_leaf(node), node_state);
+        if ( err == GHT_OK )
+            err = ght_predicate_eval(predicate, node_state, &value);
+        if ( err != GHT_OK || value == GHT_PREDICATE_FALSE )
+            goto done;
+        if ( value == GHT_PREDICATE_TRUE )
+            predicate = NULL;
+    }
+
+    if ( ! predicate && ! callback )
+    {
+        err = ght_node_count_leaves(node, count);
+    }
+    else if ( ght_node_is_leaf(node) )
+    {
+        *count += 1;
+        if ( callback )
+            err = callback(leaf, data);
     }
     else
     {
-        GHT_TRY(ght_node_new(&node_copy));
-        GHT_TRY(ght_hash_clone(node->hash, &(node_copy->hash)));
-        GHT_TRY(ght_attribute_clone(node->attributes, &(node_copy->attributes)));
+        for ( i = 0; i < node->children->num_nodes; i++ )
+        {
+            err = ght_node_visit_by_predicate(node->children->nodes[i], predicate, node_state, num_terms, leaf, callback, data, count);
+            if ( err != GHT_OK )
+                break;
+        }
     }
 
-    /* Done, return the structure */
-    *filtered_node = node_copy;
+done:
+    /* Take our part back off the path */
+    leaf->depth--;
+    leaf->hash[hash_len] = '\0';
+    return err;
+}
+
+/******************************************************************************/
+/* GhtLeaf */
+
+GhtErr
+ght_leaf_get_hash(const GhtLeaf *leaf, const GhtHash **hash)
+{
+    *hash = leaf->hash;
     return GHT_OK;
 }
+
+GhtErr
+ght_leaf_get_coordinate(const GhtLeaf *leaf, GhtCoordinate *coord)
+{
+    return ght_coordinate_from_hash(leaf->hash, coord);
+}
+
+GhtErr
+ght_leaf_get_value(const GhtLeaf *leaf, const GhtDimension *dim, double *val)
+{
+    int i;
+    /* Values nearest the leaf win, though a dimension appears once per path */
+    for ( i = leaf->depth - 1; i >= 0; i-- )
+    {
+        const GhtAttribute *attr = leaf->attributes[i];
+        while ( attr )
+        {
+            if ( attr->dim == dim )
+                return ght_attribute_get_value(attr, val);
+            attr = attr->next;
+        }
+    }
+    return GHT_ERROR;
+}
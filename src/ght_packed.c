@@ -0,0 +1,438 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+/**
+* Packed trees hold their nodes in one array, in depth first order.
+* Every node records where its subtree ends, so its first child is the
+* next node, each following sibling starts where the one before ends,
+* and a whole subtree is skipped by jumping to its end. Hash fragments
+* sit in one character pool, and the attributes and summaries of each
+* node are runs in shared arrays, linked so they read as ordinary
+* lists.
+*/
+
+#include "ght_internal.h"
+#include <float.h>
+
+static GhtErr
+ght_packed_count(const GhtNode *node, GhtPackedTree *packed, size_t *num_chars)
+{
+    const GhtAttribute *attr;
+    const GhtSummary *summary;
+    int i;
+
+    packed->num_nodes++;
+    if ( node->hash )
+        *num_chars += strlen(node->hash) + 1;
+    for ( attr = node->attributes; attr; attr = attr->next )
+        packed->num_attributes++;
+    for ( summary = node->summaries; summary; summary = summary->next )
+        packed->num_summaries++;
+
+    if ( node->children && node->children->num_nodes > 0 )
+    {
+        if ( node->children->num_nodes > UINT8_MAX )
+        {
+            ght_error("%s: node has more than %d children", __func__, UINT8_MAX);
+            return GHT_ERROR;
+        }
+        for ( i = 0; i < node->children->num_nodes; i++ )
+            GHT_TRY(ght_packed_count(node->children->nodes[i], packed, num_chars));
+    }
+    else
+    {
+        packed->num_points++;
+    }
+    return GHT_OK;
+}
+
+static void
+ght_packed_fill(const GhtNode *node, GhtPackedTree *packed, uint32_t *num_nodes, size_t *num_chars, uint32_t *num_attributes, uint32_t *num_summaries)
+{
+    GhtPackedNode *p = &(packed->nodes[(*num_nodes)++]);
+    const GhtAttribute *attr;
+    const GhtSummary *summary;
+    int i;
+
+    p->num_leaves = node->num_leaves;
+    p->hash = GHT_PACKED_NO_HASH;
+    if ( node->hash )
+    {
+        p->hash = *num_chars;
+        strcpy(packed->hashes + *num_chars, node->hash);
+        *num_chars += strlen(node->hash) + 1;
+    }
+
+    p->attributes = *num_attributes;
+    for ( attr = node->attributes; attr; attr = attr->next )
+    {
+        GhtAttribute *a = &(packed->attributes[(*num_attributes)++]);
+        *a = *attr;
+        a->next = attr->next ? a + 1 : NULL;
+        p->num_attributes++;
+    }
+
+    p->summaries = *num_summaries;
+    for ( summary = node->summaries; summary; summary = summary->next )
+    {
+        GhtSummary *s = &(packed->summaries[(*num_summaries)++]);
+        *s = *summary;
+        s->next = summary->next ? s + 1 : NULL;
+        p->num_summaries++;
+    }
+
+    if ( node->children )
+    {
+        p->num_children = node->children->num_nodes;
+        for ( i = 0; i < node->children->num_nodes; i++ )
+            ght_packed_fill(node->children->nodes[i], packed, num_nodes, num_chars, num_attributes, num_summaries);
+    }
+    p->end = *num_nodes;
+}
+
+/**
+* Make a packed copy of a tree. The copy shares the schema of the
+* tree, and is read-only.
+*/
+GhtErr
+ght_packed_tree_from_tree(const GhtTree *tree, GhtPackedTree **packed)
+{
+    GhtPackedTree *p;
+    size_t num_chars = 0;
+    uint32_t num_nodes = 0, num_attributes = 0, num_summaries = 0;
+
+    if ( ! tree || ! packed )
+        return GHT_ERROR;
+
+    p = ght_malloc(sizeof(GhtPackedTree));
+    memset(p, 0, sizeof(GhtPackedTree));
+    p->schema = tree->schema;
+    p->config = tree->config;
+    p->context = ght_context_get_current();
+
+    if ( tree->root )
+    {
+        if ( ght_packed_count(tree->root, p, &num_chars) != GHT_OK )
+        {
+            ght_free(p);
+            return GHT_ERROR;
+        }
+        p->nodes = ght_malloc(p->num_nodes * sizeof(GhtPackedNode));
+        memset(p->nodes, 0, p->num_nodes * sizeof(GhtPackedNode));
+        p->hashes = ght_malloc(num_chars ? num_chars : 1);
+        p->attributes = ght_malloc((p->num_attributes ? p->num_attributes : 1) * sizeof(GhtAttribute));
+        p->summaries = ght_malloc((p->num_summaries ? p->num_summaries : 1) * sizeof(GhtSummary));
+        num_chars = 0;
+        ght_packed_fill(tree->root, p, &num_nodes, &num_chars, &num_attributes, &num_summaries);
+    }
+
+    *packed = p;
+    return GHT_OK;
+}
+
+GhtErr
+ght_packed_tree_free(GhtPackedTree *packed)
+{
+    GhtContext *context;
+    if ( ! packed )
+        return GHT_ERROR;
+    context = ght_context_swap(packed->context);
+    if ( packed->nodes )
+        ght_free(packed->nodes);
+    if ( packed->hashes )
+        ght_free(packed->hashes);
+    if ( packed->attributes )
+        ght_free(packed->attributes);
+    if ( packed->summaries )
+        ght_free(packed->summaries);
+    ght_free(packed);
+    ght_context_swap(context);
+    return GHT_OK;
+}
+
+/** Read the point count, which is kept rather than counted */
+GhtErr
+ght_packed_tree_get_numpoints(const GhtPackedTree *packed, int *numpoints)
+{
+    if ( ! packed || ! numpoints )
+        return GHT_ERROR;
+    *numpoints = packed->num_points;
+    return GHT_OK;
+}
+
+/** Ordinary node with the hash, attributes and summaries of a packed one, and no children */
+static void
+ght_packed_node_view(const GhtPackedTree *packed, uint32_t i, GhtNode *node)
+{
+    const GhtPackedNode *p = &(packed->nodes[i]);
+    memset(node, 0, sizeof(GhtNode));
+    node->hash = p->hash == GHT_PACKED_NO_HASH ? NULL : packed->hashes + p->hash;
+    node->attributes = p->num_attributes ? packed->attributes + p->attributes : NULL;
+    node->summaries = p->num_summaries ? packed->summaries + p->summaries : NULL;
+    node->num_leaves = p->num_leaves;
+}
+
+static GhtErr
+ght_packed_node_to_node(const GhtPackedTree *packed, uint32_t i, GhtNode **node)
+{
+    GhtNode view, *n;
+    uint32_t c;
+
+    /* The view has no children, so cloning it copies just this node */
+    ght_packed_node_view(packed, i, &view);
+    GHT_TRY(ght_node_clone(&view, &n));
+
+    if ( packed->nodes[i].num_children )
+        GHT_TRY(ght_nodelist_new(packed->nodes[i].num_children, &(n->children)));
+    for ( c = i + 1; c < packed->nodes[i].end; c = packed->nodes[c].end )
+    {
+        GhtNode *child;
+        GHT_TRY(ght_packed_node_to_node(packed, c, &child));
+        GHT_TRY(ght_node_add_child(n, child));
+    }
+    *node = n;
+    return GHT_OK;
+}
+
+/** Make an ordinary, changeable, tree from a packed one */
+GhtErr
+ght_packed_tree_to_tree(const GhtPackedTree *packed, GhtTree **tree)
+{
+    GhtTree *t;
+
+    if ( ! packed || ! tree )
+        return GHT_ERROR;
+
+    GHT_TRY(ght_tree_new(packed->schema, &t));
+    t->config = packed->config;
+    if ( packed->num_nodes )
+        GHT_TRY(ght_packed_node_to_node(packed, 0, &(t->root)));
+    *tree = t;
+    return GHT_OK;
+}
+
+/**
+* Calculate the extent of the points in a single pass over the node
+* array, keeping the length of the hash above each open subtree.
+*/
+GhtErr
+ght_packed_tree_get_extent(const GhtPackedTree *packed, GhtArea *area)
+{
+    GhtHash h[GHT_MAX_HASH_LENGTH + 1];
+    uint32_t ends[GHT_LEAF_MAX_DEPTH];
+    size_t lens[GHT_LEAF_MAX_DEPTH];
+    int depth = 0;
+    size_t len = 0;
+    uint32_t i;
+
+    area->x.min = DBL_MAX;
+    area->y.min = DBL_MAX;
+    area->x.max = -1 * DBL_MAX;
+    area->y.max = -1 * DBL_MAX;
+
+    if ( ! packed->num_nodes )
+        return GHT_ERROR;
+
+    h[0] = '\0';
+    for ( i = 0; i < packed->num_nodes; i++ )
+    {
+        const GhtPackedNode *p = &(packed->nodes[i]);
+
+        /* Close the subtrees that ended before this node */
+        while ( depth > 0 && ends[depth-1] <= i )
+            len = lens[--depth];
+        h[len] = '\0';
+
+        if ( p->hash != GHT_PACKED_NO_HASH )
+        {
+            const char *frag = packed->hashes + p->hash;
+            size_t fraglen = strlen(frag);
+            if ( len + fraglen > GHT_MAX_HASH_LENGTH )
+            {
+                ght_error("%s: tree is deeper than the longest hash", __func__);
+                return GHT_ERROR;
+            }
+            memcpy(h + len, frag, fraglen + 1);
+        }
+
+        if ( p->end == i + 1 )
+        {
+            GhtCoordinate coord;
+            GHT_TRY(ght_coordinate_from_hash(h, &coord));
+            if ( coord.x < area->x.min ) area->x.min = coord.x;
+            if ( coord.x > area->x.max ) area->x.max = coord.x;
+            if ( coord.y < area->y.min ) area->y.min = coord.y;
+            if ( coord.y > area->y.max ) area->y.max = coord.y;
+        }
+        else
+        {
+            if ( depth >= GHT_LEAF_MAX_DEPTH )
+            {
+                ght_error("%s: tree is deeper than the longest hash", __func__);
+                return GHT_ERROR;
+            }
+            lens[depth] = len;
+            ends[depth++] = p->end;
+            len = strlen(h);
+        }
+    }
+    return GHT_OK;
+}
+
+static GhtErr
+ght_packed_node_visit(const GhtPackedTree *packed, uint32_t i, const GhtPredicate *predicate, const uint8_t *state, int num_terms, GhtLeaf *leaf, GhtLeafCallback callback, void *data, int *count)
+{
+    const GhtPackedNode *p = &(packed->nodes[i]);
+    uint8_t node_state[num_terms ? num_terms : 1];
+    size_t hash_len = strlen(leaf->hash);
+    GhtErr err = GHT_OK;
+    GhtNode view;
+    uint32_t c;
+
+    /* Add our part of the hash and attributes to the path */
+    ght_packed_node_view(packed, i, &view);
+    if ( leaf->depth >= GHT_LEAF_MAX_DEPTH ||
+         (view.hash && hash_len + strlen(view.hash) > GHT_MAX_HASH_LENGTH) )
+    {
+        ght_error("%s: tree is deeper than the longest hash", __func__);
+        return GHT_ERROR;
+    }
+    if ( view.hash )
+        strcat(leaf->hash, view.hash);
+    leaf->attributes[leaf->depth++] = view.attributes;
+
+    if ( predicate )
+    {
+        GhtPredicateValue value;
+        memcpy(node_state, state, num_terms);
+        err = ght_predicate_update(predicate, &view, leaf->hash, p->end == i + 1, node_state);
+        if ( err == GHT_OK )
+            err = ght_predicate_eval(predicate, node_state, &value);
+        if ( err != GHT_OK || value == GHT_PREDICATE_FALSE )
+            goto done;
+        if ( value == GHT_PREDICATE_TRUE )
+            predicate = NULL;
+    }
+
+    if ( ! predicate && ! callback )
+    {
+        *count += p->num_leaves;
+    }
+    else if ( p->end == i + 1 )
+    {
+        *count += 1;
+        if ( callback )
+            err = callback(leaf, data);
+    }
+    else
+    {
+        for ( c = i + 1; err == GHT_OK && c < p->end; c = packed->nodes[c].end )
+        {
+            err = ght_packed_node_visit(packed, c, predicate, node_state, num_terms, leaf, callback, data, count);
+        }
+    }
+
+done:
+    leaf->depth--;
+    leaf->hash[hash_len] = '\0';
+    return err;
+}
+
+static GhtErr
+ght_packed_tree_visit(const GhtPackedTree *packed, GhtPredicate *predicate, GhtLeafCallback callback, void *data, int *count)
+{
+    GhtLeaf leaf;
+    GhtErr err = GHT_OK;
+    int num_terms = 0;
+
+    *count = 0;
+    if ( ! packed )
+        return GHT_ERROR;
+    if ( ! packed->num_nodes )
+        return GHT_OK;
+    if ( predicate )
+        GHT_TRY(ght_predicate_prepare(predicate, packed->schema, &num_terms));
+
+    memset(&leaf, 0, sizeof(GhtLeaf));
+    {
+        uint8_t state[num_terms ? num_terms : 1];
+        memset(state, GHT_PREDICATE_UNKNOWN, num_terms);
+        err = ght_packed_node_visit(packed, 0, predicate, state, num_terms, &leaf, callback, data, count);
+    }
+
+    /* Stopping early is not a failure */
+    if ( err == GHT_DONE )
+        return GHT_OK;
+    return err;
+}
+
+GhtErr
+ght_packed_tree_filter_count(const GhtPackedTree *packed, GhtPredicate *predicate, int *count)
+{
+    return ght_packed_tree_visit(packed, predicate, NULL, NULL, count);
+}
+
+GhtErr
+ght_packed_tree_filter_foreach(const GhtPackedTree *packed, GhtPredicate *predicate, GhtLeafCallback callback, void *data)
+{
+    int count;
+    if ( ! callback )
+        return GHT_ERROR;
+    return ght_packed_tree_visit(packed, predicate, callback, data, &count);
+}
+
+static GhtErr
+ght_packed_node_write(const GhtPackedTree *packed, uint32_t i, GhtWriter *writer)
+{
+    const GhtPackedNode *p = &(packed->nodes[i]);
+    const GhtAttribute *attr;
+    GhtNode view;
+    uint8_t childcount = p->num_children;
+    uint32_t c;
+
+    ght_packed_node_view(packed, i, &view);
+    GHT_TRY(ght_hash_write(view.hash, writer));
+    GHT_TRY(ght_write(writer, &(p->num_attributes), 1));
+    for ( attr = view.attributes; attr; attr = attr->next )
+        GHT_TRY(ght_attribute_write(attr, writer));
+
+    GHT_TRY(ght_write(writer, &childcount, 1));
+    if ( childcount && (writer->flags & GHT_FLAG_SUMMARIES) )
+        GHT_TRY(ght_summary_write(view.summaries, writer));
+
+    for ( c = i + 1; c < p->end; c = packed->nodes[c].end )
+        GHT_TRY(ght_packed_node_write(packed, c, writer));
+    return GHT_OK;
+}
+
+/**
+* Write a packed tree in the same format as ght_tree_write. Writers
+* asking for blocks or delta encoding go through an unpacked copy,
+* since both reorganize the nodes as they go.
+*/
+GhtErr
+ght_packed_tree_write(const GhtPackedTree *packed, GhtWriter *writer)
+{
+    if ( ! packed || ! writer || ! packed->num_nodes )
+        return GHT_ERROR;
+
+    if ( writer->codec != GHT_CODEC_NONE || writer->delta )
+    {
+        GhtTree *tree;
+        GhtErr err;
+        GHT_TRY(ght_packed_tree_to_tree(packed, &tree));
+        err = ght_tree_write(tree, writer);
+        ght_tree_free(tree);
+        return err;
+    }
+
+    GHT_TRY(ght_tree_write_header(packed->schema, &(packed->config), writer));
+    return ght_packed_node_write(packed, 0, writer);
+}
@@ -0,0 +1,598 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+#include "ght_internal.h"
+
+/******************************************************************************/
+/* GhtPredicate */
+
+static GhtErr
+ght_predicate_new(GhtPredicateType type, GhtPredicate **predicate)
+{
+    GhtPredicate *p = ght_malloc(sizeof(GhtPredicate));
+    memset(p, 0, sizeof(GhtPredicate));
+    p->type = type;
+    p->term = -1;
+    *predicate = p;
+    return GHT_OK;
+}
+
+static GhtErr
+ght_predicate_new_filter(const char *dimname, GhtFilterMode mode, double min, double max, GhtPredicate **predicate)
+{
+    GhtPredicate *p;
+    if ( ! dimname )
+        return GHT_ERROR;
+    GHT_TRY(ght_predicate_new(GHT_PREDICATE_FILTER, &p));
+    p->dimname = ght_strdup(dimname);
+    p->filter.mode = mode;
+    p->filter.range.min = min;
+    p->filter.range.max = max;
+    *predicate = p;
+    return GHT_OK;
+}
+
+GhtErr
+ght_predicate_new_greater_than(const char *dimname, double value, GhtPredicate **predicate)
+{
+    return ght_predicate_new_filter(dimname, GHT_GREATER_THAN, value, value, predicate);
+}
+
+GhtErr
+ght_predicate_new_less_than(const char *dimname, double value, GhtPredicate **predicate)
+{
+    return ght_predicate_new_filter(dimname, GHT_LESS_THAN, value, value, predicate);
+}
+
+GhtErr
+ght_predicate_new_between(const char *dimname, double value1, double value2, GhtPredicate **predicate)
+{
+    if ( value1 > value2 )
+        return ght_predicate_new_filter(dimname, GHT_BETWEEN, value2, value1, predicate);
+    return ght_predicate_new_filter(dimname, GHT_BETWEEN, value1, value2, predicate);
+}
+
+GhtErr
+ght_predicate_new_equal(const char *dimname, double value, GhtPredicate **predicate)
+{
+    return ght_predicate_new_filter(dimname, GHT_EQUAL, value, value, predicate);
+}
+
+GhtErr
+ght_predicate_new_area(const GhtArea *area, GhtPredicate **predicate)
+{
+    GHT_TRY(ght_predicate_new(GHT_PREDICATE_AREA, predicate));
+    (*predicate)->area = *area;
+    return GHT_OK;
+}
+
+GhtErr
+ght_predicate_new_and(GhtPredicate **predicate)
+{
+    return ght_predicate_new(GHT_PREDICATE_AND, predicate);
+}
+
+GhtErr
+ght_predicate_new_or(GhtPredicate **predicate)
+{
+    return ght_predicate_new(GHT_PREDICATE_OR, predicate);
+}
+
+static GhtErr
+ght_predicate_append(GhtPredicate *predicate, GhtPredicate *arg)
+{
+    if ( predicate->num_args == predicate->max_args )
+    {
+        predicate->max_args = predicate->max_args ? 2 * predicate->max_args : 4;
+        predicate->args = ght_realloc(predicate->args, predicate->max_args * sizeof(GhtPredicate*));
+    }
+    predicate->args[predicate->num_args++] = arg;
+    return GHT_OK;
+}
+
+GhtErr
+ght_predicate_new_not(GhtPredicate *arg, GhtPredicate **predicate)
+{
+    if ( ! arg )
+        return GHT_ERROR;
+    GHT_TRY(ght_predicate_new(GHT_PREDICATE_NOT, predicate));
+    return ght_predicate_append(*predicate, arg);
+}
+
+/** Add a term to an AND or OR predicate, which takes ownership of it */
+GhtErr
+ght_predicate_add(GhtPredicate *predicate, GhtPredicate *arg)
+{
+    if ( ! arg )
+        return GHT_ERROR;
+    if ( predicate->type != GHT_PREDICATE_AND && predicate->type != GHT_PREDICATE_OR )
+    {
+        ght_error("%s: only AND and OR predicates take extra terms", __func__);
+        return GHT_ERROR;
+    }
+    return ght_predicate_append(predicate, arg);
+}
+
+GhtErr
+ght_predicate_free(GhtPredicate *predicate)
+{
+    int i;
+    assert(predicate);
+    for ( i = 0; i < predicate->num_args; i++ )
+    {
+        GHT_TRY(ght_predicate_free(predicate->args[i]));
+    }
+    if ( predicate->args )
+        ght_free(predicate->args);
+    if ( predicate->dimname )
+        ght_free(predicate->dimname);
+    ght_free(predicate);
+    return GHT_OK;
+}
+
+/**
+* Test a single value against the filter.
+*/
+static int
+ght_filter_value(const GhtFilter *filter, double val)
+{
+    switch ( filter->mode )
+    {
+        case GHT_GREATER_THAN:
+            return val > filter->range.min;
+        case GHT_LESS_THAN:
+            return val < filter->range.max;
+        case GHT_BETWEEN:
+            return (val <= filter->range.max) && (val >= filter->range.min);
+        case GHT_EQUAL:
+            return val == filter->range.min;
+        default:
+            ght_error("%s: invalid GhtFilterMode (%d)", __func__, filter->mode);
+    }
+    return 0;
+}
+
+static int
+ght_filter_test_value(const GhtFilter *filter, const GhtAttribute *attr)
+{
+    double val;
+    if ( ght_attribute_get_value(attr, &val) != GHT_OK )
+        return 0;
+    return ght_filter_value(filter, val);
+}
+
+/* Raw integer comparators, one per storage type */
+
+static int
+ght_filter_test_int8(const GhtFilter *filter, const GhtAttribute *attr)
+{
+    int8_t v;
+    memcpy(&v, attr->val, sizeof(int8_t));
+    return v >= filter->storage_min && v <= filter->storage_max;
+}
+
+static int
+ght_filter_test_uint8(const GhtFilter *filter, const GhtAttribute *attr)
+{
+    uint8_t v;
+    memcpy(&v, attr->val, sizeof(uint8_t));
+    return v >= filter->storage_min && v <= filter->storage_max;
+}
+
+static int
+ght_filter_test_int16(const GhtFilter *filter, const GhtAttribute *attr)
+{
+    int16_t v;
+    memcpy(&v, attr->val, sizeof(int16_t));
+    return v >= filter->storage_min && v <= filter->storage_max;
+}
+
+static int
+ght_filter_test_uint16(const GhtFilter *filter, const GhtAttribute *attr)
+{
+    uint16_t v;
+    memcpy(&v, attr->val, sizeof(uint16_t));
+    return v >= filter->storage_min && v <= filter->storage_max;
+}
+
+static int
+ght_filter_test_int32(const GhtFilter *filter, const GhtAttribute *attr)
+{
+    int32_t v;
+    memcpy(&v, attr->val, sizeof(int32_t));
+    return v >= filter->storage_min && v <= filter->storage_max;
+}
+
+static int
+ght_filter_test_uint32(const GhtFilter *filter, const GhtAttribute *attr)
+{
+    uint32_t v;
+    memcpy(&v, attr->val, sizeof(uint32_t));
+    return v >= filter->storage_min && v <= filter->storage_max;
+}
+
+static int
+ght_filter_test_int64(const GhtFilter *filter, const GhtAttribute *attr)
+{
+    int64_t v;
+    memcpy(&v, attr->val, sizeof(int64_t));
+    return v >= filter->storage_min && v <= filter->storage_max;
+}
+
+/** Does the stored value convert to a real value above (or at) the threshold? */
+static int
+ght_filter_storage_above(GhtAttribute *attr, int64_t storage, double threshold, int inclusive)
+{
+    double val;
+    ght_attribute_set_integer(attr, storage);
+    ght_attribute_get_value(attr, &val);
+    return inclusive ? (val >= threshold) : (val > threshold);
+}
+
+/**
+* Find the smallest stored value in [min, max] whose real value is
+* above (or at) the threshold. Real values rise with stored values
+* when the scale is positive, so a binary search will do, and going
+* through the attribute conversion keeps the answer identical to
+* comparing real values one by one.
+*/
+static int
+ght_filter_storage_first(const GhtDimension *dim, int64_t min, int64_t max, double threshold, int inclusive, int64_t *first)
+{
+    GhtAttribute attr;
+    memset(&attr, 0, sizeof(GhtAttribute));
+    attr.dim = dim;
+
+    if ( ! ght_filter_storage_above(&attr, max, threshold, inclusive) )
+        return 0;
+
+    while ( min < max )
+    {
+        int64_t mid = min + (int64_t)(((uint64_t)max - (uint64_t)min) / 2);
+        if ( ght_filter_storage_above(&attr, mid, threshold, inclusive) )
+            max = mid;
+        else
+            min = mid + 1;
+    }
+    *first = min;
+    return 1;
+}
+
+/**
+* Convert the real-valued thresholds into an inclusive range of
+* stored values, and pick a comparator for the storage type, so
+* attributes can be tested without conversion. Floating point and
+* unsigned 64-bit dimensions, or dimensions with a negative scale,
+* keep comparing real values.
+*/
+static GhtErr
+ght_filter_prepare(GhtFilter *filter)
+{
+    const GhtDimension *dim = filter->dim;
+    int64_t type_min, type_max, first;
+    double lower = filter->range.min;
+    double upper = filter->range.max;
+    int lower_inclusive = 1;
+    int upper_inclusive = 1;
+    int has_lower = 1;
+    int has_upper = 1;
+
+    filter->test = ght_filter_test_value;
+
+    switch ( dim->type )
+    {
+        case GHT_INT8:
+            type_min = INT8_MIN; type_max = INT8_MAX;
+            filter->test = ght_filter_test_int8;
+            break;
+        case GHT_UINT8:
+            type_min = 0; type_max = UINT8_MAX;
+            filter->test = ght_filter_test_uint8;
+            break;
+        case GHT_INT16:
+            type_min = INT16_MIN; type_max = INT16_MAX;
+            filter->test = ght_filter_test_int16;
+            break;
+        case GHT_UINT16:
+            type_min = 0; type_max = UINT16_MAX;
+            filter->test = ght_filter_test_uint16;
+            break;
+        case GHT_INT32:
+            type_min = INT32_MIN; type_max = INT32_MAX;
+            filter->test = ght_filter_test_int32;
+            break;
+        case GHT_UINT32:
+            type_min = 0; type_max = UINT32_MAX;
+            filter->test = ght_filter_test_uint32;
+            break;
+        case GHT_INT64:
+            type_min = INT64_MIN; type_max = INT64_MAX;
+            filter->test = ght_filter_test_int64;
+            break;
+        default:
+            return GHT_OK;
+    }
+
+    if ( dim->scale <= 0 || lower != lower || upper != upper )
+    {
+        filter->test = ght_filter_test_value;
+        return GHT_OK;
+    }
+
+    switch ( filter->mode )
+    {
+        case GHT_GREATER_THAN:
+            lower_inclusive = 0;
+            has_upper = 0;
+            break;
+        case GHT_LESS_THAN:
+            upper_inclusive = 0;
+            has_lower = 0;
+            break;
+        case GHT_BETWEEN:
+            break;
+        case GHT_EQUAL:
+            upper = lower;
+            break;
+        default:
+            ght_error("%s: invalid GhtFilterMode (%d)", __func__, filter->mode);
+            return GHT_ERROR;
+    }
+
+    /* Empty unless the bounds below say otherwise */
+    filter->storage_min = 1;
+    filter->storage_max = 0;
+
+    if ( has_lower )
+    {
+        if ( ! ght_filter_storage_first(dim, type_min, type_max, lower, lower_inclusive, &first) )
+            return GHT_OK;
+        filter->storage_min = first;
+    }
+    else
+    {
+        filter->storage_min = type_min;
+    }
+
+    /* Last value below (or at) the upper bound is one before the first above it */
+    if ( has_upper && ght_filter_storage_first(dim, type_min, type_max, upper, ! upper_inclusive, &first) )
+    {
+        if ( first == type_min )
+        {
+            filter->storage_min = 1;
+            filter->storage_max = 0;
+            return GHT_OK;
+        }
+        filter->storage_max = first - 1;
+    }
+    else
+    {
+        filter->storage_max = type_max;
+    }
+    return GHT_OK;
+}
+
+/**
+* Resolve the filter dimensions against the schema of the tree
+* to be filtered, and number the filter and area terms.
+*/
+static GhtErr
+ght_predicate_prepare_terms(GhtPredicate *predicate, const GhtSchema *schema, int *num_terms)
+{
+    int i;
+    GhtDimension *dim;
+
+    switch ( predicate->type )
+    {
+        case GHT_PREDICATE_FILTER:
+            GHT_TRY(ght_schema_get_dimension_by_name(schema, predicate->dimname, &dim));
+            predicate->filter.dim = dim;
+            GHT_TRY(ght_filter_prepare(&(predicate->filter)));
+            predicate->term = (*num_terms)++;
+            return GHT_OK;
+        case GHT_PREDICATE_AREA:
+            predicate->term = (*num_terms)++;
+            return GHT_OK;
+        default:
+            for ( i = 0; i < predicate->num_args; i++ )
+            {
+                GHT_TRY(ght_predicate_prepare_terms(predicate->args[i], schema, num_terms));
+            }
+            return GHT_OK;
+    }
+}
+
+GhtErr
+ght_predicate_prepare(GhtPredicate *predicate, const GhtSchema *schema, int *num_terms)
+{
+    *num_terms = 0;
+    return ght_predicate_prepare_terms(predicate, schema, num_terms);
+}
+
+/**
+* Test a whole range of values against the filter.
+*/
+static GhtPredicateValue
+ght_filter_range(const GhtFilter *filter, double min, double max)
+{
+    switch ( filter->mode )
+    {
+        case GHT_GREATER_THAN:
+            if ( max <= filter->range.min ) return GHT_PREDICATE_FALSE;
+            if ( min > filter->range.min ) return GHT_PREDICATE_TRUE;
+            break;
+        case GHT_LESS_THAN:
+            if ( min >= filter->range.max ) return GHT_PREDICATE_FALSE;
+            if ( max < filter->range.max ) return GHT_PREDICATE_TRUE;
+            break;
+        case GHT_BETWEEN:
+            if ( max < filter->range.min || min > filter->range.max ) return GHT_PREDICATE_FALSE;
+            if ( min >= filter->range.min && max <= filter->range.max ) return GHT_PREDICATE_TRUE;
+            break;
+        case GHT_EQUAL:
+            if ( filter->range.min < min || filter->range.min > max ) return GHT_PREDICATE_FALSE;
+            if ( min == filter->range.min && max == filter->range.min ) return GHT_PREDICATE_TRUE;
+            break;
+        default:
+            ght_error("%s: invalid GhtFilterMode (%d)", __func__, filter->mode);
+    }
+    return GHT_PREDICATE_UNKNOWN;
+}
+
+static GhtErr
+ght_predicate_update_filter(const GhtPredicate *predicate, const GhtNode *node, int is_leaf, uint8_t *state)
+{
+    const GhtFilter *filter = &(predicate->filter);
+    const GhtAttribute *attr = node->attributes;
+    const GhtSummary *summary;
+
+    /* An attribute holds for the node and everything under it */
+    while ( attr )
+    {
+        if ( attr->dim == filter->dim )
+        {
+            state[predicate->term] = filter->test(filter, attr) ? GHT_PREDICATE_TRUE : GHT_PREDICATE_FALSE;
+            return GHT_OK;
+        }
+        attr = attr->next;
+    }
+
+    /* The summary may settle the whole subtree without visiting the leaves, */
+    /* but leaves without the dimension pass, so only prune when all carry it */
+    if ( node->summaries && ght_summary_get_by_dimension(node->summaries, filter->dim, &summary) == GHT_OK )
+    {
+        GhtPredicateValue value = ght_filter_range(filter, summary->min, summary->max);
+        if ( value == GHT_PREDICATE_TRUE ||
+             (value == GHT_PREDICATE_FALSE && summary->count >= node->num_leaves) )
+        {
+            state[predicate->term] = value;
+            return GHT_OK;
+        }
+    }
+
+    /* Points without a value for the dimension pass */
+    if ( is_leaf )
+        state[predicate->term] = GHT_PREDICATE_TRUE;
+
+    return GHT_OK;
+}
+
+static GhtErr
+ght_predicate_update_area(const GhtPredicate *predicate, const GhtHash *hash, int is_leaf, uint8_t *state)
+{
+    const GhtArea *box = &(predicate->area);
+
+    if ( is_leaf )
+    {
+        GhtCoordinate coord;
+        GHT_TRY(ght_coordinate_from_hash(hash, &coord));
+        if ( coord.x >= box->x.min && coord.x <= box->x.max &&
+             coord.y >= box->y.min && coord.y <= box->y.max )
+            state[predicate->term] = GHT_PREDICATE_TRUE;
+        else
+            state[predicate->term] = GHT_PREDICATE_FALSE;
+    }
+    else
+    {
+        GhtArea area;
+        GHT_TRY(ght_area_from_hash(hash, &area));
+        if ( area.x.min > box->x.max || area.x.max < box->x.min ||
+             area.y.min > box->y.max || area.y.max < box->y.min )
+            state[predicate->term] = GHT_PREDICATE_FALSE;
+        else if ( area.x.min >= box->x.min && area.x.max <= box->x.max &&
+                  area.y.min >= box->y.min && area.y.max <= box->y.max )
+            state[predicate->term] = GHT_PREDICATE_TRUE;
+    }
+    return GHT_OK;
+}
+
+/**
+* Settle any undecided terms that this node (with full hash) can
+* decide for its whole subtree. At a leaf every term gets decided.
+*/
+GhtErr
+ght_predicate_update(const GhtPredicate *predicate, const GhtNode *node, const GhtHash *hash, int is_leaf, uint8_t *state)
+{
+    int i;
+    switch ( predicate->type )
+    {
+        case GHT_PREDICATE_FILTER:
+            if ( state[predicate->term] == GHT_PREDICATE_UNKNOWN )
+                return ght_predicate_update_filter(predicate, node, is_leaf, state);
+            return GHT_OK;
+        case GHT_PREDICATE_AREA:
+            if ( state[predicate->term] == GHT_PREDICATE_UNKNOWN )
+                return ght_predicate_update_area(predicate, hash, is_leaf, state);
+            return GHT_OK;
+        default:
+            for ( i = 0; i < predicate->num_args; i++ )
+            {
+                GHT_TRY(ght_predicate_update(predicate->args[i], node, hash, is_leaf, state));
+            }
+            return GHT_OK;
+    }
+}
+
+/**
+* Combine the term states with three-valued logic, so a subtree
+* is only visited when the terms decided so far leave it open.
+*/
+GhtErr
+ght_predicate_eval(const GhtPredicate *predicate, const uint8_t *state, GhtPredicateValue *value)
+{
+    int i;
+    GhtPredicateValue v;
+
+    switch ( predicate->type )
+    {
+        case GHT_PREDICATE_FILTER:
+        case GHT_PREDICATE_AREA:
+            *value = state[predicate->term];
+            return GHT_OK;
+        case GHT_PREDICATE_NOT:
+            GHT_TRY(ght_predicate_eval(predicate->args[0], state, &v));
+            if ( v == GHT_PREDICATE_UNKNOWN )
+                *value = v;
+            else
+                *value = (v == GHT_PREDICATE_TRUE) ? GHT_PREDICATE_FALSE : GHT_PREDICATE_TRUE;
+            return GHT_OK;
+        case GHT_PREDICATE_AND:
+            *value = GHT_PREDICATE_TRUE;
+            for ( i = 0; i < predicate->num_args; i++ )
+            {
+                GHT_TRY(ght_predicate_eval(predicate->args[i], state, &v));
+                if ( v == GHT_PREDICATE_FALSE )
+                {
+                    *value = v;
+                    return GHT_OK;
+                }
+                if ( v == GHT_PREDICATE_UNKNOWN )
+                    *value = v;
+            }
+            return GHT_OK;
+        case GHT_PREDICATE_OR:
+            *value = GHT_PREDICATE_FALSE;
+            for ( i = 0; i < predicate->num_args; i++ )
+            {
+                GHT_TRY(ght_predicate_eval(predicate->args[i], state, &v));
+                if ( v == GHT_PREDICATE_TRUE )
+                {
+                    *value = v;
+                    return GHT_OK;
+                }
+                if ( v == GHT_PREDICATE_UNKNOWN )
+                    *value = v;
+            }
+            return GHT_OK;
+        default:
+            ght_error("%s: invalid GhtPredicateType (%d)", __func__, predicate->type);
+    }
+    return GHT_ERROR;
+}
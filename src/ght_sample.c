@@ -0,0 +1,332 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+/**
+* Level-of-detail sampling. All the points under a node share the
+* prefix of its full hash, so cutting the tree where the hashes reach
+* a given length splits the points into hash cells, and each cell is
+* reduced to one representative point. Representatives can be cached
+* on the interior nodes, built bottom-up in one pass, so sampling at
+* any resolution only walks down to the cells.
+*/
+
+#include "ght_internal.h"
+
+/* Running totals for the points of one hash cell */
+typedef struct
+{
+    const GhtSchema *schema;
+    int count;
+    double x;
+    double y;
+    double *sums;
+    int *counts;
+    GhtNode *first;
+} GhtSampleCell;
+
+static void
+ght_sample_cell_init(GhtSampleCell *cell, const GhtSchema *schema, double *sums, int *counts)
+{
+    memset(cell, 0, sizeof(GhtSampleCell));
+    cell->schema = schema;
+    cell->sums = sums;
+    cell->counts = counts;
+    memset(sums, 0, schema->num_dims * sizeof(double));
+    memset(counts, 0, schema->num_dims * sizeof(int));
+}
+
+/** Copy a visited point, with the attributes from all along its path */
+static GhtErr
+ght_sample_leaf_copy(const GhtLeaf *leaf, GhtNode **node)
+{
+    GhtAttribute *attr = NULL;
+    int i;
+
+    for ( i = leaf->depth - 1; i >= 0; i-- )
+    {
+        GhtAttribute *a;
+        GHT_TRY(ght_attribute_union(attr, (GhtAttribute*)(leaf->attributes[i]), &a));
+        if ( attr )
+            ght_attribute_free(attr);
+        attr = a;
+    }
+    GHT_TRY(ght_node_new_from_hash((GhtHash*)(leaf->hash), node));
+    if ( attr )
+        GHT_TRY(ght_node_add_attribute(*node, attr));
+    return GHT_OK;
+}
+
+/** GhtLeafCallback adding one point to the totals of a cell */
+static GhtErr
+ght_sample_cell_add_leaf(const GhtLeaf *leaf, void *data)
+{
+    GhtSampleCell *cell = (GhtSampleCell*)data;
+    GhtCoordinate coord;
+    int i;
+
+    GHT_TRY(ght_leaf_get_coordinate(leaf, &coord));
+    cell->x += coord.x;
+    cell->y += coord.y;
+    cell->count++;
+
+    for ( i = 0; i < leaf->depth; i++ )
+    {
+        const GhtAttribute *attr = leaf->attributes[i];
+        while ( attr )
+        {
+            double val;
+            GHT_TRY(ght_attribute_get_value(attr, &val));
+            cell->sums[attr->dim->position] += val;
+            cell->counts[attr->dim->position] += 1;
+            attr = attr->next;
+        }
+    }
+
+    if ( ! cell->first )
+        GHT_TRY(ght_sample_leaf_copy(leaf, &(cell->first)));
+
+    return GHT_OK;
+}
+
+/** Add the totals of one cell into another, taking its first point if needed */
+static void
+ght_sample_cell_merge(GhtSampleCell *cell, GhtSampleCell *other)
+{
+    int i;
+    cell->count += other->count;
+    cell->x += other->x;
+    cell->y += other->y;
+    for ( i = 0; i < cell->schema->num_dims; i++ )
+    {
+        cell->sums[i] += other->sums[i];
+        cell->counts[i] += other->counts[i];
+    }
+    if ( ! cell->first )
+    {
+        cell->first = other->first;
+        other->first = NULL;
+    }
+}
+
+/** Reduce the totals of a cell to a single new point */
+static GhtErr
+ght_sample_cell_reduce(const GhtSampleCell *cell, GhtSampleMode mode, GhtNode **node)
+{
+    GhtCoordinate coord;
+    GhtNode *n;
+    int i;
+
+    if ( ! cell->first )
+        return GHT_ERROR;
+
+    if ( mode == GHT_SAMPLE_FIRST )
+        return ght_node_clone(cell->first, node);
+
+    /* The centroid is inside the cell, so its hash keeps the cell prefix */
+    coord.x = cell->x / cell->count;
+    coord.y = cell->y / cell->count;
+    GHT_TRY(ght_node_new_from_coordinate(&coord, strlen(cell->first->hash), &n));
+
+    if ( mode == GHT_SAMPLE_CENTROID )
+    {
+        if ( ght_attribute_clone(cell->first->attributes, &(n->attributes)) != GHT_OK )
+            goto fail;
+    }
+    else
+    {
+        for ( i = 0; i < cell->schema->num_dims; i++ )
+        {
+            GhtAttribute *attr;
+            if ( ! cell->counts[i] )
+                continue;
+            if ( ght_attribute_new_from_double(cell->schema->dims[i], cell->sums[i] / cell->counts[i], &attr) != GHT_OK )
+                goto fail;
+            ght_node_add_attribute(n, attr);
+        }
+    }
+    *node = n;
+    return GHT_OK;
+
+fail:
+    ght_node_free(n);
+    return GHT_ERROR;
+}
+
+/** Add our part of the hash and attributes to the path */
+static GhtErr
+ght_sample_push(GhtLeaf *leaf, const GhtNode *node)
+{
+    if ( leaf->depth >= GHT_LEAF_MAX_DEPTH ||
+         (node->hash && strlen(leaf->hash) + strlen(node->hash) > GHT_MAX_HASH_LENGTH) )
+    {
+        ght_error("%s: tree is deeper than the longest hash", __func__);
+        return GHT_ERROR;
+    }
+    if ( node->hash )
+        strcat(leaf->hash, node->hash);
+    leaf->attributes[leaf->depth++] = node->attributes;
+    return GHT_OK;
+}
+
+static GhtErr
+ght_node_sample(const GhtNode *node, const GhtSchema *schema, int resolution, GhtSampleMode mode, int cached, GhtLeaf *leaf, GhtNodeList *nodelist)
+{
+    size_t hash_len = strlen(leaf->hash);
+    size_t node_len = node->hash ? strlen(node->hash) : 0;
+    GhtNode *sample;
+    GhtErr err = GHT_OK;
+    int i;
+
+    if ( hash_len + node_len >= (size_t)resolution || ght_node_is_leaf(node) )
+    {
+        /* Everything under here is in one cell */
+        if ( cached && node->sample )
+        {
+            GHT_TRY(ght_node_clone(node->sample, &sample));
+        }
+        else
+        {
+            GhtSampleCell cell;
+            double sums[schema->num_dims];
+            int counts[schema->num_dims];
+            int count = 0;
+
+            ght_sample_cell_init(&cell, schema, sums, counts);
+            err = ght_node_visit_by_predicate(node, NULL, NULL, 0, leaf, ght_sample_cell_add_leaf, &cell, &count);
+            if ( err == GHT_OK )
+                err = ght_sample_cell_reduce(&cell, mode, &sample);
+            if ( cell.first )
+                ght_node_free(cell.first);
+            if ( err != GHT_OK )
+                return err;
+        }
+        return ght_nodelist_add_node(nodelist, sample);
+    }
+
+    GHT_TRY(ght_sample_push(leaf, node));
+    for ( i = 0; err == GHT_OK && i < node->children->num_nodes; i++ )
+    {
+        err = ght_node_sample(node->children->nodes[i], schema, resolution, mode, cached, leaf, nodelist);
+    }
+    leaf->depth--;
+    leaf->hash[hash_len] = '\0';
+    return err;
+}
+
+/**
+* Add one new point per hash cell of resolution characters to the
+* nodelist, in tree order. Points with shorter hashes than the
+* resolution are cells of their own. Uses the representatives cached
+* by ght_tree_build_lod when they were made with the same mode.
+*/
+GhtErr
+ght_tree_sample(const GhtTree *tree, int resolution, GhtSampleMode mode, GhtNodeList *nodelist)
+{
+    GhtLeaf leaf;
+
+    if ( ! tree || ! nodelist || resolution < 0 )
+        return GHT_ERROR;
+    if ( mode != GHT_SAMPLE_FIRST && mode != GHT_SAMPLE_CENTROID && mode != GHT_SAMPLE_AVERAGE )
+    {
+        ght_error("%s: unknown sample mode %d", __func__, mode);
+        return GHT_ERROR;
+    }
+    if ( ! tree->root )
+        return GHT_OK;
+
+    memset(&leaf, 0, sizeof(GhtLeaf));
+    return ght_node_sample(tree->root, tree->schema, resolution, mode,
+                           tree->lod && tree->lod_mode == mode, &leaf, nodelist);
+}
+
+/** Total up the cell of every node bottom-up, storing its representative on interior nodes */
+static GhtErr
+ght_node_build_lod(GhtNode *node, GhtSampleMode mode, GhtLeaf *leaf, GhtSampleCell *cell)
+{
+    size_t hash_len = strlen(leaf->hash);
+    GhtErr err = GHT_OK;
+    int i;
+
+    GHT_TRY(ght_sample_push(leaf, node));
+
+    if ( ght_node_is_leaf(node) )
+    {
+        err = ght_sample_cell_add_leaf(leaf, cell);
+    }
+    else
+    {
+        for ( i = 0; err == GHT_OK && i < node->children->num_nodes; i++ )
+        {
+            GhtSampleCell child;
+            double sums[cell->schema->num_dims];
+            int counts[cell->schema->num_dims];
+
+            ght_sample_cell_init(&child, cell->schema, sums, counts);
+            err = ght_node_build_lod(node->children->nodes[i], mode, leaf, &child);
+            ght_sample_cell_merge(cell, &child);
+            if ( child.first )
+                ght_node_free(child.first);
+        }
+        if ( err == GHT_OK )
+            err = ght_node_clear_sample(node);
+        if ( err == GHT_OK )
+            err = ght_sample_cell_reduce(cell, mode, &(node->sample));
+    }
+
+    leaf->depth--;
+    leaf->hash[hash_len] = '\0';
+    return err;
+}
+
+/**
+* Cache a representative point on every interior node of the tree.
+* Inserting points drops the representatives on their way down, and
+* sampling falls back to totalling those cells on the fly.
+*/
+GhtErr
+ght_tree_build_lod(GhtTree *tree, GhtSampleMode mode)
+{
+    GhtSampleCell cell;
+    GhtContext *context;
+    GhtLeaf leaf;
+    GhtErr err;
+
+    if ( ! tree )
+        return GHT_ERROR;
+    if ( mode != GHT_SAMPLE_FIRST && mode != GHT_SAMPLE_CENTROID && mode != GHT_SAMPLE_AVERAGE )
+    {
+        ght_error("%s: unknown sample mode %d", __func__, mode);
+        return GHT_ERROR;
+    }
+
+    GHT_TRY(ght_tree_check_mutable(tree, __func__));
+
+    tree->lod = 1;
+    tree->lod_mode = mode;
+    if ( ! tree->root )
+        return GHT_OK;
+
+    {
+        double sums[tree->schema->num_dims];
+        int counts[tree->schema->num_dims];
+
+        /* Samples belong to the tree, and are freed under its context */
+        context = ght_context_swap(tree->context);
+        memset(&leaf, 0, sizeof(GhtLeaf));
+        ght_sample_cell_init(&cell, tree->schema, sums, counts);
+        err = ght_node_build_lod(tree->root, mode, &leaf, &cell);
+        if ( cell.first )
+            ght_node_free(cell.first);
+        ght_context_swap(context);
+    }
+    if ( err != GHT_OK )
+        tree->lod = 0;
+    return err;
+}
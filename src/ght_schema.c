@@ -48,6 +48,7 @@ GhtErr ght_dimension_clone(const GhtDimension *dim, GhtDimension **newdim)
         d->name = ght_strdup(dim->name);
     if ( dim->description )
         d->description = ght_strdup(dim->description);
+    *newdim = d;
     return GHT_OK;        
 }
 
@@ -422,6 +423,7 @@ GhtErr ght_schema_clone(const GhtSchema *schema, GhtSchema **newschema)
     {
         ght_dimension_clone(schema->dims[i], &(s->dims[i]));
     }
+    *newschema = s;
     return GHT_OK;
 }
 
@@ -533,3 +535,220 @@ GhtErr ght_schema_to_xml_file(const GhtSchema *schema, const char *filename)
 }
 
 
+/******************************************************************************
+*  Binary GhtSchema
+******************************************************************************/
+
+/**
+* Binary schema serialization:
+* - number of dimensions
+* - for each dimension:
+*   - length of name, name (no null terminator)
+*   - length of description, description (no null terminator)
+*   - type, scale, offset
+*/
+GhtErr ght_schema_write(const GhtSchema *schema, GhtWriter *writer)
+{
+    int i;
+    uint8_t num_dims = schema->num_dims;
+
+    if ( schema->num_dims > 255 )
+    {
+        ght_error("%s: schema has too many dimensions (%d)", __func__, schema->num_dims);
+        return GHT_ERROR;
+    }
+
+    GHT_TRY(ght_write(writer, &num_dims, 1));
+    for ( i = 0; i < schema->num_dims; i++ )
+    {
+        const GhtDimension *dim = schema->dims[i];
+        uint8_t namelen = dim->name ? strlen(dim->name) : 0;
+        uint16_t desclen = dim->description ? strlen(dim->description) : 0;
+        uint8_t type = dim->type;
+
+        GHT_TRY(ght_write(writer, &namelen, 1));
+        GHT_TRY(ght_write(writer, dim->name, namelen));
+        GHT_TRY(ght_write(writer, &desclen, 2));
+        GHT_TRY(ght_write(writer, dim->description, desclen));
+        GHT_TRY(ght_write(writer, &type, 1));
+        GHT_TRY(ght_write(writer, &(dim->scale), 8));
+        GHT_TRY(ght_write(writer, &(dim->offset), 8));
+    }
+    return GHT_OK;
+}
+
+GhtErr ght_schema_read(GhtReader *reader, GhtSchema **schema)
+{
+    int i;
+    uint8_t num_dims;
+    GhtSchema *s;
+
+    GHT_TRY(ght_read(reader, &num_dims, 1));
+    GHT_TRY(ght_schema_new(&s));
+    for ( i = 0; i < num_dims; i++ )
+    {
+        GhtDimension *dim;
+        uint8_t namelen, type;
+        uint16_t desclen;
+
+        GHT_TRY(ght_dimension_new(&dim));
+        GHT_TRY(ght_read(reader, &namelen, 1));
+        dim->name = ght_malloc(namelen + 1);
+        GHT_TRY(ght_read(reader, dim->name, namelen));
+        dim->name[namelen] = '\0';
+        GHT_TRY(ght_read(reader, &desclen, 2));
+        dim->description = ght_malloc(desclen + 1);
+        GHT_TRY(ght_read(reader, dim->description, desclen));
+        dim->description[desclen] = '\0';
+        GHT_TRY(ght_read(reader, &type, 1));
+        if ( type == GHT_UNKNOWN || type >= GHT_NUM_TYPES )
+        {
+            ght_dimension_free(dim);
+            ght_schema_free(s);
+            ght_error("%s: invalid dimension type %d", __func__, type);
+            return GHT_ERROR;
+        }
+        dim->type = type;
+        GHT_TRY(ght_read(reader, &(dim->scale), 8));
+        GHT_TRY(ght_read(reader, &(dim->offset), 8));
+        GHT_TRY(ght_schema_add_dimension(s, dim));
+    }
+    *schema = s;
+    return GHT_OK;
+}
+
+#define GHT_FNV_OFFSET 14695981039346656037ULL
+#define GHT_FNV_PRIME 1099511628211ULL
+
+static uint64_t ght_fnv1a(uint64_t hash, const void *bytes, size_t size)
+{
+    const uint8_t *ptr = bytes;
+    while ( size-- )
+    {
+        hash ^= *ptr++;
+        hash *= GHT_FNV_PRIME;
+    }
+    return hash;
+}
+
+/** FNV-1a hash of the parts of a schema that ght_schema_same compares */
+GhtErr ght_schema_hash(const GhtSchema *schema, uint64_t *hash)
+{
+    int i;
+    uint64_t h = GHT_FNV_OFFSET;
+    for ( i = 0; i < schema->num_dims; i++ )
+    {
+        const GhtDimension *dim = schema->dims[i];
+        uint8_t type = dim->type;
+        if ( dim->name )
+            h = ght_fnv1a(h, dim->name, strlen(dim->name) + 1);
+        h = ght_fnv1a(h, &type, 1);
+        h = ght_fnv1a(h, &(dim->scale), sizeof(double));
+        h = ght_fnv1a(h, &(dim->offset), sizeof(double));
+    }
+    *hash = h;
+    return GHT_OK;
+}
+
+/******************************************************************************
+*  GhtSchema cache
+******************************************************************************/
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+static pthread_mutex_t ght_schema_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define GHT_SCHEMA_CACHE_LOCK() pthread_mutex_lock(&ght_schema_cache_lock)
+#define GHT_SCHEMA_CACHE_UNLOCK() pthread_mutex_unlock(&ght_schema_cache_lock)
+#else
+#define GHT_SCHEMA_CACHE_LOCK()
+#define GHT_SCHEMA_CACHE_UNLOCK()
+#endif
+
+typedef struct
+{
+    uint64_t hash;
+    GhtSchema *schema;
+} GhtSchemaCacheEntry;
+
+static GhtSchemaCacheEntry *ght_schema_cache = NULL;
+static int ght_schema_cache_size = 0;
+static int ght_schema_cache_max = 0;
+
+/**
+* Hand a schema to the process-wide cache. If an equivalent schema
+* is already cached the one passed in is freed, and the cached one
+* is returned instead. Cached schemas live until ght_schema_cache_clear,
+* which frees them with the default handlers.
+*/
+GhtErr ght_schema_intern(GhtSchema *schema, const GhtSchema **interned)
+{
+    int i;
+    uint64_t hash;
+
+    GHT_TRY(ght_schema_hash(schema, &hash));
+
+    GHT_SCHEMA_CACHE_LOCK();
+    for ( i = 0; i < ght_schema_cache_size; i++ )
+    {
+        int same = 0;
+        if ( ght_schema_cache[i].hash != hash )
+            continue;
+        if ( ght_schema_cache[i].schema == schema )
+            same = 1;
+        else
+            ght_schema_same(ght_schema_cache[i].schema, schema, &same);
+        if ( same )
+        {
+            *interned = ght_schema_cache[i].schema;
+            GHT_SCHEMA_CACHE_UNLOCK();
+            if ( *interned != schema )
+                ght_schema_free(schema);
+            return GHT_OK;
+        }
+    }
+
+    if ( ght_schema_cache_size == ght_schema_cache_max )
+    {
+        ght_schema_cache_max = ght_schema_cache_max ? 2 * ght_schema_cache_max : 8;
+        ght_schema_cache = ght_realloc(ght_schema_cache, ght_schema_cache_max * sizeof(GhtSchemaCacheEntry));
+    }
+    ght_schema_cache[ght_schema_cache_size].hash = hash;
+    ght_schema_cache[ght_schema_cache_size].schema = schema;
+    ght_schema_cache_size++;
+    *interned = schema;
+    GHT_SCHEMA_CACHE_UNLOCK();
+    return GHT_OK;
+}
+
+/** Free every cached schema, no trees using them may remain */
+GhtErr ght_schema_cache_clear(void)
+{
+    int i;
+    GhtContext *context = ght_context_swap(NULL);
+    GHT_SCHEMA_CACHE_LOCK();
+    for ( i = 0; i < ght_schema_cache_size; i++ )
+    {
+        ght_schema_free(ght_schema_cache[i].schema);
+    }
+    if ( ght_schema_cache )
+        ght_free(ght_schema_cache);
+    ght_schema_cache = NULL;
+    ght_schema_cache_size = 0;
+    ght_schema_cache_max = 0;
+    GHT_SCHEMA_CACHE_UNLOCK();
+    ght_context_swap(context);
+    return GHT_OK;
+}
+
+/** Read a binary schema and swap it for the cached equivalent, the cache outlives any context so it uses the default */
+GhtErr ght_schema_read_interned(GhtReader *reader, const GhtSchema **schema)
+{
+    GhtSchema *s;
+    GhtErr err;
+    GhtContext *context = ght_context_swap(NULL);
+    err = ght_schema_read(reader, &s);
+    if ( err == GHT_OK )
+        err = ght_schema_intern(s, schema);
+    ght_context_swap(context);
+    return err;
+}
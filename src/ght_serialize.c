@@ -46,6 +46,7 @@ ght_writer_new_file(const char *filename, GhtWriter **writer)
     w->filename = ght_strdup(filename);
     w->filesize = 0;
     w->type = GHT_IO_FILE;
+    w->context = ght_context_get_current();
     *writer = w;
     return GHT_OK;    
 }
@@ -58,6 +59,7 @@ ght_writer_new_mem(GhtWriter **writer)
     memset(w, 0,sizeof(GhtWriter));
     w->bytebuffer = bytebuffer_create();
     w->type = GHT_IO_MEM;
+    w->context = ght_context_get_current();
     *writer = w;
     return GHT_OK;
 }
@@ -65,7 +67,9 @@ ght_writer_new_mem(GhtWriter **writer)
 GhtErr
 ght_writer_free(GhtWriter *writer)
 {
+    GhtContext *context;
     if ( ! writer ) return GHT_ERROR;
+    context = ght_context_swap(writer->context);
     if ( writer->type == GHT_IO_MEM )
     {
         bytebuffer_destroy(writer->bytebuffer);
@@ -79,6 +83,7 @@ ght_writer_free(GhtWriter *writer)
     }
 
     ght_free(writer);
+    ght_context_swap(context);
     return GHT_OK;
 }
 
@@ -86,9 +91,13 @@ GhtErr
 ght_write(GhtWriter *writer, const void *bytes, size_t bytesize)
 {
     assert(writer);
+    GHT_STATS_ADD(bytes_written, bytesize);
     if ( writer->type == GHT_IO_MEM )
     {
+        /* The buffer grows with the handlers it was made with */
+        GhtContext *context = ght_context_swap(writer->context);
         bytebuffer_append(writer->bytebuffer, bytes, bytesize);
+        ght_context_swap(context);
         return GHT_OK;
     }
     else if (writer->type == GHT_IO_FILE )
@@ -107,6 +116,48 @@ ght_write(GhtWriter *writer, const void *bytes, size_t bytesize)
     }    
 }
 
+GhtErr
+ght_write_varint(GhtWriter *writer, uint64_t val)
+{
+    uint8_t buffer[10];
+    size_t size = 0;
+    while ( val >= 0x80 )
+    {
+        buffer[size++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    buffer[size++] = (uint8_t)val;
+    return ght_write(writer, buffer, size);
+}
+
+GhtErr
+ght_writer_set_delta(GhtWriter *writer, int delta)
+{
+    writer->delta = delta;
+    return GHT_OK;
+}
+
+GhtErr
+ght_writer_set_embed_schema(GhtWriter *writer, int embed)
+{
+    writer->embed_schema = embed;
+    return GHT_OK;
+}
+
+GhtErr
+ght_writer_set_codec(GhtWriter *writer, GhtCodec codec)
+{
+    int available;
+    GHT_TRY(ght_codec_available(codec, &available));
+    if ( ! available )
+    {
+        ght_error("%s: codec %d is not available in this build", __func__, codec);
+        return GHT_ERROR;
+    }
+    writer->codec = codec;
+    return GHT_OK;
+}
+
 GhtErr
 ght_writer_get_size(GhtWriter *writer, size_t *size)
 {
@@ -172,6 +223,7 @@ ght_reader_new_file(const char *filename, const GhtSchema *schema, GhtReader **r
     r->type = GHT_IO_FILE;
     r->filename = ght_strdup(filename);
     r->schema = schema;
+    r->context = ght_context_get_current();
     *reader = r;
     return GHT_OK;
 }
@@ -187,13 +239,36 @@ ght_reader_new_mem(const uint8_t *bytes_start, size_t bytes_size, const GhtSchem
     r->bytes_current = bytes_start;
     r->bytes_size = bytes_size;
     r->schema = schema;
+    r->context = ght_context_get_current();
     *reader = r;
     return GHT_OK;
 }
 
+GhtErr
+ght_reader_free_blocks(GhtReader *reader)
+{
+    if ( reader->blocks )
+    {
+        int i;
+        for ( i = 0; i < reader->num_blocks; i++ )
+        {
+            if ( reader->blocks[i].hash )
+                ght_hash_free(reader->blocks[i].hash);
+            if ( reader->blocks[i].summaries )
+                ght_summary_free(reader->blocks[i].summaries);
+        }
+        ght_free(reader->blocks);
+    }
+    reader->blocks = NULL;
+    reader->num_blocks = 0;
+    return GHT_OK;
+}
+
 GhtErr
 ght_reader_free(GhtReader *reader)
 {
+    GhtContext *context = ght_context_swap(reader->context);
+    ght_reader_free_blocks(reader);
     if ( reader->type == GHT_IO_FILE )
     {
         if ( reader->file )
@@ -202,7 +277,8 @@ ght_reader_free(GhtReader *reader)
             ght_free(reader->filename);
     }
     ght_free(reader);
-    return GHT_OK;    
+    ght_context_swap(context);
+    return GHT_OK;
 }
 
 GhtErr
@@ -218,12 +294,14 @@ ght_read(GhtReader *reader, void *bytes, size_t read_size)
         }
         memcpy(bytes, reader->bytes_current, read_size);
         reader->bytes_current += read_size;
+        GHT_STATS_ADD(bytes_read, read_size);
         return GHT_OK;
     }
     else if (reader->type == GHT_IO_FILE )
     {
         size_t rsz;
         rsz = fread(bytes, 1, read_size, reader->file);
+        GHT_STATS_ADD(bytes_read, rsz);
         if ( rsz != read_size )
         {
             if ( feof(reader->file) )
@@ -247,3 +325,110 @@ ght_read(GhtReader *reader, void *bytes, size_t read_size)
     }    
 }
 
+GhtErr
+ght_read_varint(GhtReader *reader, uint64_t *val)
+{
+    uint8_t byte;
+    int shift = 0;
+    uint64_t v = 0;
+    do
+    {
+        if ( shift > 63 )
+        {
+            ght_error("%s: variable length integer is too long", __func__);
+            return GHT_ERROR;
+        }
+        GHT_TRY(ght_read(reader, &byte, 1));
+        v |= ((uint64_t)(byte & 0x7F)) << shift;
+        shift += 7;
+    }
+    while ( byte & 0x80 );
+    *val = v;
+    return GHT_OK;
+}
+
+GhtErr
+ght_reader_tell(GhtReader *reader, size_t *position)
+{
+    assert(reader);
+    if ( reader->type == GHT_IO_MEM )
+    {
+        *position = reader->bytes_current - reader->bytes_start;
+        return GHT_OK;
+    }
+    else if ( reader->type == GHT_IO_FILE )
+    {
+        long pos = ftell(reader->file);
+        if ( pos < 0 )
+        {
+            ght_error("%s: unable to read position in %s", __func__, reader->filename);
+            return GHT_ERROR;
+        }
+        *position = pos;
+        return GHT_OK;
+    }
+    ght_error("%s: unknown reader type %d", __func__, reader->type);
+    return GHT_ERROR;
+}
+
+GhtErr
+ght_reader_seek(GhtReader *reader, size_t position)
+{
+    assert(reader);
+    if ( reader->type == GHT_IO_MEM )
+    {
+        if ( position > reader->bytes_size )
+        {
+            ght_error("%s: attempting to seek past the end of the byte buffer", __func__);
+            return GHT_ERROR;
+        }
+        reader->bytes_current = reader->bytes_start + position;
+        return GHT_OK;
+    }
+    else if ( reader->type == GHT_IO_FILE )
+    {
+        if ( fseek(reader->file, position, SEEK_SET) )
+        {
+            ght_error("%s: unable to seek to %zu in %s", __func__, position, reader->filename);
+            return GHT_ERROR;
+        }
+        return GHT_OK;
+    }
+    ght_error("%s: unknown reader type %d", __func__, reader->type);
+    return GHT_ERROR;
+}
+
+GhtErr
+ght_reader_get_size(GhtReader *reader, size_t *size)
+{
+    assert(reader);
+    if ( reader->type == GHT_IO_MEM )
+    {
+        *size = reader->bytes_size;
+        return GHT_OK;
+    }
+    else if ( reader->type == GHT_IO_FILE )
+    {
+        long pos = ftell(reader->file);
+        long end;
+        if ( pos < 0 || fseek(reader->file, 0, SEEK_END) )
+        {
+            ght_error("%s: unable to find the size of %s", __func__, reader->filename);
+            return GHT_ERROR;
+        }
+        end = ftell(reader->file);
+        fseek(reader->file, pos, SEEK_SET);
+        *size = end;
+        return GHT_OK;
+    }
+    ght_error("%s: unknown reader type %d", __func__, reader->type);
+    return GHT_ERROR;
+}
+
+GhtErr
+ght_reader_get_num_blocks(const GhtReader *reader, int *num_blocks)
+{
+    assert(reader);
+    *num_blocks = reader->num_blocks;
+    return GHT_OK;
+}
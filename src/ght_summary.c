@@ -0,0 +1,213 @@
+/******************************************************************************
+*  LibGHT, software to manage point clouds.
+*  LibGHT is free and open source software provided by the Government of Canada
+*  Copyright (c) 2012 Natural Resources Canada
+*
+*  Nouri Sabo <nsabo@NRCan.gc.ca>, Natural Resources Canada
+*  Paul Ramsey <pramsey@opengeo.org>, OpenGeo
+*
+******************************************************************************/
+
+#include "ght_internal.h"
+
+/******************************************************************************/
+/* GhtSummary */
+
+GhtErr
+ght_summary_new(const GhtDimension *dim, double min, double max, int count, GhtSummary **summary)
+{
+    GhtSummary *s;
+    s = ght_malloc(sizeof(GhtSummary));
+    if ( ! s ) return GHT_ERROR;
+    memset(s, 0, sizeof(GhtSummary));
+    s->dim = dim;
+    s->next = NULL;
+    s->min = min;
+    s->max = max;
+    s->count = count;
+    *summary = s;
+    return GHT_OK;
+}
+
+GhtErr
+ght_summary_free(GhtSummary *summary)
+{
+    GhtSummary *next;
+    while ( summary )
+    {
+        next = summary->next;
+        ght_free(summary);
+        summary = next;
+    }
+    return GHT_OK;
+}
+
+GhtErr
+ght_summary_clone(const GhtSummary *summary, GhtSummary **summary_out)
+{
+    GhtSummary **tail = summary_out;
+    *summary_out = NULL;
+    while ( summary )
+    {
+        GHT_TRY(ght_summary_new(summary->dim, summary->min, summary->max, summary->count, tail));
+        tail = &((*tail)->next);
+        summary = summary->next;
+    }
+    return GHT_OK;
+}
+
+GhtErr
+ght_summary_get_by_dimension(const GhtSummary *summary, const GhtDimension *dim, const GhtSummary **found)
+{
+    while ( summary )
+    {
+        if ( summary->dim == dim )
+        {
+            *found = summary;
+            return GHT_OK;
+        }
+        summary = summary->next;
+    }
+    *found = NULL;
+    return GHT_ERROR;
+}
+
+/** Widen the entry for dim to take in [min, max] from count more leaves, appending a new entry if needed */
+GhtErr
+ght_summary_extend(GhtSummary **summary, const GhtDimension *dim, double min, double max, int count)
+{
+    GhtSummary *s = *summary;
+    GhtSummary *last = NULL;
+
+    while ( s )
+    {
+        if ( s->dim == dim )
+        {
+            if ( min < s->min ) s->min = min;
+            if ( max > s->max ) s->max = max;
+            s->count += count;
+            return GHT_OK;
+        }
+        last = s;
+        s = s->next;
+    }
+
+    GHT_TRY(ght_summary_new(dim, min, max, count, &s));
+    if ( last )
+        last->next = s;
+    else
+        *summary = s;
+    return GHT_OK;
+}
+
+/** Widen the summary with every range of another summary */
+GhtErr
+ght_summary_extend_by_summary(GhtSummary **summary, const GhtSummary *other)
+{
+    while ( other )
+    {
+        GHT_TRY(ght_summary_extend(summary, other->dim, other->min, other->max, other->count));
+        other = other->next;
+    }
+    return GHT_OK;
+}
+
+/** Widen the summary with the values of an attribute list, held by count leaves */
+GhtErr
+ght_summary_extend_by_attribute(GhtSummary **summary, const GhtAttribute *attr, int count)
+{
+    double val;
+    while ( attr )
+    {
+        GHT_TRY(ght_attribute_get_value(attr, &val));
+        GHT_TRY(ght_summary_extend(summary, attr->dim, val, val, count));
+        attr = attr->next;
+    }
+    return GHT_OK;
+}
+
+/**
+* Widen the summary with a node and its subtree. An attribute of
+* the node holds for every leaf under it, and takes the place of the
+* count of the node's own summary entry for that dimension.
+*/
+GhtErr
+ght_summary_extend_by_node(GhtSummary **summary, const GhtNode *node)
+{
+    const GhtSummary *s;
+    const GhtAttribute *attr;
+
+    for ( s = node->summaries; s; s = s->next )
+    {
+        int count = s->count;
+        for ( attr = node->attributes; attr; attr = attr->next )
+        {
+            if ( attr->dim == s->dim )
+                count = 0;
+        }
+        GHT_TRY(ght_summary_extend(summary, s->dim, s->min, s->max, count));
+    }
+    return ght_summary_extend_by_attribute(summary, node->attributes, node->num_leaves);
+}
+
+/**
+* Summary serialization:
+* - number of GhtSummary entries
+* - for each, dimension position, min, max, leaf count (varint)
+*/
+GhtErr
+ght_summary_write(const GhtSummary *summary, GhtWriter *writer)
+{
+    uint8_t count = 0;
+    const GhtSummary *s = summary;
+
+    while ( s )
+    {
+        count++;
+        s = s->next;
+    }
+    GHT_TRY(ght_write(writer, &count, 1));
+
+    s = summary;
+    while ( s )
+    {
+        uint8_t position;
+        GHT_TRY(ght_dimension_get_position(s->dim, &position));
+        GHT_TRY(ght_write(writer, &position, 1));
+        GHT_TRY(ght_write(writer, &(s->min), sizeof(double)));
+        GHT_TRY(ght_write(writer, &(s->max), sizeof(double)));
+        GHT_TRY(ght_write_varint(writer, (uint64_t)s->count));
+        s = s->next;
+    }
+    return GHT_OK;
+}
+
+GhtErr
+ght_summary_read(GhtReader *reader, GhtSummary **summary)
+{
+    uint8_t count;
+    GhtSummary **tail = summary;
+    const GhtSchema *schema = reader->schema;
+
+    *summary = NULL;
+    GHT_TRY(ght_read(reader, &count, 1));
+    while ( count )
+    {
+        uint8_t dimnum;
+        double min, max;
+        uint64_t num_leaves;
+        GHT_TRY(ght_read(reader, &dimnum, 1));
+        GHT_TRY(ght_read(reader, &min, sizeof(double)));
+        GHT_TRY(ght_read(reader, &max, sizeof(double)));
+        GHT_TRY(ght_read_varint(reader, &num_leaves));
+        if ( dimnum >= schema->num_dims )
+        {
+            ght_error("%s: summary dimension %d does not exist in schema %p", __func__, dimnum, schema);
+            return GHT_ERROR;
+        }
+        GHT_TRY(ght_summary_new(schema->dims[dimnum], min, max, (int)num_leaves, tail));
+        tail = &((*tail)->next);
+        count--;
+    }
+    return GHT_OK;
+}
@@ -22,6 +22,7 @@ ght_tree_new(const GhtSchema *schema, GhtTree **tree)
     t->config.allow_duplicates = GHT_DUPES_YES;
     t->config.max_hash_length  = GHT_MAX_HASH_LENGTH;
     t->schema = schema;
+    t->context = ght_context_get_current();
     *tree = t;
     return GHT_OK;
 }
@@ -29,10 +30,15 @@ ght_tree_new(const GhtSchema *schema, GhtTree **tree)
 GhtErr
 ght_tree_free(GhtTree *tree)
 {
+    GhtContext *context;
     assert(tree);
-    if ( tree->root )
+    context = ght_context_swap(tree->context);
+    if ( tree->arena )
+        ght_free(tree->arena);
+    else if ( tree->root )
         ght_node_free(tree->root);
     ght_free(tree);
+    ght_context_swap(context);
     return GHT_OK;
 }
 
@@ -49,15 +55,43 @@ ght_tree_get_hash(const GhtTree *tree, GhtHash **hash)
 GhtErr
 ght_tree_compact_attributes(GhtTree *tree)
 {
-    int i;
-    GhtAttribute attr;
+    return ght_tree_compact_attributes_tolerance(tree, NULL, NULL);
+}
 
-    /* for 'Z 'and all other attributes... */
-    for ( i = 2; i < tree->schema->num_dims; i++ )
+/**
+* Lossy compaction: wherever all the values of a dimension under a
+* node lie within its tolerance, the node carries their midpoint
+* instead. Every value moves by at most half its tolerance, plus
+* rounding to the dimension scale, and max_errors (if not NULL)
+* reports the actual largest move per dimension.
+*/
+GhtErr
+ght_tree_compact_attributes_tolerance(GhtTree *tree, const double *tolerances, double *max_errors)
+{
+    GhtContext *context;
+    GhtErr err;
+    int i, lossy = 0;
+
+    GHT_TRY(ght_tree_check_mutable(tree, __func__));
+    for ( i = 0; i < tree->schema->num_dims; i++ )
     {
-        ght_node_compact_attribute(tree->root, tree->schema->dims[i], &attr);
+        if ( max_errors )
+            max_errors[i] = 0.0;
+        if ( tolerances && tolerances[i] > 0.0 )
+            lossy = 1;
     }
-    return GHT_OK;
+
+    context = ght_context_swap(tree->context);
+    GHT_STATS_START(compact);
+    err = ght_node_compact_attributes(tree->root, tree->schema, tolerances, max_errors);
+    /* Values have moved, so the summaries and samples have to follow them */
+    if ( err == GHT_OK && lossy && tree->config.summaries && tree->root )
+        err = ght_node_summarize(tree->root);
+    if ( err == GHT_OK && lossy && tree->lod )
+        err = ght_tree_build_lod(tree, tree->lod_mode);
+    GHT_STATS_STOP(compact);
+    ght_context_swap(context);
+    return err;
 }
 
 
@@ -65,29 +99,186 @@ ght_tree_compact_attributes(GhtTree *tree)
 GhtErr
 ght_tree_insert_node(GhtTree *tree, GhtNode *node)
 {
+    GhtContext *context;
+    GhtErr err = GHT_OK;
+
+    GHT_TRY(ght_tree_check_mutable(tree, __func__));
     if ( ! tree->root )
     {
         tree->root = node;
+        return GHT_OK;
     }
+
+    context = ght_context_swap(tree->context);
+    GHT_STATS_START(insert);
+    if ( tree->config.summaries )
+        err = ght_node_insert_node_summarized(tree->root, node, tree->config.allow_duplicates);
     else
+        err = ght_node_insert_node(tree->root, node, tree->config.allow_duplicates);
+    GHT_STATS_STOP(insert);
+    ght_context_swap(context);
+
+    return err;
+}
+
+GhtErr
+ght_tree_set_summaries(GhtTree *tree, int summaries)
+{
+    GhtContext *context;
+    GhtErr err = GHT_OK;
+
+    GHT_TRY(ght_tree_check_mutable(tree, __func__));
+    tree->config.summaries = summaries ? 1 : 0;
+    if ( summaries && tree->root )
     {
-        GHT_TRY(ght_node_insert_node(tree->root, node, tree->config.allow_duplicates));
+        context = ght_context_swap(tree->context);
+        err = ght_node_summarize(tree->root);
+        ght_context_swap(context);
     }
-    tree->num_nodes++;
-    return GHT_OK;
+    return err;
 }
 
+/**
+* Blocked layout, following the header:
+* - codec
+* - root node head (hash and attributes)
+* - number of blocks (one per child of the root)
+* - block index: child hash, offset, compressed size, raw size (all
+*   three as varints), and for summarized trees the value ranges
+*   within the block
+* - root summaries (summarized trees only)
+* - compressed blocks, each a serialized child subtree
+*/
+static GhtErr
+ght_tree_write_blocks(const GhtTree *tree, GhtWriter *writer)
+{
+    int i;
+    uint8_t codec = writer->codec;
+    uint8_t num_blocks = 0;
+    uint64_t offset = 0;
+    GhtBlock *blocks = NULL;
+    uint8_t **blockbytes = NULL;
+    GhtWriter *blockwriter = NULL;
+    GhtSummary *summary = NULL;
+    const GhtNode *root = tree->root;
+    GhtErr err = GHT_ERROR;
+
+    if ( root->children )
+    {
+        /* The count is a single byte in the stream */
+        if ( root->children->num_nodes > UINT8_MAX )
+        {
+            ght_error("%s: root has %d children, more than the %d blocks a tree can hold", __func__, root->children->num_nodes, UINT8_MAX);
+            return GHT_ERROR;
+        }
+        num_blocks = root->children->num_nodes;
+    }
+
+    GHT_TRY(ght_write(writer, &codec, 1));
+    GHT_TRY(ght_node_write_head(root, writer));
+    GHT_TRY(ght_write(writer, &num_blocks, 1));
+
+    if ( ! num_blocks )
+        return GHT_OK;
+
+    /* Compress every subtree up front, the index needs the sizes */
+    blocks = ght_malloc(num_blocks * sizeof(GhtBlock));
+    blockbytes = ght_malloc(num_blocks * sizeof(uint8_t*));
+    if ( ! blocks || ! blockbytes )
+        goto done;
+    memset(blockbytes, 0, num_blocks * sizeof(uint8_t*));
+    for ( i = 0; i < num_blocks; i++ )
+    {
+        size_t size;
+        const GhtNode *child = root->children->nodes[i];
+
+        if ( ght_writer_new_mem(&blockwriter) != GHT_OK )
+            goto done;
+        blockwriter->flags = writer->flags;
+        if ( ght_node_write(child, blockwriter) != GHT_OK )
+            goto done;
+        blocks[i].raw_size = bytebuffer_getsize(blockwriter->bytebuffer);
+        if ( ght_codec_compress(writer->codec,
+                                bytebuffer_getbytes(blockwriter->bytebuffer),
+                                blocks[i].raw_size, &(blockbytes[i]), &size) != GHT_OK )
+            goto done;
+        ght_writer_free(blockwriter);
+        blockwriter = NULL;
+        blocks[i].size = size;
+        blocks[i].offset = offset;
+        offset += size;
+    }
+
+    /* Write the index */
+    for ( i = 0; i < num_blocks; i++ )
+    {
+        if ( ght_hash_write(root->children->nodes[i]->hash, writer) != GHT_OK ||
+             ght_write_varint(writer, blocks[i].offset) != GHT_OK ||
+             ght_write_varint(writer, blocks[i].size) != GHT_OK ||
+             ght_write_varint(writer, blocks[i].raw_size) != GHT_OK )
+            goto done;
+        if ( writer->flags & GHT_FLAG_SUMMARIES )
+        {
+            /* Leaf children carry their values as attributes, so fold those in */
+            const GhtNode *child = root->children->nodes[i];
+            if ( ght_summary_extend_by_node(&summary, child) != GHT_OK ||
+                 ght_summary_write(summary, writer) != GHT_OK )
+                goto done;
+            ght_summary_free(summary);
+            summary = NULL;
+        }
+    }
+    if ( (writer->flags & GHT_FLAG_SUMMARIES) &&
+         ght_summary_write(root->summaries, writer) != GHT_OK )
+        goto done;
+
+    /* Write the blocks */
+    for ( i = 0; i < num_blocks; i++ )
+    {
+        if ( ght_write(writer, blockbytes[i], blocks[i].size) != GHT_OK )
+            goto done;
+    }
+    err = GHT_OK;
+
+done:
+    if ( blockwriter )
+        ght_writer_free(blockwriter);
+    if ( summary )
+        ght_summary_free(summary);
+    if ( blockbytes )
+    {
+        for ( i = 0; i < num_blocks; i++ )
+        {
+            if ( blockbytes[i] )
+                ght_free(blockbytes[i]);
+        }
+        ght_free(blockbytes);
+    }
+    if ( blocks )
+        ght_free(blocks);
+    return err;
+}
+
+/** Write the stream header, settling the feature flags for the writer */
 GhtErr
-ght_tree_write(const GhtTree *tree, GhtWriter *writer)
+ght_tree_write_header(const GhtSchema *schema, const GhtConfig *config, GhtWriter *writer)
 {
-    uint8_t version = GHT_FORMAT_VERSION;
+    uint8_t version;
+    uint8_t flags = 0;
     char endian = machine_endian();
 
-    assert(writer);
-    assert(tree);
-    
-    if ( ! tree->root )
-        return GHT_ERROR;
+    if ( writer->codec != GHT_CODEC_NONE )
+        flags |= GHT_FLAG_BLOCKS;
+    if ( config->summaries )
+        flags |= GHT_FLAG_SUMMARIES;
+    if ( writer->delta )
+        flags |= GHT_FLAG_DELTA;
+    if ( writer->embed_schema )
+        flags |= GHT_FLAG_SCHEMA;
+    writer->flags = flags;
+
+    /* Plain streams stay at version 1, so older readers can still take them */
+    version = flags ? GHT_FORMAT_VERSION : 1;
     
     /* Endianness */
     GHT_TRY(ght_write(writer, &endian, 1)); /* 0 = Big, 1 = Little */
@@ -96,35 +287,284 @@ ght_tree_write(const GhtTree *tree, GhtWriter *writer)
     GHT_TRY(ght_write(writer, &version, 1));
     
     /* Maximum hash length in this tree */
-    GHT_TRY(ght_write(writer, &(tree->config.max_hash_length), 1));
+    GHT_TRY(ght_write(writer, &(config->max_hash_length), 1));
+
+    /* Optional features used in this stream, version 2 onwards */
+    if ( version > 1 )
+        GHT_TRY(ght_write(writer, &flags, 1));
+
+    /* Binary schema, so readers need no XML */
+    if ( flags & GHT_FLAG_SCHEMA )
+        GHT_TRY(ght_schema_write(schema, writer));
+
+    return GHT_OK;
+}
+
+GhtErr
+ght_tree_write(const GhtTree *tree, GhtWriter *writer)
+{
+    GhtErr err;
+    assert(writer);
+    assert(tree);
     
-    return ght_node_write(tree->root, writer);
+    if ( ! tree->root )
+        return GHT_ERROR;
+
+    GHT_STATS_START(write);
+    err = ght_tree_write_header(tree->schema, &(tree->config), writer);
+
+    if ( err == GHT_OK && (writer->flags & GHT_FLAG_BLOCKS) )
+        err = ght_tree_write_blocks(tree, writer);
+    else if ( err == GHT_OK )
+        err = ght_node_write(tree->root, writer);
+    GHT_STATS_STOP(write);
+    return err;
 }
 
-GhtErr 
-ght_tree_read(GhtReader *reader, GhtTree **tree)
+static GhtErr
+ght_tree_read_block_index(GhtReader *reader, GhtTree *tree)
+{
+    int i;
+    uint8_t codec;
+    uint8_t num_blocks;
+
+    GHT_TRY(ght_read(reader, &codec, 1));
+    reader->codec = codec;
+    GHT_TRY(ght_node_read_head(reader, &(tree->root)));
+    GHT_TRY(ght_read(reader, &num_blocks, 1));
+
+    reader->num_blocks = num_blocks;
+    if ( ! num_blocks )
+        return GHT_OK;
+
+    reader->blocks = ght_malloc(num_blocks * sizeof(GhtBlock));
+    memset(reader->blocks, 0, num_blocks * sizeof(GhtBlock));
+    for ( i = 0; i < num_blocks; i++ )
+    {
+        GhtBlock *block = &(reader->blocks[i]);
+        GHT_TRY(ght_hash_read(reader, &(block->hash)));
+        GHT_TRY(ght_read_varint(reader, &(block->offset)));
+        GHT_TRY(ght_read_varint(reader, &(block->size)));
+        GHT_TRY(ght_read_varint(reader, &(block->raw_size)));
+        if ( reader->flags & GHT_FLAG_SUMMARIES )
+            GHT_TRY(ght_summary_read(reader, &(block->summaries)));
+    }
+    if ( reader->flags & GHT_FLAG_SUMMARIES )
+        GHT_TRY(ght_summary_read(reader, &(tree->root->summaries)));
+
+    /* Block offsets are relative to the end of the index */
+    return ght_reader_tell(reader, &(reader->blocks_start));
+}
+
+static GhtErr
+ght_tree_read_root_in_context(GhtReader *reader, GhtTree **tree)
 {
     GhtTree *t;
+    GhtErr err = GHT_ERROR;
+
+    *tree = NULL;
     
-    GHT_TRY(ght_tree_new(reader->schema, tree));
-    t = *tree;
+    /* Readers can be reused for a sequence of trees */
+    GHT_TRY(ght_reader_free_blocks(reader));
+
+    GHT_TRY(ght_tree_new(reader->schema, &t));
     
     /* Endianness */
-    GHT_TRY(ght_read(reader, &(t->config.endian), 1));
+    if ( ght_read(reader, &(t->config.endian), 1) != GHT_OK )
+        goto fail;
     /* File format version */
-    GHT_TRY(ght_read(reader, &(t->config.version), 1));
+    if ( ght_read(reader, &(t->config.version), 1) != GHT_OK )
+        goto fail;
     
-    if ( GHT_FORMAT_VERSION == t->config.version )
+    if ( t->config.version < 1 || t->config.version > GHT_FORMAT_VERSION )
+    {
+        ght_error("%s: unsupported GHT format version %d", __func__, t->config.version);
+        goto fail;
+    }
+
+    /* Maximum hash length in this tree */
+    if ( ght_read(reader, &(t->config.max_hash_length), 1) != GHT_OK )
+        goto fail;
+
+    /* Version 1 streams have no feature flags */
+    reader->version = t->config.version;
+    reader->endian = t->config.endian;
+    reader->flags = 0;
+    if ( t->config.version > 1 && ght_read(reader, &(reader->flags), 1) != GHT_OK )
+        goto fail;
+    t->config.summaries = (reader->flags & GHT_FLAG_SUMMARIES) ? 1 : 0;
+
+    /* Embedded schema, used when the reader was not given one */
+    if ( reader->flags & GHT_FLAG_SCHEMA )
+    {
+        const GhtSchema *schema;
+        if ( ght_schema_read_interned(reader, &schema) != GHT_OK )
+            goto fail;
+        if ( reader->schema && reader->schema != schema )
+        {
+            int same;
+            if ( ght_schema_same(reader->schema, schema, &same) != GHT_OK )
+                goto fail;
+            if ( ! same )
+            {
+                ght_error("%s: embedded schema does not match reader schema", __func__);
+                goto fail;
+            }
+        }
+        else
+        {
+            reader->schema = schema;
+        }
+        t->schema = reader->schema;
+    }
+
+    if ( ! t->schema )
     {
-        /* Maximum hash length in this tree */
-        GHT_TRY(ght_read(reader, &(t->config.max_hash_length), 1));
-        return ght_node_read(reader, &(t->root));
+        ght_error("%s: reader has no schema and stream embeds none", __func__);
+        goto fail;
     }
+
+    if ( reader->flags & GHT_FLAG_BLOCKS )
+        err = ght_tree_read_block_index(reader, t);
     else
+        err = ght_node_read(reader, &(t->root));
+    if ( err != GHT_OK )
+        goto fail;
+
+    *tree = t;
+    return GHT_OK;
+
+fail:
+    ght_reader_free_blocks(reader);
+    ght_tree_free(t);
+    *tree = NULL;
+    return GHT_ERROR;
+}
+
+/** Trees are built with the handlers of the reader they come from */
+GhtErr
+ght_tree_read_root(GhtReader *reader, GhtTree **tree)
+{
+    GhtContext *context = ght_context_swap(reader->context);
+    GhtErr err = ght_tree_read_root_in_context(reader, tree);
+    ght_context_swap(context);
+    return err;
+}
+
+static GhtErr
+ght_tree_read_block_in_context(GhtReader *reader, GhtTree *tree, int block)
+{
+    GhtBlock *b;
+    GhtReader *blockreader = NULL;
+    GhtNode *child = NULL;
+    uint8_t *bytes = NULL, *raw = NULL;
+    GhtErr err = GHT_ERROR;
+
+    if ( block < 0 || block >= reader->num_blocks )
     {
-        ght_error("%s: unsupported GHT format version %d", __func__, t->config.version);
+        ght_error("%s: block %d does not exist", __func__, block);
         return GHT_ERROR;
     }
+    if ( ! tree->root )
+        return GHT_ERROR;
+    GHT_TRY(ght_tree_check_mutable(tree, __func__));
+
+    /* Already in the tree, adding it again would double it */
+    b = &(reader->blocks[block]);
+    if ( b->loaded )
+        return GHT_OK;
+    GHT_TRY(ght_reader_seek(reader, reader->blocks_start + b->offset));
+
+    bytes = ght_malloc(b->size ? b->size : 1);
+    raw = ght_malloc(b->raw_size ? b->raw_size : 1);
+    if ( ! bytes || ! raw ||
+         ght_read(reader, bytes, b->size) != GHT_OK ||
+         ght_codec_decompress(reader->codec, bytes, b->size, raw, b->raw_size) != GHT_OK )
+        goto done;
+
+    if ( ght_reader_new_mem(raw, b->raw_size, reader->schema, &blockreader) != GHT_OK )
+        goto done;
+    blockreader->flags = reader->flags;
+    if ( ght_node_read(blockreader, &child) != GHT_OK )
+        goto done;
+
+    err = ght_node_add_child(tree->root, child);
+    if ( err == GHT_OK )
+        b->loaded = 1;
+    else
+        ght_node_free(child);
+
+done:
+    if ( blockreader )
+        ght_reader_free(blockreader);
+    if ( raw )
+        ght_free(raw);
+    if ( bytes )
+        ght_free(bytes);
+    return err;
+}
+
+GhtErr
+ght_tree_read_block(GhtReader *reader, GhtTree *tree, int block)
+{
+    GhtContext *context = ght_context_swap(reader->context);
+    GhtErr err = ght_tree_read_block_in_context(reader, tree, block);
+    ght_context_swap(context);
+    return err;
+}
+
+GhtErr 
+ght_tree_read(GhtReader *reader, GhtTree **tree)
+{
+    int i;
+    GhtErr err;
+    GHT_STATS_START(read);
+    err = ght_tree_read_root(reader, tree);
+    for ( i = 0; err == GHT_OK && i < reader->num_blocks; i++ )
+    {
+        err = ght_tree_read_block(reader, *tree, i);
+    }
+    /* No half-read trees */
+    if ( err != GHT_OK && *tree )
+    {
+        ght_tree_free(*tree);
+        *tree = NULL;
+    }
+    GHT_STATS_STOP(read);
+    return err;
+}
+
+GhtErr
+ght_reader_get_block_area(const GhtReader *reader, const GhtTree *tree, int block, GhtArea *area)
+{
+    GhtHash h[GHT_MAX_HASH_LENGTH+1];
+
+    if ( block < 0 || block >= reader->num_blocks || ! tree->root )
+        return GHT_ERROR;
+
+    memset(h, 0, GHT_MAX_HASH_LENGTH+1);
+    if ( tree->root->hash )
+        strncpy(h, tree->root->hash, GHT_MAX_HASH_LENGTH);
+    if ( reader->blocks[block].hash )
+        strncat(h, reader->blocks[block].hash, GHT_MAX_HASH_LENGTH - strlen(h));
+
+    return ght_area_from_hash(h, area);
+}
+
+GhtErr
+ght_reader_get_block_range(const GhtReader *reader, int block, const char *dimname, GhtRange *range)
+{
+    GhtDimension *dim;
+    const GhtSummary *summary;
+
+    if ( block < 0 || block >= reader->num_blocks )
+        return GHT_ERROR;
+
+    GHT_TRY(ght_schema_get_dimension_by_name(reader->schema, dimname, &dim));
+    GHT_TRY(ght_summary_get_by_dimension(reader->blocks[block].summaries, dim, &summary));
+    range->min = summary->min;
+    range->max = summary->max;
+    return GHT_OK;
 }
 
 GhtErr
@@ -134,6 +574,7 @@ ght_tree_from_nodelist(const GhtSchema *schema, GhtNodeList *nlist, GhtConfig *c
     GhtTree *t;
     GhtNode *root;
     GhtErr err;
+    GHT_STATS_START(insert);
     
     for ( i = 0; i < nlist->num_nodes; i++ )
     {
@@ -150,7 +591,10 @@ ght_tree_from_nodelist(const GhtSchema *schema, GhtNodeList *nlist, GhtConfig *c
         }
         else
         {
-            err = ght_node_insert_node(root, node, config->allow_duplicates);
+            if ( config->summaries )
+                err = ght_node_insert_node_summarized(root, node, config->allow_duplicates);
+            else
+                err = ght_node_insert_node(root, node, config->allow_duplicates);
             /* If we have an error, that's a big problem. The nodes underneath */
             /* the GhtNodeList have now been mutated during the insertion */
             /* process, and there are also new interior nodes lying around too */
@@ -164,9 +608,9 @@ ght_tree_from_nodelist(const GhtSchema *schema, GhtNodeList *nlist, GhtConfig *c
             }
         }
     }
+    GHT_STATS_STOP(insert);
     
     GHT_TRY(ght_tree_new(schema, &t));
-    t->num_nodes = nlist->num_nodes;
     t->root = root;
     t->schema = schema;
     t->config = *config;
@@ -212,100 +656,122 @@ ght_tree_get_schema(const GhtTree *tree, const GhtSchema **schema)
     return GHT_OK;  
 }
 
-static GhtErr
-ght_tree_filter(const GhtTree *tree, const GhtFilter *filter, GhtTree **tree_filtered)
+/**
+* Copy out the points that pass a predicate, in one traversal of the
+* tree. The filtered tree shares the schema of the source tree.
+*/
+GhtErr
+ght_tree_filter_predicate(const GhtTree *tree, GhtPredicate *predicate, GhtTree **tree_filtered)
 {
-    GhtSchema *schema_filtered = NULL;
     GhtNode *root_filtered = NULL;
     GhtErr err;
-    int num_leaves = 0;
-    
+    int num_terms;
+
     /* We need a tree and a place to put a new tree */
-    if ( ! tree || ! tree_filtered )
+    if ( ! tree || ! predicate || ! tree_filtered )
         return GHT_ERROR;
-    
-    /* Filter */
-    err = ght_node_filter_by_attribute(tree->root, filter, &root_filtered);
-    if ( err == GHT_ERROR )
-        ght_error("%s: attribute filter failed", __func__);
-        
+
+    GHT_TRY(ght_predicate_prepare(predicate, tree->schema, &num_terms));
+
+    /* Filter, with every term undecided at the top */
+    {
+        uint8_t state[num_terms ? num_terms : 1];
+        memset(state, GHT_PREDICATE_UNKNOWN, num_terms);
+        err = ght_node_filter_by_predicate(tree->root, predicate, "", state, num_terms, &root_filtered);
+        if ( err == GHT_ERROR )
+        {
+            ght_error("%s: predicate filter failed", __func__);
+            return GHT_ERROR;
+        }
+    }
+
     /* Got a valid response, so build a new tree around it */
-    GHT_TRY(ght_node_count_leaves(root_filtered, &num_leaves));
-    GHT_TRY(ght_schema_clone(tree->schema, &schema_filtered));
-    GHT_TRY(ght_tree_new(schema_filtered, tree_filtered));
-    (*tree_filtered)->num_nodes = num_leaves;
+    GHT_TRY(ght_tree_new(tree->schema, tree_filtered));
     (*tree_filtered)->config = tree->config;
     (*tree_filtered)->root = root_filtered;
 
     return GHT_OK;
 }
 
+static GhtErr
+ght_tree_visit(const GhtTree *tree, GhtPredicate *predicate, GhtLeafCallback callback, void *data, int *count)
+{
+    GhtLeaf leaf;
+    GhtErr err;
+    int num_terms = 0;
+
+    *count = 0;
+    if ( ! tree )
+        return GHT_ERROR;
+    if ( predicate )
+        GHT_TRY(ght_predicate_prepare(predicate, tree->schema, &num_terms));
+
+    memset(&leaf, 0, sizeof(GhtLeaf));
+    {
+        uint8_t state[num_terms ? num_terms : 1];
+        memset(state, GHT_PREDICATE_UNKNOWN, num_terms);
+        err = ght_node_visit_by_predicate(tree->root, predicate, state, num_terms, &leaf, callback, data, count);
+    }
+
+    /* Stopping early is not a failure */
+    if ( err == GHT_DONE )
+        return GHT_OK;
+    return err;
+}
+
+GhtErr
+ght_tree_filter_count(const GhtTree *tree, GhtPredicate *predicate, int *count)
+{
+    return ght_tree_visit(tree, predicate, NULL, NULL, count);
+}
+
+GhtErr
+ght_tree_filter_foreach(const GhtTree *tree, GhtPredicate *predicate, GhtLeafCallback callback, void *data)
+{
+    int count;
+    if ( ! callback )
+        return GHT_ERROR;
+    return ght_tree_visit(tree, predicate, callback, data, &count);
+}
+
+static GhtErr
+ght_tree_filter(const GhtTree *tree, GhtPredicate *predicate, GhtTree **tree_filtered)
+{
+    GhtErr err = ght_tree_filter_predicate(tree, predicate, tree_filtered);
+    ght_predicate_free(predicate);
+    return err;
+}
+
 GhtErr
 ght_tree_filter_greater_than(const GhtTree *tree, const char *dimname, double value, GhtTree **tree_filtered)
 {
-    GhtFilter filter;
-    GhtDimension *dim;
-    
-    /* Set up filter */
-    filter.mode = GHT_GREATER_THAN;
-    filter.range.min = filter.range.max = value;
-    GHT_TRY(ght_schema_get_dimension_by_name(tree->schema, dimname, &dim));
-    filter.dim = dim;
-    
-    return ght_tree_filter(tree, &filter, tree_filtered);
-}    
+    GhtPredicate *predicate;
+    GHT_TRY(ght_predicate_new_greater_than(dimname, value, &predicate));
+    return ght_tree_filter(tree, predicate, tree_filtered);
+}
 
 GhtErr
 ght_tree_filter_less_than(const GhtTree *tree, const char *dimname, double value, GhtTree **tree_filtered)
 {
-    GhtFilter filter;
-    GhtDimension *dim;
-    
-    /* Set up filter */
-    filter.mode = GHT_LESS_THAN;
-    filter.range.min = filter.range.max = value;
-    GHT_TRY(ght_schema_get_dimension_by_name(tree->schema, dimname, &dim));
-    filter.dim = dim;
-    
-    return ght_tree_filter(tree, &filter, tree_filtered);
-}    
+    GhtPredicate *predicate;
+    GHT_TRY(ght_predicate_new_less_than(dimname, value, &predicate));
+    return ght_tree_filter(tree, predicate, tree_filtered);
+}
 
 GhtErr
 ght_tree_filter_between(const GhtTree *tree, const char *dimname, double value1, double value2, GhtTree **tree_filtered)
 {
-    GhtFilter filter;
-    GhtDimension *dim;
-
-    if ( value1 > value2 )
-    {   
-        double tmp = value1;
-        value1 = value2;
-        value2 = tmp;
-    }
-    
-    /* Set up filter */
-    filter.mode = GHT_BETWEEN;
-    filter.range.min = value1;
-    filter.range.max = value2;
-    GHT_TRY(ght_schema_get_dimension_by_name(tree->schema, dimname, &dim));
-    filter.dim = dim;
-    
-    return ght_tree_filter(tree, &filter, tree_filtered);
-}    
+    GhtPredicate *predicate;
+    GHT_TRY(ght_predicate_new_between(dimname, value1, value2, &predicate));
+    return ght_tree_filter(tree, predicate, tree_filtered);
+}
 
 GhtErr
 ght_tree_filter_equal(const GhtTree *tree, const char *dimname, double value, GhtTree **tree_filtered)
 {
-    GhtFilter filter;
-    GhtDimension *dim;
-    
-    /* Set up filter */
-    filter.mode = GHT_EQUAL;
-    filter.range.min = filter.range.max = value;
-    GHT_TRY(ght_schema_get_dimension_by_name(tree->schema, dimname, &dim));
-    filter.dim = dim;
-    
-    return ght_tree_filter(tree, &filter, tree_filtered);
+    GhtPredicate *predicate;
+    GHT_TRY(ght_predicate_new_equal(dimname, value, &predicate));
+    return ght_tree_filter(tree, predicate, tree_filtered);
 }
     
 GhtErr
@@ -313,11 +779,193 @@ ght_tree_get_numpoints(const GhtTree *tree, int *numpoints)
 {
     if ( numpoints )
     {
-        *numpoints = tree->num_nodes;
+        *numpoints = tree->root ? tree->root->num_leaves : 0;
         return GHT_OK;
     }
     else
     {
         return GHT_ERROR;
     }
-}
\ No newline at end of file
+}
+
+/**
+* Profile the tree, to see how the resolution and point density
+* shape it, and what it costs to hold in memory.
+*/
+GhtErr
+ght_tree_get_profile(const GhtTree *tree, GhtTreeProfile *profile)
+{
+    if ( ! tree || ! profile )
+        return GHT_ERROR;
+
+    memset(profile, 0, sizeof(GhtTreeProfile));
+    if ( ! tree->root )
+        return GHT_OK;
+    return ght_node_profile(tree->root, 0, profile);
+}
+/******************************************************************************
+*  Frozen trees
+******************************************************************************/
+
+/* One allocation holding a whole frozen tree, each part filled in order */
+typedef struct
+{
+    GhtNode *nodes;
+    int num_nodes;
+    GhtNodeList *lists;
+    int num_lists;
+    GhtNode **children;
+    int num_children;
+    GhtAttribute *attributes;
+    int num_attributes;
+    GhtSummary *summaries;
+    int num_summaries;
+    char *chars;
+    size_t num_chars;
+} GhtArena;
+
+/** Tally up the room needed to copy a node and everything it holds */
+static void
+ght_arena_count(const GhtNode *node, GhtArena *arena)
+{
+    const GhtAttribute *attr;
+    const GhtSummary *summary;
+    int i;
+
+    arena->num_nodes++;
+    if ( node->hash )
+        arena->num_chars += strlen(node->hash) + 1;
+    for ( attr = node->attributes; attr; attr = attr->next )
+        arena->num_attributes++;
+    for ( summary = node->summaries; summary; summary = summary->next )
+        arena->num_summaries++;
+    if ( node->sample )
+        ght_arena_count(node->sample, arena);
+    if ( node->children && node->children->num_nodes > 0 )
+    {
+        arena->num_lists++;
+        arena->num_children += node->children->num_nodes;
+        for ( i = 0; i < node->children->num_nodes; i++ )
+            ght_arena_count(node->children->nodes[i], arena);
+    }
+}
+
+/** Copy a node into the next free slots of the arena, children after their parent */
+static GhtNode *
+ght_arena_copy(const GhtNode *node, GhtArena *arena)
+{
+    GhtNode *n = &(arena->nodes[arena->num_nodes++]);
+    const GhtAttribute *attr;
+    const GhtSummary *summary;
+    GhtAttribute **attr_tail = &(n->attributes);
+    GhtSummary **summary_tail = &(n->summaries);
+    int i;
+
+    n->num_leaves = node->num_leaves;
+    if ( node->hash )
+    {
+        n->hash = arena->chars + arena->num_chars;
+        strcpy(n->hash, node->hash);
+        arena->num_chars += strlen(node->hash) + 1;
+    }
+    for ( attr = node->attributes; attr; attr = attr->next )
+    {
+        GhtAttribute *a = &(arena->attributes[arena->num_attributes++]);
+        *a = *attr;
+        a->next = NULL;
+        *attr_tail = a;
+        attr_tail = &(a->next);
+    }
+    for ( summary = node->summaries; summary; summary = summary->next )
+    {
+        GhtSummary *s = &(arena->summaries[arena->num_summaries++]);
+        *s = *summary;
+        s->next = NULL;
+        *summary_tail = s;
+        summary_tail = &(s->next);
+    }
+    if ( node->sample )
+        n->sample = ght_arena_copy(node->sample, arena);
+    if ( node->children && node->children->num_nodes > 0 )
+    {
+        GhtNodeList *nl = &(arena->lists[arena->num_lists++]);
+        nl->num_nodes = nl->max_nodes = node->children->num_nodes;
+        nl->nodes = &(arena->children[arena->num_children]);
+        arena->num_children += nl->num_nodes;
+        n->children = nl;
+        for ( i = 0; i < nl->num_nodes; i++ )
+            nl->nodes[i] = ght_arena_copy(node->children->nodes[i], arena);
+    }
+    return n;
+}
+
+/**
+* Move the nodes of a tree into a single block of memory, laid out
+* depth first so traversals touch memory in order. A frozen tree can
+* no longer be changed, and every read-only operation on it is safe
+* from any number of threads at once.
+*/
+GhtErr
+ght_tree_freeze(GhtTree *tree)
+{
+    GhtArena count, arena;
+    size_t sizes[6], offsets[6], total = 0;
+    uint8_t *block;
+    GhtContext *context;
+    int i;
+
+    if ( ! tree )
+        return GHT_ERROR;
+    if ( tree->frozen || ! tree->root )
+    {
+        tree->frozen = 1;
+        return GHT_OK;
+    }
+
+    memset(&count, 0, sizeof(GhtArena));
+    ght_arena_count(tree->root, &count);
+
+    /* Widest alignments first, the hash characters at the end */
+    sizes[0] = count.num_nodes * sizeof(GhtNode);
+    sizes[1] = count.num_lists * sizeof(GhtNodeList);
+    sizes[2] = count.num_children * sizeof(GhtNode*);
+    sizes[3] = count.num_attributes * sizeof(GhtAttribute);
+    sizes[4] = count.num_summaries * sizeof(GhtSummary);
+    sizes[5] = count.num_chars;
+    for ( i = 0; i < 6; i++ )
+    {
+        offsets[i] = total;
+        total += (sizes[i] + 7) & ~((size_t)7);
+    }
+
+    context = ght_context_swap(tree->context);
+    block = ght_malloc(total);
+    memset(block, 0, total);
+    memset(&arena, 0, sizeof(GhtArena));
+    arena.nodes = (GhtNode*)(block + offsets[0]);
+    arena.lists = (GhtNodeList*)(block + offsets[1]);
+    arena.children = (GhtNode**)(block + offsets[2]);
+    arena.attributes = (GhtAttribute*)(block + offsets[3]);
+    arena.summaries = (GhtSummary*)(block + offsets[4]);
+    arena.chars = (char*)(block + offsets[5]);
+    ght_arena_copy(tree->root, &arena);
+
+    ght_node_free(tree->root);
+    ght_context_swap(context);
+    tree->root = arena.nodes;
+    tree->arena = block;
+    tree->frozen = 1;
+    return GHT_OK;
+}
+
+/** Report a change attempted on a frozen tree */
+GhtErr
+ght_tree_check_mutable(const GhtTree *tree, const char *func)
+{
+    if ( tree->frozen )
+    {
+        ght_error("%s: tree is frozen and cannot be changed", func);
+        return GHT_ERROR;
+    }
+    return GHT_OK;
+}
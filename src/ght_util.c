@@ -9,6 +9,7 @@
 ******************************************************************************/
 
 #include "ght_internal.h"
+#include <time.h>
 
 int fexists(const char *filename); /* ght_util.c */
 char machine_endian(void); /* ght_util.c */
@@ -159,6 +160,7 @@ ght_config_init(GhtConfig *config)
     //     unsigned char  max_hash_length;
     //     unsigned char  version;
     //     unsigned char  endian;
+    //     unsigned char  summaries;
     // } GhtConfig;
     memset(config, 0, sizeof(GhtConfig));
     config->allow_duplicates = GHT_DUPES_YES;
@@ -168,4 +170,51 @@ ght_config_init(GhtConfig *config)
     return GHT_OK;
 }
 
+#ifdef GHT_ENABLE_STATS
+
+#ifdef HAVE_TLS
+__thread GhtStats ght_stats;
+#else
+GhtStats ght_stats;
+#endif
+
+double
+ght_stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+GhtErr
+ght_stats_get(GhtStats *stats)
+{
+    *stats = ght_stats;
+    return GHT_OK;
+}
+
+GhtErr
+ght_stats_reset(void)
+{
+    memset(&ght_stats, 0, sizeof(GhtStats));
+    return GHT_OK;
+}
+
+#else
+
+GhtErr
+ght_stats_get(GhtStats *stats)
+{
+    memset(stats, 0, sizeof(GhtStats));
+    return GHT_ERROR;
+}
+
+GhtErr
+ght_stats_reset(void)
+{
+    return GHT_ERROR;
+}
+
+#endif
+
 
@@ -10,6 +10,7 @@
 
 #include "CUnit/Basic.h"
 #include "cu_tester.h"
+#include "ght_mem.h"
 
 /* GLOBALS ************************************************************/
 
@@ -301,6 +302,18 @@ test_ght_node_build_tree(void)
     /* also, it's hanging off the parent node */
     CU_ASSERT_EQUAL(node3->children->nodes[2], node5);
 
+    /* Every node knows how many points are under it */
+    CU_ASSERT_EQUAL(root->num_leaves, 6);
+    CU_ASSERT_EQUAL(root->children->nodes[0]->num_leaves, 5);
+    CU_ASSERT_EQUAL(node3->num_leaves, 3);
+
+    /* and dropped duplicates are not counted */
+    err = ght_node_new_from_hash("c0v2hdm1wpzpy4vkv4", &node5);
+    err = ght_node_insert_node(root, node5, GHT_DUPES_NO);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(root->num_leaves, 6);
+    ght_node_free(node5);
+
     // stringbuffer_t *sb = ght_stringbuffer_create();
     // err = ght_node_to_string(root, sb, 0);
     // printf("\n%s\n", ght_stringbuffer_getstring(sb));
@@ -333,6 +346,38 @@ test_ght_node_unbuild_tree(void)
     ght_node_free(root);
 }
 
+static void
+test_ght_nodelist_append(void)
+{
+    int i;
+    GhtNodeList *nodelist;
+    GhtNode *nodes[12];
+    GhtHash h[2] = "a";
+
+    for ( i = 0; i < 12; i++ )
+    {
+        h[0] = 'a' + i;
+        ght_node_new_from_hash(h, &(nodes[i]));
+    }
+
+    ght_nodelist_new(0, &nodelist);
+    CU_ASSERT_EQUAL(ght_nodelist_reserve(nodelist, 3), GHT_OK);
+    CU_ASSERT_EQUAL(nodelist->max_nodes, 3);
+    CU_ASSERT_EQUAL(ght_nodelist_add_nodes(nodelist, nodes, 3), GHT_OK);
+    CU_ASSERT_EQUAL(nodelist->max_nodes, 3);
+    ght_nodelist_add_node(nodelist, nodes[3]);
+    CU_ASSERT_EQUAL(ght_nodelist_add_nodes(nodelist, nodes + 4, 8), GHT_OK);
+    CU_ASSERT_EQUAL(nodelist->num_nodes, 12);
+    CU_ASSERT(nodelist->max_nodes >= 12);
+    for ( i = 0; i < 12; i++ )
+        CU_ASSERT_PTR_EQUAL(nodelist->nodes[i], nodes[i]);
+
+    /* Reserving less than is there changes nothing */
+    CU_ASSERT_EQUAL(ght_nodelist_reserve(nodelist, 1), GHT_OK);
+    CU_ASSERT_EQUAL(nodelist->num_nodes, 12);
+    ght_nodelist_free_deep(nodelist);
+}
+
 
 static void
 test_ght_node_build_tree_big(void)
@@ -525,6 +570,114 @@ test_ght_node_file_serialization(void)
     
 }
 
+/* Allocations made through the counting context, and not yet freed, */
+/* kept atomically since knn workers allocate from several threads */
+static int counted_blocks = 0;
+static GhtContext *counted_context = NULL;
+static int counted_misses = 0;
+
+static void *
+counting_allocator(size_t size)
+{
+    __sync_fetch_and_add(&counted_blocks, 1);
+    return malloc(size);
+}
+
+static void *
+counting_reallocator(void *mem, size_t size)
+{
+    if ( ! mem )
+        __sync_fetch_and_add(&counted_blocks, 1);
+    return realloc(mem, size);
+}
+
+static void
+counting_deallocator(void *mem)
+{
+    __sync_fetch_and_sub(&counted_blocks, 1);
+    free(mem);
+}
+
+/* Note any knn callback that runs outside the counting context */
+static GhtErr
+counting_knn_callback(int point, const GhtCoordinate *coord, int num_neighbours,
+                      const int *neighbours, const double *distances, void *data)
+{
+    if ( ght_context_get_current() != counted_context )
+        __sync_fetch_and_add(&counted_misses, 1);
+    return GHT_OK;
+}
+
+static void
+test_ght_context(void)
+{
+    GhtContext *ctx;
+    GhtTree *tree, *treeread;
+    GhtWriter *writer;
+    GhtReader *reader;
+    GhtCoordinate coord;
+    size_t size;
+    uint8_t *bytes;
+    GhtErr err;
+    int i, blocks;
+
+    err = ght_context_new(counting_allocator, counting_reallocator, counting_deallocator, NULL, NULL, NULL, &ctx);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(counted_blocks, 1);
+
+    /* Everything made while the context is current comes from it */
+    ght_context_set_current(ctx);
+    ght_tree_new(schema, &tree);
+    for ( i = 0; i < 20; i++ )
+    {
+        GhtNode *node;
+        coord.x = -126.4 + i * 0.001;
+        coord.y = 45.12 + i * 0.002;
+        ght_node_new_from_coordinate(&coord, GHT_MAX_HASH_LENGTH, &node);
+        ght_tree_insert_node(tree, node);
+    }
+    ght_writer_new_mem(&writer);
+    ght_context_set_current(NULL);
+    CU_ASSERT(counted_blocks > 20);
+
+    /* and goes back to it, whichever context is current at the time */
+    ght_tree_set_summaries(tree, 1);
+    ght_tree_build_lod(tree, GHT_SAMPLE_CENTROID);
+    ght_tree_write(tree, writer);
+
+    /* even from the knn worker threads */
+    counted_context = ctx;
+    counted_misses = 0;
+    blocks = counted_blocks;
+    err = ght_tree_knn_all(tree, 3, 4, counting_knn_callback, NULL);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(counted_misses, 0);
+    CU_ASSERT_EQUAL(counted_blocks, blocks);
+    CU_ASSERT_EQUAL(ght_context_get_current(), NULL);
+
+    ght_tree_free(tree);
+    ght_writer_get_size(writer, &size);
+    bytes = ght_malloc(size);
+    ght_writer_get_bytes(writer, bytes);
+    ght_writer_free(writer);
+    CU_ASSERT_EQUAL(counted_blocks, 1);
+
+    /* Trees read take the context of their reader */
+    ght_context_set_current(ctx);
+    ght_reader_new_mem(bytes, size, schema, &reader);
+    ght_context_set_current(NULL);
+    err = ght_tree_read(reader, &treeread);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT(counted_blocks > 20);
+    ght_reader_free(reader);
+    ght_tree_free(treeread);
+    ght_free(bytes);
+    CU_ASSERT_EQUAL(counted_blocks, 1);
+
+    ght_context_free(ctx);
+    CU_ASSERT_EQUAL(counted_blocks, 0);
+}
+
 /* REGISTER ***********************************************************/
 
 CU_TestInfo core_tests[] =
@@ -534,9 +687,11 @@ CU_TestInfo core_tests[] =
     GHT_TEST(test_ght_hash_leaf_parts),
     GHT_TEST(test_ght_node_build_tree),
     GHT_TEST(test_ght_node_unbuild_tree),
+    GHT_TEST(test_ght_nodelist_append),
     GHT_TEST(test_ght_node_build_tree_big),
     GHT_TEST(test_ght_node_serialization),
     GHT_TEST(test_ght_node_file_serialization),
+    GHT_TEST(test_ght_context),
     CU_TEST_INFO_NULL
 };
 
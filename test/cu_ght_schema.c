@@ -64,7 +64,54 @@ test_schema_xml()
     ght_schema_free(myschema);
 }
 
+static void
+test_schema_binary()
+{
+    char *mystr, *str;
+    GhtErr result;
+    GhtSchema *myschema = NULL;
+    const GhtSchema *interned1, *interned2;
+    GhtWriter *writer;
+    GhtReader *reader;
+    uint8_t *bytes;
+    size_t bytes_size, schema_size;
+    uint64_t hash1, hash2;
+
+    ght_writer_new_mem(&writer);
+    result = ght_schema_write(schema, writer);
+    CU_ASSERT_EQUAL(result, GHT_OK);
+    ght_writer_get_size(writer, &bytes_size);
+    bytes = ght_malloc(bytes_size);
+    ght_writer_get_bytes(writer, bytes);
+    ght_writer_free(writer);
+
+    /* Binary form round-trips to the same XML */
+    ght_reader_new_mem(bytes, bytes_size, NULL, &reader);
+    result = ght_schema_read(reader, &myschema);
+    CU_ASSERT_EQUAL(result, GHT_OK);
+    ght_schema_to_xml_str(schema, &str, &schema_size);
+    ght_schema_to_xml_str(myschema, &mystr, &schema_size);
+    CU_ASSERT_STRING_EQUAL(str, mystr);
+    ght_free(str);
+    ght_free(mystr);
+    ght_schema_hash(schema, &hash1);
+    ght_schema_hash(myschema, &hash2);
+    CU_ASSERT_EQUAL(hash1, hash2);
 
+    /* Second read is swapped for the cached copy of the first */
+    result = ght_schema_intern(myschema, &interned1);
+    CU_ASSERT_EQUAL(result, GHT_OK);
+    CU_ASSERT_PTR_EQUAL(interned1, myschema);
+    ght_reader_free(reader);
+    ght_reader_new_mem(bytes, bytes_size, NULL, &reader);
+    result = ght_schema_read_interned(reader, &interned2);
+    CU_ASSERT_EQUAL(result, GHT_OK);
+    CU_ASSERT_PTR_EQUAL(interned1, interned2);
+
+    ght_reader_free(reader);
+    ght_free(bytes);
+    ght_schema_cache_clear();
+}
 
 static void
 test_schema_size()
@@ -80,6 +127,7 @@ test_schema_size()
 CU_TestInfo schema_tests[] =
 {
     GHT_TEST(test_schema_xml),
+    GHT_TEST(test_schema_binary),
     CU_TEST_INFO_NULL
 };
 
@@ -10,6 +10,8 @@
 
 #include "CUnit/Basic.h"
 #include "cu_tester.h"
+#include "ght_mem.h"
+#include <math.h>
 
 /* GLOBALS ************************************************************/
 
@@ -29,6 +31,7 @@ init_suite(void)
 static int
 clean_suite(void)
 {
+    ght_schema_cache_clear();
     if ( simpleschema )
         return ght_schema_free(simpleschema);
 
@@ -100,6 +103,14 @@ tsv_file_to_tree(const char *fname, const GhtSchema *schema)
     return tree;
 }
 
+static int
+tree_numpoints(const GhtTree *tree)
+{
+    int numpoints = -1;
+    ght_tree_get_numpoints(tree, &numpoints);
+    return numpoints;
+}
+
 static void
 test_ght_tree_extent(void)
 {
@@ -111,7 +122,7 @@ test_ght_tree_extent(void)
     
     /* Read a nodelist from a TSV file */
     tree = tsv_file_to_tree(simpledata, simpleschema);
-    CU_ASSERT_EQUAL(tree->num_nodes, 8);
+    CU_ASSERT_EQUAL(tree_numpoints(tree), 8);
     err = ght_tree_get_extent(tree, &area);
     CU_ASSERT_EQUAL(err, GHT_OK);
     // printf("%g %g, %g %g\n", area.x.min, area.y.min, area.x.max, area.y.max);
@@ -155,26 +166,1291 @@ test_ght_tree_filter(void)
     
     /* Read a nodelist from a TSV file */
     tree1 = tsv_file_to_tree(simpledata, simpleschema);
-    CU_ASSERT_EQUAL(tree1->num_nodes, 8);
+    CU_ASSERT_EQUAL(tree_numpoints(tree1), 8);
 
     err = ght_tree_filter_greater_than(tree1, "Z", 123.35, &tree2);
     CU_ASSERT_EQUAL(err, GHT_OK);
-    CU_ASSERT_EQUAL(tree2->num_nodes, 7);    
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 7);    
     ght_tree_free(tree2);
     
     err = ght_tree_filter_less_than(tree1, "Z", 123.35, &tree2);
     CU_ASSERT_EQUAL(err, GHT_OK);
-    CU_ASSERT_EQUAL(tree2->num_nodes, 1);    
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 1);    
     ght_tree_free(tree2);
 
     err = ght_tree_filter_less_than(tree1, "Z", 103.35, &tree2);
     CU_ASSERT_EQUAL(err, GHT_OK);
-    CU_ASSERT_EQUAL(tree2->num_nodes, 0);   
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 0);   
+    ght_tree_free(tree2);
+
+    /* Thresholds landing exactly on stored values */
+    err = ght_tree_filter_equal(tree1, "Z", 123.4, &tree2);
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 7);
+    ght_tree_free(tree2);
+
+    err = ght_tree_filter_less_than(tree1, "Z", 123.4, &tree2);
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 1);
+    ght_tree_free(tree2);
+
+    err = ght_tree_filter_greater_than(tree1, "Z", 123.3, &tree2);
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 7);
+    ght_tree_free(tree2);
+
+    err = ght_tree_filter_between(tree1, "Z", 123.3, 123.3, &tree2);
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 1);
+    ght_tree_free(tree2);
+
+    err = ght_tree_filter_equal(tree1, "Intensity", 5, &tree2);
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 8);
+    ght_tree_free(tree2);
+
+    err = ght_tree_filter_greater_than(tree1, "Intensity", 70000, &tree2);
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 0);
     ght_tree_free(tree2);
     
     ght_tree_free(tree1);
 }
 
+static void
+test_ght_tree_predicate(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1, *tree2;
+    GhtPredicate *predicate, *term;
+    GhtArea area;
+    GhtErr err;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    area.x.min = -126.415; area.x.max = -126.41;
+    area.y.min = 45.12; area.y.max = 45.13;
+
+    /* Z > 123.35 AND inside the area */
+    ght_predicate_new_and(&predicate);
+    ght_predicate_new_greater_than("Z", 123.35, &term);
+    ght_predicate_add(predicate, term);
+    ght_predicate_new_area(&area, &term);
+    ght_predicate_add(predicate, term);
+    err = ght_tree_filter_predicate(tree1, predicate, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 4);
+    CU_ASSERT_PTR_EQUAL(tree2->schema, tree1->schema);
+    ght_tree_free(tree2);
+    ght_predicate_free(predicate);
+
+    /* Z < 123.35 OR NOT inside the area */
+    ght_predicate_new_or(&predicate);
+    ght_predicate_new_less_than("Z", 123.35, &term);
+    ght_predicate_add(predicate, term);
+    ght_predicate_new_area(&area, &term);
+    ght_predicate_new_not(term, &term);
+    ght_predicate_add(predicate, term);
+    err = ght_tree_filter_predicate(tree1, predicate, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(tree_numpoints(tree2), 4);
+    ght_tree_free(tree2);
+
+    /* Unknown dimensions are refused */
+    ght_predicate_new_equal("NoSuchDimension", 1.0, &term);
+    ght_predicate_add(predicate, term);
+    err = ght_tree_filter_predicate(tree1, predicate, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_ERROR);
+    ght_predicate_free(predicate);
+
+    ght_tree_free(tree1);
+}
+
+typedef struct
+{
+    const GhtDimension *dim;
+    double sum;
+    int count;
+    int stop_at;
+} LeafTotal;
+
+static GhtErr
+leaf_total(const GhtLeaf *leaf, void *data)
+{
+    LeafTotal *total = data;
+    double val;
+    GhtCoordinate coord;
+
+    if ( ght_leaf_get_value(leaf, total->dim, &val) == GHT_OK )
+        total->sum += val;
+    ght_leaf_get_coordinate(leaf, &coord);
+    CU_ASSERT(coord.x < -126.41 && coord.x > -126.42);
+    total->count++;
+    return total->count == total->stop_at ? GHT_DONE : GHT_OK;
+}
+
+static void
+test_ght_tree_filter_count(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1;
+    GhtPredicate *predicate;
+    GhtDimension *dim;
+    LeafTotal total;
+    GhtErr err;
+    int count;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+
+    ght_predicate_new_greater_than("Z", 123.35, &predicate);
+    err = ght_tree_filter_count(tree1, predicate, &count);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(count, 7);
+
+    /* Visit the matching points in place */
+    ght_schema_get_dimension_by_name(simpleschema, "Z", &dim);
+    memset(&total, 0, sizeof(LeafTotal));
+    total.dim = dim;
+    err = ght_tree_filter_foreach(tree1, predicate, leaf_total, &total);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(total.count, 7);
+    CU_ASSERT_DOUBLE_EQUAL(total.sum, 7 * 123.4, 0.0001);
+
+    /* All points, stopping after three */
+    memset(&total, 0, sizeof(LeafTotal));
+    total.dim = dim;
+    total.stop_at = 3;
+    err = ght_tree_filter_foreach(tree1, NULL, leaf_total, &total);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(total.count, 3);
+
+    ght_predicate_free(predicate);
+    ght_tree_free(tree1);
+}
+
+/* Half the points carry Z, the others leave it out */
+static GhtTree *
+partial_tree(int summaries)
+{
+    GhtTree *tree;
+    int i;
+
+    ght_tree_new(simpleschema, &tree);
+    ght_tree_set_summaries(tree, summaries);
+    for ( i = 0; i < 20; i++ )
+    {
+        GhtCoordinate coord;
+        GhtNode *node;
+        coord.x = -126.4 + i * 0.0001;
+        coord.y = 45.12 + i * 0.0001;
+        ght_node_new_from_coordinate(&coord, 16, &node);
+        if ( i % 2 )
+        {
+            GhtAttribute *attr;
+            ght_attribute_new_from_double(simpleschema->dims[2], 10.0 + i, &attr);
+            ght_node_add_attribute(node, attr);
+        }
+        ght_tree_insert_node(tree, node);
+    }
+    return tree;
+}
+
+static void
+test_ght_tree_filter_partial(void)
+{
+    GhtTree *trees[4];
+    GhtPredicate *predicate;
+    GhtWriter *writer;
+    GhtReader *reader;
+    int i, count;
+
+    /* No summaries, summaries kept while inserting, added after, and read back */
+    trees[0] = partial_tree(0);
+    trees[1] = partial_tree(1);
+    trees[2] = partial_tree(0);
+    ght_tree_set_summaries(trees[2], 1);
+    ght_writer_new_mem(&writer);
+    ght_tree_write(trees[1], writer);
+    ght_reader_new_mem(bytebuffer_getbytes(writer->bytebuffer), bytebuffer_getsize(writer->bytebuffer), simpleschema, &reader);
+    ght_tree_read(reader, &(trees[3]));
+    ght_reader_free(reader);
+    ght_writer_free(writer);
+
+    /* Every Z is out of range, so just the points without one pass */
+    ght_predicate_new_greater_than("Z", 100.0, &predicate);
+    for ( i = 0; i < 4; i++ )
+    {
+        CU_ASSERT_EQUAL(ght_tree_filter_count(trees[i], predicate, &count), GHT_OK);
+        CU_ASSERT_EQUAL(count, 10);
+    }
+    ght_predicate_free(predicate);
+
+    /* and when every point is in range, they all pass */
+    ght_predicate_new_less_than("Z", 100.0, &predicate);
+    for ( i = 0; i < 4; i++ )
+    {
+        CU_ASSERT_EQUAL(ght_tree_filter_count(trees[i], predicate, &count), GHT_OK);
+        CU_ASSERT_EQUAL(count, 20);
+        ght_tree_free(trees[i]);
+    }
+    ght_predicate_free(predicate);
+}
+
+static double
+node_distance2(GhtNode *node, const GhtCoordinate *pt)
+{
+    GhtCoordinate coord;
+    ght_node_get_coordinate(node, &coord);
+    return (coord.x - pt->x)*(coord.x - pt->x) + (coord.y - pt->y)*(coord.y - pt->y);
+}
+
+static void
+test_ght_tree_knn(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1;
+    GhtNodeList *all, *nearest;
+    GhtCoordinate pt;
+    GhtErr err;
+    int i, j, num_nodes, closer;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    ght_nodelist_new(8, &all);
+    ght_tree_to_nodelist(tree1, all);
+
+    /* The three nearest, in order, with nothing else closer */
+    pt.x = -126.4163; pt.y = 45.1232;
+    ght_nodelist_new(8, &nearest);
+    err = ght_tree_knn(tree1, &pt, 3, nearest);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(nearest->num_nodes, 3);
+    CU_ASSERT(nearest->nodes[0]->attributes != NULL);
+    for ( i = 1; i < nearest->num_nodes; i++ )
+        CU_ASSERT(node_distance2(nearest->nodes[i-1], &pt) <= node_distance2(nearest->nodes[i], &pt));
+    closer = 0;
+    for ( j = 0; j < all->num_nodes; j++ )
+        if ( node_distance2(all->nodes[j], &pt) < node_distance2(nearest->nodes[2], &pt) )
+            closer++;
+    CU_ASSERT_EQUAL(closer, 2);
+    ght_nodelist_free_deep(nearest);
+
+    /* Asking for more than there are returns everything */
+    ght_nodelist_new(8, &nearest);
+    err = ght_tree_knn(tree1, &pt, 20, nearest);
+    CU_ASSERT_EQUAL(nearest->num_nodes, 8);
+    ght_nodelist_free_deep(nearest);
+
+    /* Radius search agrees with brute force */
+    ght_nodelist_new(8, &nearest);
+    err = ght_tree_within_distance(tree1, &pt, 0.003, nearest);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    num_nodes = 0;
+    for ( j = 0; j < all->num_nodes; j++ )
+        if ( node_distance2(all->nodes[j], &pt) <= 0.003*0.003 )
+            num_nodes++;
+    CU_ASSERT_EQUAL(nearest->num_nodes, num_nodes);
+    CU_ASSERT(num_nodes > 1 && num_nodes < 8);
+    ght_nodelist_free_deep(nearest);
+
+    ght_nodelist_free_deep(all);
+    ght_tree_free(tree1);
+}
+
+/* Written per point, so workers never share a counter */
+typedef struct
+{
+    GhtNodeList *all;
+    int k;
+    int calls[8];
+    int mismatches[8];
+} KnnCheck;
+
+static GhtErr
+knn_check(int point, const GhtCoordinate *coord, int num_neighbours, const int *neighbours, const double *distances, void *data)
+{
+    KnnCheck *check = data;
+    int i, closer = 0;
+
+    check->calls[point]++;
+    if ( num_neighbours != check->k )
+        check->mismatches[point]++;
+    for ( i = 0; i < num_neighbours; i++ )
+    {
+        double d = sqrt(node_distance2(check->all->nodes[neighbours[i]], coord));
+        if ( fabs(d - distances[i]) > 1e-9 || neighbours[i] == point )
+            check->mismatches[point]++;
+        if ( i > 0 && distances[i] < distances[i-1] )
+            check->mismatches[point]++;
+    }
+    /* Nothing but the neighbours may be closer than the furthest one */
+    for ( i = 0; i < check->all->num_nodes; i++ )
+    {
+        if ( i != point && sqrt(node_distance2(check->all->nodes[i], coord)) < distances[num_neighbours-1] )
+            closer++;
+    }
+    if ( closer > num_neighbours - 1 )
+        check->mismatches[point]++;
+    return GHT_OK;
+}
+
+static void
+test_ght_tree_knn_all(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1;
+    KnnCheck check;
+    GhtErr err;
+    int i, threads;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    memset(&check, 0, sizeof(KnnCheck));
+    ght_nodelist_new(8, &(check.all));
+    ght_tree_to_nodelist(tree1, check.all);
+    check.k = 3;
+
+    /* Same answers serially and shared between workers */
+    for ( threads = 1; threads <= 4; threads += 3 )
+    {
+        memset(check.calls, 0, sizeof(check.calls));
+        err = ght_tree_knn_all(tree1, 3, threads, knn_check, &check);
+        CU_ASSERT_EQUAL(err, GHT_OK);
+        for ( i = 0; i < 8; i++ )
+        {
+            CU_ASSERT_EQUAL(check.calls[i], 1);
+            CU_ASSERT_EQUAL(check.mismatches[i], 0);
+        }
+    }
+
+    ght_nodelist_free_deep(check.all);
+    ght_tree_free(tree1);
+}
+
+static void
+test_ght_tree_sample(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1;
+    GhtNodeList *sample, *cached;
+    GhtAttribute *attr;
+    GhtNode *node;
+    GhtCoordinate coord;
+    GhtErr err;
+    double val;
+    int i, j;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+
+    /* One cell holds everything, its average Z is the mean of all points */
+    ght_nodelist_new(8, &sample);
+    err = ght_tree_sample(tree1, 0, GHT_SAMPLE_AVERAGE, sample);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(sample->num_nodes, 1);
+    ght_node_get_attributes(sample->nodes[0], &attr);
+    ght_attribute_get_value(attr, &val);
+    CU_ASSERT_DOUBLE_EQUAL(val, (7*123.4 + 123.3)/8, 0.01);
+    ght_nodelist_free_deep(sample);
+
+    /* Cells finer than the points give back every point */
+    ght_nodelist_new(8, &sample);
+    err = ght_tree_sample(tree1, GHT_MAX_HASH_LENGTH, GHT_SAMPLE_FIRST, sample);
+    CU_ASSERT_EQUAL(sample->num_nodes, 8);
+    ght_nodelist_free_deep(sample);
+
+    /* Cached representatives agree with the ones made on the fly */
+    err = ght_tree_build_lod(tree1, GHT_SAMPLE_CENTROID);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    coord.x = -126.41; coord.y = 45.12;
+    ght_node_new_from_coordinate(&coord, 16, &node);
+    ght_attribute_new_from_double(simpleschema->dims[2], 100.0, &attr);
+    ght_node_add_attribute(node, attr);
+    ght_tree_insert_node(tree1, node);
+
+    /* Only the nodes the new point went through lose their representative */
+    for ( i = 0, j = 0; i < tree1->root->children->num_nodes; i++ )
+    {
+        if ( tree1->root->children->nodes[i]->sample )
+            j++;
+    }
+    CU_ASSERT(j > 0);
+    CU_ASSERT_PTR_NULL(tree1->root->sample);
+
+    for ( i = 0; i <= 8; i++ )
+    {
+        ght_nodelist_new(8, &sample);
+        ght_nodelist_new(8, &cached);
+        ght_tree_sample(tree1, i, GHT_SAMPLE_CENTROID, cached);
+        tree1->lod = 0;
+        ght_tree_sample(tree1, i, GHT_SAMPLE_CENTROID, sample);
+        tree1->lod = 1;
+        CU_ASSERT_EQUAL(sample->num_nodes, cached->num_nodes);
+        for ( j = 0; j < sample->num_nodes && j < cached->num_nodes; j++ )
+        {
+            CU_ASSERT_STRING_EQUAL(sample->nodes[j]->hash, cached->nodes[j]->hash);
+        }
+        ght_nodelist_free_deep(sample);
+        ght_nodelist_free_deep(cached);
+    }
+
+    ght_tree_free(tree1);
+}
+
+static GhtErr
+stats_group_count(const GhtHash *prefix, int num_dims, const GhtAttributeStats *stats, void *data)
+{
+    int *counts = (int*)data;
+    counts[0] += 1;
+    counts[1] += stats[2].count;
+    return GHT_OK;
+}
+
+static void
+test_ght_tree_stats(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1;
+    GhtAttributeStats stats[4];
+    int bins[2];
+    int counts[2];
+    GhtErr err;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+
+    /* Z is compacted onto the interior nodes, and still weighs every point */
+    memset(stats, 0, sizeof(stats));
+    stats[2].range.min = 123.25;
+    stats[2].range.max = 123.45;
+    stats[2].num_bins = 2;
+    stats[2].bins = bins;
+    err = ght_tree_get_stats(tree1, stats);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(stats[0].count, 8);
+    CU_ASSERT_DOUBLE_EQUAL(stats[0].min, -126.41912, 0.0001);
+    CU_ASSERT_EQUAL(stats[2].count, 8);
+    CU_ASSERT_DOUBLE_EQUAL(stats[2].min, 123.3, 0.0001);
+    CU_ASSERT_DOUBLE_EQUAL(stats[2].max, 123.4, 0.0001);
+    CU_ASSERT_DOUBLE_EQUAL(stats[2].sum, 7*123.4 + 123.3, 0.0001);
+    CU_ASSERT_EQUAL(bins[0], 1);
+    CU_ASSERT_EQUAL(bins[1], 7);
+    CU_ASSERT_EQUAL(stats[3].count, 8);
+    CU_ASSERT_DOUBLE_EQUAL(stats[3].sum, 40, 0.0001);
+
+    /* Groups split the points between them */
+    memset(counts, 0, sizeof(counts));
+    err = ght_tree_get_stats_by_prefix(tree1, 0, stats, stats_group_count, counts);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(counts[0], 1);
+    CU_ASSERT_EQUAL(counts[1], 8);
+    memset(counts, 0, sizeof(counts));
+    err = ght_tree_get_stats_by_prefix(tree1, GHT_MAX_HASH_LENGTH, stats, stats_group_count, counts);
+    CU_ASSERT_EQUAL(counts[0], 8);
+    CU_ASSERT_EQUAL(counts[1], 8);
+
+    ght_tree_free(tree1);
+}
+
+static void
+test_ght_tree_rasterize(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    static const GhtAggregate aggs[] = { GHT_AGG_COUNT, GHT_AGG_SUM, GHT_AGG_MAX, GHT_AGG_MEAN };
+    GhtTree *tree1, *tree2;
+    GhtNodeList *all;
+    GhtArea extent;
+    double out[9], expected[9], counts[9];
+    int a, i, n, nx = 3, ny = 3;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    ght_tree_set_summaries(tree1, 1);
+    ght_nodelist_new(8, &all);
+    ght_tree_to_nodelist(tree1, all);
+    ght_tree_get_extent(tree1, &extent);
+    extent.x.max += 0.0001;
+    extent.y.min -= 0.0001;
+
+    /* Pixel by pixel, the grid agrees with binning every point */
+    for ( a = 0; a < 4; a++ )
+    {
+        CU_ASSERT_EQUAL(ght_tree_rasterize(tree1, &extent, nx, ny, "Z", aggs[a], out), GHT_OK);
+        memset(expected, 0, sizeof(expected));
+        memset(counts, 0, sizeof(counts));
+        for ( n = 0; n < all->num_nodes; n++ )
+        {
+            GhtCoordinate coord;
+            double z;
+            int ix, iy, p;
+            ght_node_get_coordinate(all->nodes[n], &coord);
+            ght_attribute_get_value(all->nodes[n]->attributes, &z);
+            ix = floor((coord.x - extent.x.min) / (extent.x.max - extent.x.min) * nx);
+            iy = floor((extent.y.max - coord.y) / (extent.y.max - extent.y.min) * ny);
+            p = iy * nx + ix;
+            if ( aggs[a] == GHT_AGG_COUNT ) expected[p] += 1;
+            else if ( aggs[a] == GHT_AGG_MAX ) expected[p] = counts[p] && expected[p] > z ? expected[p] : z;
+            else expected[p] += z;
+            counts[p] += 1;
+        }
+        for ( i = 0; i < nx * ny; i++ )
+        {
+            if ( ! counts[i] && aggs[a] != GHT_AGG_COUNT && aggs[a] != GHT_AGG_SUM )
+            {
+                CU_ASSERT(isnan(out[i]));
+                continue;
+            }
+            if ( aggs[a] == GHT_AGG_MEAN )
+                expected[i] /= counts[i];
+            CU_ASSERT_DOUBLE_EQUAL(out[i], expected[i], 0.0001);
+        }
+    }
+
+    /* One pixel around the root cell takes the whole tree in bulk */
+    ght_area_from_hash(tree1->root->hash, &extent);
+    extent.x.min -= 1; extent.x.max += 1;
+    extent.y.min -= 1; extent.y.max += 1;
+    ght_tree_rasterize(tree1, &extent, 1, 1, NULL, GHT_AGG_COUNT, out);
+    CU_ASSERT_DOUBLE_EQUAL(out[0], 8, 0.0001);
+    ght_tree_rasterize(tree1, &extent, 1, 1, "Z", GHT_AGG_MIN, out);
+    CU_ASSERT_DOUBLE_EQUAL(out[0], 123.3, 0.0001);
+    ght_tree_rasterize(tree1, &extent, 1, 1, "Z", GHT_AGG_MEAN, out);
+    CU_ASSERT_DOUBLE_EQUAL(out[0], (7*123.4 + 123.3)/8, 0.0001);
+    ght_tree_rasterize(tree1, &extent, 1, 1, "Intensity", GHT_AGG_SUM, out);
+    CU_ASSERT_DOUBLE_EQUAL(out[0], 40, 0.0001);
+
+    /* Without summaries the extremes come from the points themselves */
+    tree2 = tsv_file_to_tree(simpledata, simpleschema);
+    CU_ASSERT_EQUAL(ght_tree_rasterize(tree2, &extent, 1, 1, "Z", GHT_AGG_MIN, out), GHT_OK);
+    CU_ASSERT_DOUBLE_EQUAL(out[0], 123.3, 0.0001);
+    CU_ASSERT_EQUAL(ght_tree_rasterize(tree2, &extent, 1, 1, "Z", GHT_AGG_MAX, out), GHT_OK);
+    CU_ASSERT_DOUBLE_EQUAL(out[0], 123.4, 0.0001);
+
+    ght_nodelist_free_deep(all);
+    ght_tree_free(tree1);
+    ght_tree_free(tree2);
+}
+
+static int frozen_errors = 0;
+
+static void
+count_error_handler(const char *fmt, va_list ap)
+{
+    frozen_errors++;
+}
+
+static void
+test_ght_tree_freeze(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1;
+    GhtContext *ctx;
+    GhtWriter *writer;
+    GhtNode *node;
+    GhtCoordinate coord;
+    size_t size_before, size_after;
+    uint8_t bytes_before[1024], bytes_after[1024];
+    GhtArea extent_before, extent_after;
+    int count = 0;
+    GhtErr err;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    ght_tree_set_summaries(tree1, 1);
+    ght_tree_get_extent(tree1, &extent_before);
+    ght_writer_new_mem(&writer);
+    ght_tree_write(tree1, writer);
+    ght_writer_get_size(writer, &size_before);
+    ght_writer_get_bytes(writer, bytes_before);
+    ght_writer_free(writer);
+
+    /* Nothing changes for readers */
+    err = ght_tree_freeze(tree1);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    ght_tree_get_extent(tree1, &extent_after);
+    CU_ASSERT_DOUBLE_EQUAL(extent_before.x.min, extent_after.x.min, 0.0000001);
+    CU_ASSERT_DOUBLE_EQUAL(extent_before.y.max, extent_after.y.max, 0.0000001);
+    ght_tree_filter_count(tree1, NULL, &count);
+    CU_ASSERT_EQUAL(count, 8);
+    ght_writer_new_mem(&writer);
+    ght_tree_write(tree1, writer);
+    ght_writer_get_size(writer, &size_after);
+    ght_writer_get_bytes(writer, bytes_after);
+    ght_writer_free(writer);
+    CU_ASSERT_EQUAL(size_before, size_after);
+    CU_ASSERT_EQUAL(memcmp(bytes_before, bytes_after, size_after), 0);
+
+    /* but writers are turned away */
+    ght_context_new(NULL, NULL, NULL, count_error_handler, NULL, NULL, &ctx);
+    ght_context_set_current(ctx);
+    coord.x = -126.41; coord.y = 45.12;
+    ght_node_new_from_coordinate(&coord, 16, &node);
+    err = ght_tree_insert_node(tree1, node);
+    CU_ASSERT_EQUAL(err, GHT_ERROR);
+    err = ght_tree_compact_attributes(tree1);
+    CU_ASSERT_EQUAL(err, GHT_ERROR);
+    CU_ASSERT_EQUAL(frozen_errors, 2);
+    ght_node_free(node);
+    ght_context_set_current(NULL);
+    ght_context_free(ctx);
+
+    ght_tree_free(tree1);
+}
+
+static void
+test_ght_tree_packed(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1, *tree2;
+    GhtPackedTree *packed;
+    GhtPredicate *predicate;
+    GhtDimension *dim;
+    GhtWriter *writer;
+    LeafTotal total1, total2;
+    size_t size1, size2;
+    uint8_t bytes1[1024], bytes2[1024];
+    GhtArea extent1, extent2;
+    int count1, count2;
+    GhtErr err;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    ght_tree_set_summaries(tree1, 1);
+    err = ght_packed_tree_from_tree(tree1, &packed);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+
+    /* Same answers as the tree it came from */
+    ght_tree_get_numpoints(tree1, &count1);
+    ght_packed_tree_get_numpoints(packed, &count2);
+    CU_ASSERT_EQUAL(count1, count2);
+    ght_tree_get_extent(tree1, &extent1);
+    ght_packed_tree_get_extent(packed, &extent2);
+    CU_ASSERT_DOUBLE_EQUAL(extent1.x.min, extent2.x.min, 0.0000001);
+    CU_ASSERT_DOUBLE_EQUAL(extent1.x.max, extent2.x.max, 0.0000001);
+    CU_ASSERT_DOUBLE_EQUAL(extent1.y.min, extent2.y.min, 0.0000001);
+    CU_ASSERT_DOUBLE_EQUAL(extent1.y.max, extent2.y.max, 0.0000001);
+
+    ght_predicate_new_greater_than("Z", 123.35, &predicate);
+    err = ght_packed_tree_filter_count(packed, predicate, &count2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(count2, 7);
+    ght_packed_tree_filter_count(packed, NULL, &count2);
+    CU_ASSERT_EQUAL(count1, count2);
+
+    ght_schema_get_dimension_by_name(simpleschema, "Z", &dim);
+    memset(&total1, 0, sizeof(LeafTotal));
+    memset(&total2, 0, sizeof(LeafTotal));
+    total1.dim = total2.dim = dim;
+    ght_tree_filter_foreach(tree1, predicate, leaf_total, &total1);
+    err = ght_packed_tree_filter_foreach(packed, predicate, leaf_total, &total2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(total2.count, 7);
+    CU_ASSERT_DOUBLE_EQUAL(total1.sum, total2.sum, 0.0000001);
+    ght_predicate_free(predicate);
+
+    /* Written out byte for byte the same */
+    ght_writer_new_mem(&writer);
+    ght_tree_write(tree1, writer);
+    ght_writer_get_size(writer, &size1);
+    ght_writer_get_bytes(writer, bytes1);
+    ght_writer_free(writer);
+    ght_writer_new_mem(&writer);
+    err = ght_packed_tree_write(packed, writer);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    ght_writer_get_size(writer, &size2);
+    ght_writer_get_bytes(writer, bytes2);
+    ght_writer_free(writer);
+    CU_ASSERT_EQUAL(size1, size2);
+    CU_ASSERT_EQUAL(memcmp(bytes1, bytes2, size2), 0);
+
+    /* And back again */
+    err = ght_packed_tree_to_tree(packed, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    ght_tree_get_numpoints(tree2, &count2);
+    CU_ASSERT_EQUAL(count1, count2);
+    ght_writer_new_mem(&writer);
+    ght_tree_write(tree2, writer);
+    ght_writer_get_size(writer, &size2);
+    ght_writer_get_bytes(writer, bytes2);
+    ght_writer_free(writer);
+    CU_ASSERT_EQUAL(size1, size2);
+    CU_ASSERT_EQUAL(memcmp(bytes1, bytes2, size2), 0);
+
+    ght_tree_free(tree2);
+    ght_packed_tree_free(packed);
+    ght_tree_free(tree1);
+}
+
+static void
+test_ght_tree_cursor(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1;
+    GhtTreeCursor *cursor;
+    const GhtLeaf *leaf;
+    const GhtHash *hash;
+    char hashes[8][GHT_MAX_HASH_LENGTH+1];
+    int i, numpoints, rank;
+    GhtErr err;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    ght_tree_get_numpoints(tree1, &numpoints);
+    CU_ASSERT_EQUAL(numpoints, 8);
+
+    /* Every point, in hash order */
+    err = ght_tree_cursor_new(tree1, &cursor);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    for ( i = 0; ght_tree_cursor_next(cursor, &leaf) == GHT_OK; i++ )
+    {
+        ght_leaf_get_hash(leaf, &hash);
+        strcpy(hashes[i], hash);
+        if ( i > 0 )
+            CU_ASSERT(strcmp(hashes[i-1], hashes[i]) <= 0);
+        ght_tree_cursor_get_rank(cursor, &rank);
+        CU_ASSERT_EQUAL(rank, i + 1);
+    }
+    CU_ASSERT_EQUAL(i, numpoints);
+    CU_ASSERT_EQUAL(ght_tree_cursor_next(cursor, &leaf), GHT_DONE);
+
+    /* Pages of three, each starting from a seek */
+    for ( i = 0; i < numpoints; i += 3 )
+    {
+        int j = 0;
+        ght_tree_cursor_seek_rank(cursor, i);
+        while ( j < 3 && ght_tree_cursor_next(cursor, &leaf) == GHT_OK )
+        {
+            ght_leaf_get_hash(leaf, &hash);
+            CU_ASSERT_STRING_EQUAL(hash, hashes[i+j]);
+            j++;
+        }
+        CU_ASSERT_EQUAL(j, numpoints - i < 3 ? numpoints - i : 3);
+    }
+    ght_tree_cursor_seek_rank(cursor, numpoints);
+    CU_ASSERT_EQUAL(ght_tree_cursor_next(cursor, &leaf), GHT_DONE);
+
+    /* Seeking a prefix lands on the first point inside it */
+    ght_tree_cursor_seek_prefix(cursor, hashes[5]);
+    ght_tree_cursor_get_rank(cursor, &rank);
+    CU_ASSERT(rank <= 5 && strcmp(hashes[rank], hashes[5]) == 0);
+    ght_tree_cursor_next(cursor, &leaf);
+    ght_leaf_get_hash(leaf, &hash);
+    CU_ASSERT_STRING_EQUAL(hash, hashes[5]);
+
+    /* or just after where it would be */
+    ght_tree_cursor_seek_prefix(cursor, "c0n0eqn");
+    ght_tree_cursor_get_rank(cursor, &rank);
+    CU_ASSERT(rank > 0 && rank < numpoints);
+    for ( i = 0; i < numpoints; i++ )
+        CU_ASSERT_EQUAL(i < rank, strcmp(hashes[i], "c0n0eqn") < 0);
+    ght_tree_cursor_seek_prefix(cursor, "");
+    ght_tree_cursor_get_rank(cursor, &rank);
+    CU_ASSERT_EQUAL(rank, 0);
+    ght_tree_cursor_seek_prefix(cursor, "zzz");
+    CU_ASSERT_EQUAL(ght_tree_cursor_next(cursor, &leaf), GHT_DONE);
+
+    ght_tree_cursor_free(cursor);
+    ght_tree_free(tree1);
+}
+
+static void
+test_ght_tree_compact_tolerance(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1;
+    GhtDimension *dim;
+    GhtWriter *writer;
+    LeafTotal total;
+    double tolerances[4] = {0.0, 0.0, 0.05, 0.0};
+    double max_errors[4];
+    size_t size_before, size_after;
+    GhtErr err;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    ght_writer_new_mem(&writer);
+    ght_tree_write(tree1, writer);
+    ght_writer_get_size(writer, &size_before);
+    ght_writer_free(writer);
+
+    /* Z is 123.3 or 123.4, so a tight tolerance changes nothing */
+    err = ght_tree_compact_attributes_tolerance(tree1, tolerances, max_errors);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_DOUBLE_EQUAL(max_errors[2], 0.0, 0.0000001);
+
+    /* but a looser one folds it all into the root, at the midpoint */
+    tolerances[2] = 0.15;
+    err = ght_tree_compact_attributes_tolerance(tree1, tolerances, max_errors);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT(max_errors[2] > 0.04 && max_errors[2] < 0.06);
+    CU_ASSERT_DOUBLE_EQUAL(max_errors[3], 0.0, 0.0000001);
+
+    ght_schema_get_dimension_by_name(simpleschema, "Z", &dim);
+    memset(&total, 0, sizeof(LeafTotal));
+    total.dim = dim;
+    ght_tree_filter_foreach(tree1, NULL, leaf_total, &total);
+    CU_ASSERT_EQUAL(total.count, 8);
+    CU_ASSERT_DOUBLE_EQUAL(total.sum / 8, 123.35, 0.006);
+
+    ght_writer_new_mem(&writer);
+    ght_tree_write(tree1, writer);
+    ght_writer_get_size(writer, &size_after);
+    ght_writer_free(writer);
+    CU_ASSERT(size_after < size_before);
+
+    ght_tree_free(tree1);
+}
+
+static int captured_errors = 0;
+
+static void
+capture_error_handler(const char *fmt, va_list ap)
+{
+    captured_errors++;
+}
+
+static void
+test_ght_tree_blocks(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";   
+    GhtTree *tree1, *tree2;
+    GhtErr err;
+    GhtWriter *writer;
+    GhtReader *reader;
+    GhtContext *ctx;
+    GhtNode *node;
+    GhtCoordinate coord;
+    GhtArea area;
+    const uint8_t *bytes;
+    size_t bytes_size;
+    int i, num_blocks, num_leaves;
+    stringbuffer_t *sb1, *sb2;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+
+    /* Serialize it in compressed blocks */
+    err = ght_writer_new_mem(&writer);
+    err = ght_writer_set_codec(writer, GHT_CODEC_ZLIB);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    err = ght_tree_write(tree1, writer);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    bytes = bytebuffer_getbytes(writer->bytebuffer);
+    bytes_size = bytebuffer_getsize(writer->bytebuffer);
+
+    /* Only the root and index at first */
+    err = ght_reader_new_mem(bytes, bytes_size, simpleschema, &reader);
+    err = ght_tree_read_root(reader, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    err = ght_reader_get_num_blocks(reader, &num_blocks);
+    CU_ASSERT_EQUAL(num_blocks, tree1->root->children->num_nodes);
+    CU_ASSERT_EQUAL(tree2->root->children, NULL);
+
+    err = ght_reader_get_block_area(reader, tree2, 0, &area);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT(area.x.min < -126.41 && area.x.max > -126.42);
+
+    /* Pull the blocks in, out of order */
+    err = ght_tree_read_block(reader, tree2, num_blocks - 1);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    err = ght_tree_read_block(reader, tree2, 0);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+
+    /* Reading a block twice leaves one copy of it */
+    num_leaves = tree2->root->num_leaves;
+    err = ght_tree_read_block(reader, tree2, 0);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(tree2->root->children->num_nodes, 2);
+    CU_ASSERT_EQUAL(tree2->root->num_leaves, num_leaves);
+    ght_tree_free(tree2);
+    ght_reader_free(reader);
+
+    /* Full read matches the original */
+    err = ght_reader_new_mem(bytes, bytes_size, simpleschema, &reader);
+    err = ght_tree_read(reader, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    sb1 = ght_stringbuffer_create();
+    sb2 = ght_stringbuffer_create();
+    ght_node_to_string(tree1->root, sb1, 0);
+    ght_node_to_string(tree2->root, sb2, 0);
+    CU_ASSERT_STRING_EQUAL(ght_stringbuffer_getstring(sb1), ght_stringbuffer_getstring(sb2));
+    ght_stringbuffer_destroy(sb1);
+    ght_stringbuffer_destroy(sb2);
+
+    ght_reader_free(reader);
+    ght_writer_free(writer);
+    ght_tree_free(tree1);
+    ght_tree_free(tree2);
+
+    /* More duplicates of the root than the block count can hold */
+    ght_context_new(NULL, NULL, NULL, capture_error_handler, NULL, NULL, &ctx);
+    ght_context_set_current(ctx);
+    ght_tree_new(simpleschema, &tree1);
+    coord.x = -126.41; coord.y = 45.12;
+    for ( i = 0; i < 300; i++ )
+    {
+        ght_node_new_from_coordinate(&coord, 16, &node);
+        ght_tree_insert_node(tree1, node);
+    }
+    CU_ASSERT(tree1->root->children->num_nodes > 255);
+    ght_writer_new_mem(&writer);
+    ght_writer_set_codec(writer, GHT_CODEC_ZLIB);
+    err = ght_tree_write(tree1, writer);
+    CU_ASSERT_EQUAL(err, GHT_ERROR);
+    CU_ASSERT_EQUAL(captured_errors, 1);
+    ght_writer_free(writer);
+    ght_tree_free(tree1);
+    ght_context_set_current(NULL);
+    ght_context_free(ctx);
+}
+
+static void
+test_ght_tree_summaries(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";   
+    GhtTree *tree1, *tree2, *tree3;
+    GhtErr err;
+    GhtWriter *writer;
+    GhtReader *reader;
+    GhtNodeList *nodelist;
+    GhtDimension *dim;
+    const GhtSummary *summary;
+    const uint8_t *bytes;
+    size_t bytes_size;
+    GhtRange range;
+    int i, num_blocks;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    err = ght_tree_set_summaries(tree1, 1);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    ght_schema_get_dimension_by_name(simpleschema, "Z", &dim);
+    err = ght_summary_get_by_dimension(tree1->root->summaries, dim, &summary);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_DOUBLE_EQUAL(summary->min, 123.3, 0.000001);
+    CU_ASSERT_DOUBLE_EQUAL(summary->max, 123.4, 0.000001);
+
+    /* Incremental summaries match the bulk ones */
+    ght_nodelist_new(16, &nodelist);
+    ght_tree_to_nodelist(tree1, nodelist);
+    ght_tree_new(simpleschema, &tree2);
+    ght_tree_set_summaries(tree2, 1);
+    for ( i = 0; i < nodelist->num_nodes; i++ )
+    {
+        err = ght_tree_insert_node(tree2, nodelist->nodes[i]);
+        CU_ASSERT_EQUAL(err, GHT_OK);
+    }
+    ght_nodelist_free_shallow(nodelist);
+    err = ght_summary_get_by_dimension(tree2->root->summaries, dim, &summary);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_DOUBLE_EQUAL(summary->min, 123.3, 0.000001);
+    CU_ASSERT_DOUBLE_EQUAL(summary->max, 123.4, 0.000001);
+
+    /* Filters give the same answers with summaries in play */
+    err = ght_tree_filter_greater_than(tree2, "Z", 123.35, &tree3);
+    CU_ASSERT_EQUAL(tree_numpoints(tree3), 7);
+    ght_tree_free(tree3);
+    err = ght_tree_filter_between(tree2, "Z", 123.0, 124.0, &tree3);
+    CU_ASSERT_EQUAL(tree_numpoints(tree3), 8);
+    ght_tree_free(tree3);
+    err = ght_tree_filter_less_than(tree2, "Z", 103.35, &tree3);
+    CU_ASSERT_EQUAL(tree_numpoints(tree3), 0);
+    ght_tree_free(tree3);
+    ght_tree_free(tree2);
+
+    /* Summaries survive a blocked round trip, and show up in the index */
+    err = ght_writer_new_mem(&writer);
+    err = ght_writer_set_codec(writer, GHT_CODEC_ZLIB);
+    err = ght_tree_write(tree1, writer);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    bytes = bytebuffer_getbytes(writer->bytebuffer);
+    bytes_size = bytebuffer_getsize(writer->bytebuffer);
+    err = ght_reader_new_mem(bytes, bytes_size, simpleschema, &reader);
+    err = ght_tree_read(reader, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_EQUAL(tree2->config.summaries, 1);
+    err = ght_summary_get_by_dimension(tree2->root->summaries, dim, &summary);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT_DOUBLE_EQUAL(summary->min, 123.3, 0.000001);
+    ght_reader_get_num_blocks(reader, &num_blocks);
+    for ( i = 0; i < num_blocks; i++ )
+    {
+        err = ght_reader_get_block_range(reader, i, "Z", &range);
+        CU_ASSERT_EQUAL(err, GHT_OK);
+        CU_ASSERT(range.min >= 123.3 - 0.000001 && range.max <= 123.4 + 0.000001);
+    }
+    err = ght_tree_filter_greater_than(tree2, "Z", 123.35, &tree3);
+    CU_ASSERT_EQUAL(tree_numpoints(tree3), 7);
+    ght_tree_free(tree3);
+
+    ght_reader_free(reader);
+    ght_writer_free(writer);
+    ght_tree_free(tree1);
+    ght_tree_free(tree2);
+}
+
+static void
+test_ght_tree_delta(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";   
+    GhtTree *tree1, *tree2;
+    GhtErr err;
+    GhtWriter *writer;
+    GhtReader *reader;
+    const uint8_t *bytes;
+    size_t bytes_size, plain_size;
+    stringbuffer_t *sb1, *sb2;
+    GhtContext *ctx;
+    GhtCodec codec;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    sb1 = ght_stringbuffer_create();
+    ght_node_to_string(tree1->root, sb1, 0);
+
+    /* Streams without features are written as version 1 */
+    err = ght_writer_new_mem(&writer);
+    err = ght_tree_write(tree1, writer);
+    plain_size = bytebuffer_getsize(writer->bytebuffer);
+    CU_ASSERT_EQUAL(bytebuffer_getbytes(writer->bytebuffer)[1], 1);
+    ght_writer_free(writer);
+
+    /* Round trip with deltas, both plain and blocked */
+    for ( codec = GHT_CODEC_NONE; codec <= GHT_CODEC_ZLIB; codec++ )
+    {
+        err = ght_writer_new_mem(&writer);
+        err = ght_writer_set_delta(writer, 1);
+        err = ght_writer_set_codec(writer, codec);
+        err = ght_tree_write(tree1, writer);
+        CU_ASSERT_EQUAL(err, GHT_OK);
+        bytes = bytebuffer_getbytes(writer->bytebuffer);
+        bytes_size = bytebuffer_getsize(writer->bytebuffer);
+        CU_ASSERT_EQUAL(bytes[1], GHT_FORMAT_VERSION);
+        if ( codec == GHT_CODEC_NONE )
+            CU_ASSERT(bytes_size < plain_size);
+
+        err = ght_reader_new_mem(bytes, bytes_size, simpleschema, &reader);
+        err = ght_tree_read(reader, &tree2);
+        CU_ASSERT_EQUAL(err, GHT_OK);
+        sb2 = ght_stringbuffer_create();
+        ght_node_to_string(tree2->root, sb2, 0);
+        CU_ASSERT_STRING_EQUAL(ght_stringbuffer_getstring(sb1), ght_stringbuffer_getstring(sb2));
+        ght_stringbuffer_destroy(sb2);
+        ght_tree_free(tree2);
+        ght_reader_free(reader);
+
+        /* A cut short stream fails cleanly, leaving no references behind */
+        ght_context_new(NULL, NULL, NULL, capture_error_handler, NULL, NULL, &ctx);
+        ght_context_set_current(ctx);
+        err = ght_reader_new_mem(bytes, bytes_size - 4, simpleschema, &reader);
+        err = ght_tree_read(reader, &tree2);
+        CU_ASSERT_EQUAL(err, GHT_ERROR);
+        CU_ASSERT_PTR_NULL(reader->refs);
+        ght_reader_free(reader);
+        ght_context_set_current(NULL);
+        ght_context_free(ctx);
+
+        ght_writer_free(writer);
+    }
+
+    ght_stringbuffer_destroy(sb1);
+    ght_tree_free(tree1);
+}
+
+static void
+test_ght_tree_archive(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";   
+    static const char *testfile = "test.ghta";
+    GhtTree *tree1, *tree2;
+    GhtErr err;
+    GhtArchiveWriter *aw;
+    GhtArchiveReader *ar;
+    const GhtSchema *schema;
+    GhtContext *ctx;
+    GhtArea area;
+    FILE *fp;
+    char endian;
+    int num_tiles, same;
+    int *tiles;
+    stringbuffer_t *sb1, *sb2;
+
+    if ( fexists(testfile) )
+        remove(testfile);
+
+    /* Two tiles, one compressed */
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    err = ght_archive_writer_new(testfile, simpleschema, &aw);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    err = ght_archive_writer_add_tree(aw, tree1);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    err = ght_archive_writer_set_codec(aw, GHT_CODEC_ZLIB);
+    err = ght_archive_writer_add_tree(aw, tree1);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    err = ght_archive_writer_close(aw);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+
+    err = ght_archive_reader_new(testfile, &ar);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    ght_archive_get_num_tiles(ar, &num_tiles);
+    CU_ASSERT_EQUAL(num_tiles, 2);
+    ght_archive_get_schema(ar, &schema);
+    ght_schema_same(schema, simpleschema, &same);
+    CU_ASSERT_EQUAL(same, 1);
+
+    /* Area queries hit both tiles or neither */
+    area.x.min = -126.415; area.x.max = -126.414;
+    area.y.min = 45.12; area.y.max = 45.13;
+    err = ght_archive_query_area(ar, &area, &tiles, &num_tiles);
+    CU_ASSERT_EQUAL(num_tiles, 2);
+    ght_free(tiles);
+    area.x.min = 10.0; area.x.max = 11.0;
+    err = ght_archive_query_area(ar, &area, &tiles, &num_tiles);
+    CU_ASSERT_EQUAL(num_tiles, 0);
+    ght_free(tiles);
+
+    /* Tiles read back out of order match the original */
+    sb1 = ght_stringbuffer_create();
+    ght_node_to_string(tree1->root, sb1, 0);
+    err = ght_archive_read_tile(ar, 1, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    sb2 = ght_stringbuffer_create();
+    ght_node_to_string(tree2->root, sb2, 0);
+    CU_ASSERT_STRING_EQUAL(ght_stringbuffer_getstring(sb1), ght_stringbuffer_getstring(sb2));
+    ght_stringbuffer_destroy(sb2);
+    ght_tree_free(tree2);
+    err = ght_archive_read_tile(ar, 0, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    sb2 = ght_stringbuffer_create();
+    ght_node_to_string(tree2->root, sb2, 0);
+    CU_ASSERT_STRING_EQUAL(ght_stringbuffer_getstring(sb1), ght_stringbuffer_getstring(sb2));
+    ght_stringbuffer_destroy(sb2);
+    ght_tree_free(tree2);
+
+    ght_stringbuffer_destroy(sb1);
+    ght_archive_reader_free(ar);
+    ght_tree_free(tree1);
+
+    /* Damaged archives are turned away, without leaking the reader */
+    ght_context_new(NULL, NULL, NULL, capture_error_handler, NULL, NULL, &ctx);
+    ght_context_set_current(ctx);
+    fp = fopen(testfile, "r+b");
+    fseek(fp, -4, SEEK_END);
+    fwrite("XXXX", 1, 4, fp);
+    fclose(fp);
+    captured_errors = 0;
+    CU_ASSERT_EQUAL(ght_archive_reader_new(testfile, &ar), GHT_ERROR);
+    CU_ASSERT_EQUAL(captured_errors, 1);
+    /* as are ones with the other byte order */
+    fp = fopen(testfile, "r+b");
+    fseek(fp, 4, SEEK_SET);
+    endian = fgetc(fp) ? 0 : 1;
+    fseek(fp, 4, SEEK_SET);
+    fwrite(&endian, 1, 1, fp);
+    fclose(fp);
+    CU_ASSERT_EQUAL(ght_archive_reader_new(testfile, &ar), GHT_ERROR);
+    CU_ASSERT_EQUAL(captured_errors, 2);
+    ght_context_set_current(NULL);
+    ght_context_free(ctx);
+    remove(testfile);
+}
+
+static void
+test_ght_tree_embed_schema(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree1, *tree2, *tree3;
+    GhtWriter *writer;
+    GhtReader *reader;
+    GhtErr err;
+    uint8_t *bytes;
+    size_t bytes_size;
+    int same;
+    stringbuffer_t *sb1, *sb2;
+
+    tree1 = tsv_file_to_tree(simpledata, simpleschema);
+    ght_writer_new_mem(&writer);
+    ght_writer_set_embed_schema(writer, 1);
+    err = ght_tree_write(tree1, writer);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    ght_writer_get_size(writer, &bytes_size);
+    bytes = ght_malloc(bytes_size);
+    ght_writer_get_bytes(writer, bytes);
+    ght_writer_free(writer);
+
+    /* No schema needed to read, and both reads share one schema */
+    ght_reader_new_mem(bytes, bytes_size, NULL, &reader);
+    err = ght_tree_read(reader, &tree2);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    ght_reader_free(reader);
+    ght_schema_same(tree2->schema, simpleschema, &same);
+    CU_ASSERT_EQUAL(same, 1);
+    ght_reader_new_mem(bytes, bytes_size, NULL, &reader);
+    err = ght_tree_read(reader, &tree3);
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    ght_reader_free(reader);
+    CU_ASSERT_PTR_EQUAL(tree2->schema, tree3->schema);
+
+    sb1 = ght_stringbuffer_create();
+    sb2 = ght_stringbuffer_create();
+    ght_node_to_string(tree1->root, sb1, 0);
+    ght_node_to_string(tree3->root, sb2, 0);
+    CU_ASSERT_STRING_EQUAL(ght_stringbuffer_getstring(sb1), ght_stringbuffer_getstring(sb2));
+    ght_stringbuffer_destroy(sb1);
+    ght_stringbuffer_destroy(sb2);
+
+    ght_free(bytes);
+    ght_tree_free(tree1);
+    ght_tree_free(tree2);
+    ght_tree_free(tree3);
+}
+
+static void
+test_ght_tree_counters(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree;
+    GhtWriter *writer;
+    GhtStats stats;
+    size_t size;
+    GhtErr err;
+
+    ght_stats_reset();
+    tree = tsv_file_to_tree(simpledata, simpleschema);
+    ght_writer_new_mem(&writer);
+    ght_tree_write(tree, writer);
+    ght_writer_get_size(writer, &size);
+    ght_writer_free(writer);
+    ght_tree_free(tree);
+
+    err = ght_stats_get(&stats);
+#ifdef GHT_ENABLE_STATS
+    CU_ASSERT_EQUAL(err, GHT_OK);
+    CU_ASSERT(stats.nodes_allocated > 0);
+    CU_ASSERT(stats.splits > 0);
+    CU_ASSERT(stats.descents > 0);
+    CU_ASSERT_EQUAL(stats.bytes_written, size);
+    ght_stats_reset();
+    ght_stats_get(&stats);
+    CU_ASSERT_EQUAL(stats.nodes_allocated, 0);
+#else
+    /* Nothing is counted unless the counters are built in */
+    CU_ASSERT_EQUAL(err, GHT_ERROR);
+    CU_ASSERT_EQUAL(stats.nodes_allocated, 0);
+#endif
+}
+
+static void
+test_ght_tree_profile(void)
+{
+    static const char *simpledata = "test/data/simple-data.tsv";
+    GhtTree *tree;
+    GhtTreeProfile profile;
+    int i, numpoints, nodes = 0, fanout = 0;
+
+    tree = tsv_file_to_tree(simpledata, simpleschema);
+    ght_tree_get_numpoints(tree, &numpoints);
+    CU_ASSERT_EQUAL(ght_tree_get_profile(tree, &profile), GHT_OK);
+    CU_ASSERT_EQUAL(profile.num_leaves, numpoints);
+    CU_ASSERT_EQUAL(profile.depth[0], 1);
+    for ( i = 0; i < GHT_PROFILE_MAX_DEPTH; i++ )
+        nodes += profile.depth[i];
+    for ( i = 0; i <= GHT_PROFILE_MAX_FANOUT; i++ )
+        fanout += profile.fanout[i];
+    CU_ASSERT_EQUAL(nodes, profile.num_nodes);
+    CU_ASSERT_EQUAL(fanout, profile.num_nodes);
+    CU_ASSERT_EQUAL(profile.fanout[0], numpoints);
+    CU_ASSERT_EQUAL(profile.node_bytes, profile.num_nodes * sizeof(GhtNode));
+    CU_ASSERT_EQUAL(profile.attribute_bytes, profile.num_attributes * sizeof(GhtAttribute));
+    CU_ASSERT(profile.nodelist_bytes > 0);
+
+    /* Compacted as it was read, so shared values sit at the top */
+    CU_ASSERT(profile.depth_attributes[0] > 0);
+    CU_ASSERT(profile.num_attributes < 2 * numpoints);
+
+    ght_tree_free(tree);
+}
 
 /* REGISTER ***********************************************************/
 
@@ -183,6 +1459,25 @@ CU_TestInfo tree_tests[] =
     GHT_TEST(test_ght_tree_extent),
     GHT_TEST(test_ght_tree_empty),
     GHT_TEST(test_ght_tree_filter),
+    GHT_TEST(test_ght_tree_predicate),
+    GHT_TEST(test_ght_tree_filter_count),
+    GHT_TEST(test_ght_tree_filter_partial),
+    GHT_TEST(test_ght_tree_knn),
+    GHT_TEST(test_ght_tree_knn_all),
+    GHT_TEST(test_ght_tree_sample),
+    GHT_TEST(test_ght_tree_stats),
+    GHT_TEST(test_ght_tree_rasterize),
+    GHT_TEST(test_ght_tree_freeze),
+    GHT_TEST(test_ght_tree_packed),
+    GHT_TEST(test_ght_tree_cursor),
+    GHT_TEST(test_ght_tree_compact_tolerance),
+    GHT_TEST(test_ght_tree_blocks),
+    GHT_TEST(test_ght_tree_summaries),
+    GHT_TEST(test_ght_tree_delta),
+    GHT_TEST(test_ght_tree_archive),
+    GHT_TEST(test_ght_tree_embed_schema),
+    GHT_TEST(test_ght_tree_counters),
+    GHT_TEST(test_ght_tree_profile),
     CU_TEST_INFO_NULL
 };
 
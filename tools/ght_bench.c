@@ -0,0 +1,591 @@
+/***********************************************************************
+* ght_bench.c
+*
+*   time the hot paths of the library on synthetic point clouds
+*   and report the results as JSON
+*
+***********************************************************************/
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "ght.h" /* We use the public GHT API to promote good practices */
+
+#define EXENAME "ght_bench"
+#define DEFAULT_NUM_POINTS 200000
+#define DEFAULT_REPEAT 3
+#define DEFAULT_SEED 1
+
+#ifdef HAVE_GETOPT_H
+/* System implementation */
+#include <getopt.h>
+#else
+/* Compatibility implementation */
+#include "getopt.h"
+#endif
+
+/* declarations */
+void ght_init(void);
+void ght_info(const char *fmt, ...);
+void ght_warn(const char *fmt, ...);
+void ght_error(const char *fmt, ...);
+void ght_free(void *ptr);
+GhtErr ght_hash_from_coordinate(const GhtCoordinate *coord, unsigned int resolution, GhtHash **rhash);
+
+/* Synthetic point cloud shapes */
+typedef enum
+{
+    GB_UNIFORM = 0,
+    GB_CLUSTERED,
+    GB_DUPLICATE,
+    GB_SCANLINE,
+    GB_NUM_PATTERNS
+} GbPattern;
+
+static const char *GbPatternNames[] =
+{
+    "uniform",
+    "clustered",
+    "duplicate",
+    "scanline",
+    NULL
+};
+
+typedef struct
+{
+    int num_points;    /* How many points in each cloud? */
+    int repeat;        /* How many times to run each benchmark, keeping the best */
+    uint64_t seed;     /* Seed for the point generators */
+    char patterns[GB_NUM_PATTERNS];  /* Which clouds to run against */
+} GbConfig;
+
+/* One synthetic cloud, the same every time for a given seed */
+typedef struct
+{
+    int num_points;
+    double *x;
+    double *y;
+    double *z;
+    int *intensity;
+    int *classification;
+    int *returns;
+} GbPoints;
+
+/* Small, fast generator, so clouds are the same on every platform */
+typedef struct
+{
+    uint64_t state;
+} GbRandom;
+
+static uint64_t
+gb_random_next(GbRandom *r)
+{
+    r->state ^= r->state >> 12;
+    r->state ^= r->state << 25;
+    r->state ^= r->state >> 27;
+    return r->state * 2685821657736338717ULL;
+}
+
+/** Uniform in [0, 1) */
+static double
+gb_random_uniform(GbRandom *r)
+{
+    return (gb_random_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/** Roughly normal, mean 0 and deviation 1 */
+static double
+gb_random_normal(GbRandom *r)
+{
+    double sum = 0.0;
+    int i;
+    for ( i = 0; i < 12; i++ )
+        sum += gb_random_uniform(r);
+    return sum - 6.0;
+}
+
+static double
+gb_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+gb_usage()
+{
+    printf("%s, version %d.%d\n\n", EXENAME, ght_version_major(), ght_version_minor());
+    printf("Usage: %s [options]\n\n", EXENAME);
+    printf("Options:\n");
+    printf("  --points N                    Points in each cloud (default %d).\n", DEFAULT_NUM_POINTS);
+    printf("  --repeat N                    Runs of each benchmark, best is kept (default %d).\n", DEFAULT_REPEAT);
+    printf("  --seed N                      Seed for the point generators (default %d).\n", DEFAULT_SEED);
+    printf("  --pattern NAME                Only run against this cloud, may be repeated.\n");
+    printf("      uniform   - points spread evenly over the area\n");
+    printf("      clustered - points in tight clumps\n");
+    printf("      duplicate - few locations, each with many points\n");
+    printf("      scanline  - LiDAR-like lines of points over smooth terrain\n");
+    printf("\n");
+    printf("Results are written to standard output as JSON.\n");
+    printf("\n");
+}
+
+static int
+gb_getopts(int argc, char **argv, GbConfig *config)
+{
+    int ch = 0;
+    int i, num_patterns = 0;
+
+    /* options descriptor */
+    static struct option longopts[] =
+    {
+        { "points", required_argument, NULL, 'n' },
+        { "repeat", required_argument, NULL, 'r' },
+        { "seed", required_argument, NULL, 's' },
+        { "pattern", required_argument, NULL, 'p' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    memset(config, 0, sizeof(GbConfig));
+    config->num_points = DEFAULT_NUM_POINTS;
+    config->repeat = DEFAULT_REPEAT;
+    config->seed = DEFAULT_SEED;
+
+    while ( (ch = getopt_long(argc, argv, "n:r:s:p:h", longopts, NULL)) != -1)
+    {
+        switch (ch)
+        {
+            case 'n':
+            {
+                config->num_points = atoi(optarg);
+                break;
+            }
+            case 'r':
+            {
+                config->repeat = atoi(optarg);
+                break;
+            }
+            case 's':
+            {
+                config->seed = strtoull(optarg, NULL, 10);
+                break;
+            }
+            case 'p':
+            {
+                for ( i = 0; GbPatternNames[i]; i++ )
+                {
+                    if ( strcmp(optarg, GbPatternNames[i]) == 0 )
+                        break;
+                }
+                if ( ! GbPatternNames[i] )
+                {
+                    ght_warn("unknown pattern '%s'", optarg);
+                    return 0;
+                }
+                config->patterns[i] = 1;
+                num_patterns++;
+                break;
+            }
+            default:
+            {
+                return 0;
+            }
+        }
+    }
+
+    if ( config->num_points < 1 || config->repeat < 1 )
+        return 0;
+
+    /* All of them, unless some were asked for */
+    if ( ! num_patterns )
+        memset(config->patterns, 1, GB_NUM_PATTERNS);
+
+    return 1;
+}
+
+static void
+gb_points_free(GbPoints *pts)
+{
+    free(pts->x);
+    free(pts->y);
+    free(pts->z);
+    free(pts->intensity);
+    free(pts->classification);
+    free(pts->returns);
+}
+
+/**
+* Fill in a cloud over a patch about a kilometre across, with
+* elevations, intensities, classes and return numbers to go with it.
+*/
+static void
+gb_points_generate(GbPattern pattern, int num_points, uint64_t seed, GbPoints *pts)
+{
+    static const double xmin = -123.15, ymin = 49.25, width = 0.01;
+    GbRandom r;
+    int i;
+
+    r.state = (seed + 1) * 0x9E3779B97F4A7C15ULL + pattern;
+    pts->num_points = num_points;
+    pts->x = malloc(num_points * sizeof(double));
+    pts->y = malloc(num_points * sizeof(double));
+    pts->z = malloc(num_points * sizeof(double));
+    pts->intensity = malloc(num_points * sizeof(int));
+    pts->classification = malloc(num_points * sizeof(int));
+    pts->returns = malloc(num_points * sizeof(int));
+
+    for ( i = 0; i < num_points; i++ )
+    {
+        double u, v;
+
+        switch ( pattern )
+        {
+            case GB_UNIFORM:
+            {
+                u = gb_random_uniform(&r);
+                v = gb_random_uniform(&r);
+                break;
+            }
+            case GB_CLUSTERED:
+            {
+                /* Centres come from their own sequence, so they are shared */
+                GbRandom c;
+                c.state = (seed + 7) * 0x9E3779B97F4A7C15ULL + (gb_random_next(&r) % 32);
+                u = gb_random_uniform(&c) + 0.005 * gb_random_normal(&r);
+                v = gb_random_uniform(&c) + 0.005 * gb_random_normal(&r);
+                break;
+            }
+            case GB_DUPLICATE:
+            {
+                /* One location for every sixteen points */
+                GbRandom c;
+                c.state = (seed + 13) * 0x9E3779B97F4A7C15ULL + (gb_random_next(&r) % (num_points / 16 + 1));
+                gb_random_next(&c);
+                u = gb_random_uniform(&c);
+                v = gb_random_uniform(&c);
+                break;
+            }
+            case GB_SCANLINE:
+            default:
+            {
+                /* Lines across the patch, one after the other, a little jitter on each shot */
+                int per_line = (int)sqrt((double)num_points) + 1;
+                int line = i / per_line;
+                u = (double)(i % per_line) / per_line + 0.0002 * gb_random_normal(&r);
+                v = (double)line / per_line + 0.0001 * gb_random_normal(&r);
+                break;
+            }
+        }
+
+        /* Keep it inside the patch */
+        u = u < 0.0 ? 0.0 : (u >= 1.0 ? 0.999999 : u);
+        v = v < 0.0 ? 0.0 : (v >= 1.0 ? 0.999999 : v);
+        pts->x[i] = xmin + width * u;
+        pts->y[i] = ymin + width * v;
+
+        /* Rolling terrain, with some things standing on it */
+        pts->z[i] = 100.0 + 20.0 * sin(6.0 * u) * cos(4.0 * v) + 0.05 * gb_random_normal(&r);
+        pts->classification[i] = 2;
+        pts->returns[i] = 1;
+        if ( gb_random_uniform(&r) < 0.3 )
+        {
+            pts->z[i] += 5.0 + 15.0 * gb_random_uniform(&r);
+            pts->classification[i] = 5;
+            pts->returns[i] = 1 + (int)(3 * gb_random_uniform(&r));
+        }
+        pts->intensity[i] = (int)(200 + 50 * gb_random_normal(&r)) & 0xffff;
+    }
+}
+
+static GhtErr
+gb_build_schema(GhtSchemaPtr *schema)
+{
+    GhtDimensionPtr dim;
+    GHT_TRY(ght_schema_new(schema));
+    GHT_TRY(ght_dimension_new_from_parameters("X", "", GHT_DOUBLE, 1.0, 0.0, &dim));
+    GHT_TRY(ght_schema_add_dimension(*schema, dim));
+    GHT_TRY(ght_dimension_new_from_parameters("Y", "", GHT_DOUBLE, 1.0, 0.0, &dim));
+    GHT_TRY(ght_schema_add_dimension(*schema, dim));
+    GHT_TRY(ght_dimension_new_from_parameters("Z", "", GHT_INT32, 0.01, 0.0, &dim));
+    GHT_TRY(ght_schema_add_dimension(*schema, dim));
+    GHT_TRY(ght_dimension_new_from_parameters("Intensity", "", GHT_UINT16, 1.0, 0.0, &dim));
+    GHT_TRY(ght_schema_add_dimension(*schema, dim));
+    GHT_TRY(ght_dimension_new_from_parameters("Classification", "", GHT_UINT8, 1.0, 0.0, &dim));
+    GHT_TRY(ght_schema_add_dimension(*schema, dim));
+    GHT_TRY(ght_dimension_new_from_parameters("ReturnNumber", "", GHT_UINT8, 1.0, 0.0, &dim));
+    GHT_TRY(ght_schema_add_dimension(*schema, dim));
+    return GHT_OK;
+}
+
+/** Make a node for every point, the way a loader would */
+static GhtErr
+gb_build_nodelist(const GbPoints *pts, const GhtSchemaPtr schema, GhtNodeListPtr *nodelist)
+{
+    GhtDimensionPtr dims[4];
+    int i, d;
+
+    for ( d = 0; d < 4; d++ )
+        GHT_TRY(ght_schema_get_dimension_by_index(schema, d + 2, &(dims[d])));
+
+    GHT_TRY(ght_nodelist_new(pts->num_points, nodelist));
+    for ( i = 0; i < pts->num_points; i++ )
+    {
+        GhtCoordinate coord;
+        GhtNodePtr node;
+        GhtAttributePtr attr;
+        double vals[4];
+
+        coord.x = pts->x[i];
+        coord.y = pts->y[i];
+        vals[0] = pts->z[i];
+        vals[1] = pts->intensity[i];
+        vals[2] = pts->classification[i];
+        vals[3] = pts->returns[i];
+
+        GHT_TRY(ght_node_new_from_coordinate(&coord, GHT_MAX_HASH_LENGTH, &node));
+        for ( d = 0; d < 4; d++ )
+        {
+            GHT_TRY(ght_attribute_new_from_double(dims[d], vals[d], &attr));
+            GHT_TRY(ght_node_add_attribute(node, attr));
+        }
+        GHT_TRY(ght_nodelist_add_node(*nodelist, node));
+    }
+    return GHT_OK;
+}
+
+static GhtErr
+gb_build_tree(const GbPoints *pts, const GhtSchemaPtr schema, GhtTreePtr *tree)
+{
+    GhtNodeListPtr nodelist;
+    GhtConfig config;
+    ght_config_init(&config);
+    GHT_TRY(gb_build_nodelist(pts, schema, &nodelist));
+    GHT_TRY(ght_tree_from_nodelist(schema, nodelist, &config, tree));
+    return ght_nodelist_free_shallow(nodelist);
+}
+
+/* Running JSON output, and the best time of the benchmark being run */
+typedef struct
+{
+    int num_results;
+    double best;
+} GbReport;
+
+static void
+gb_report(GbReport *report, const char *pattern, const char *benchmark, int num_points, double seconds, double bytes)
+{
+    printf("%s\n    {\"pattern\": \"%s\", \"benchmark\": \"%s\", \"points\": %d, \"seconds\": %.6f, \"points_per_sec\": %.0f",
+           report->num_results ? "," : "", pattern, benchmark, num_points, seconds,
+           seconds > 0.0 ? num_points / seconds : 0.0);
+    if ( bytes > 0.0 )
+        printf(", \"bytes\": %.0f, \"bytes_per_point\": %.3f", bytes, bytes / num_points);
+    printf("}");
+    report->num_results++;
+}
+
+/* Time one run of a stretch of code, keeping the best */
+#define GB_TIME(report, code) { \
+    double gb_start = gb_now(); \
+    code; \
+    double gb_elapsed = gb_now() - gb_start; \
+    if ( report.best < 0.0 || gb_elapsed < report.best ) report.best = gb_elapsed; }
+
+static GhtErr
+gb_run_pattern(const GbConfig *config, GbPattern pattern, const GhtSchemaPtr schema, GbReport *out)
+{
+    const char *name = GbPatternNames[pattern];
+    GbPoints pts;
+    GbReport report = *out;
+    GhtTreePtr tree;
+    GhtWriterPtr writer;
+    GhtPredicatePtr predicate;
+    unsigned char *bytes;
+    size_t size = 0;
+    int i, r, count, numpoints;
+
+    gb_points_generate(pattern, config->num_points, config->seed, &pts);
+
+    /* Hashing on its own */
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GB_TIME(report,
+            for ( i = 0; i < pts.num_points; i++ )
+            {
+                GhtCoordinate coord;
+                GhtHash *hash;
+                coord.x = pts.x[i];
+                coord.y = pts.y[i];
+                GHT_TRY(ght_hash_from_coordinate(&coord, GHT_MAX_HASH_LENGTH, &hash));
+                ght_free(hash);
+            }
+        );
+    }
+    gb_report(&report, name, "hash_from_coordinate", pts.num_points, report.best, 0);
+
+    /* Building a tree one insert at a time */
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GhtNodeListPtr nodelist;
+        GHT_TRY(gb_build_nodelist(&pts, schema, &nodelist));
+        GHT_TRY(ght_tree_new(schema, &tree));
+        GB_TIME(report,
+            for ( i = 0; i < pts.num_points; i++ )
+            {
+                GhtNodePtr node;
+                GHT_TRY(ght_nodelist_get_node(nodelist, i, &node));
+                GHT_TRY(ght_tree_insert_node(tree, node));
+            }
+        );
+        ght_nodelist_free_shallow(nodelist);
+        ght_tree_free(tree);
+    }
+    gb_report(&report, name, "tree_insert_node", pts.num_points, report.best, 0);
+
+    /* and all at once */
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GhtNodeListPtr nodelist;
+        GhtConfig tconfig;
+        ght_config_init(&tconfig);
+        GHT_TRY(gb_build_nodelist(&pts, schema, &nodelist));
+        GB_TIME(report, GHT_TRY(ght_tree_from_nodelist(schema, nodelist, &tconfig, &tree)));
+        ght_nodelist_free_shallow(nodelist);
+        ght_tree_free(tree);
+    }
+    gb_report(&report, name, "tree_from_nodelist", pts.num_points, report.best, 0);
+
+    /* Compaction */
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GHT_TRY(gb_build_tree(&pts, schema, &tree));
+        GB_TIME(report, GHT_TRY(ght_tree_compact_attributes(tree)));
+        ght_tree_free(tree);
+    }
+    gb_report(&report, name, "tree_compact_attributes", pts.num_points, report.best, 0);
+
+    /* The rest all run against one compacted tree */
+    GHT_TRY(gb_build_tree(&pts, schema, &tree));
+    GHT_TRY(ght_tree_compact_attributes(tree));
+    GHT_TRY(ght_tree_get_numpoints(tree, &numpoints));
+
+    /* Writing */
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GHT_TRY(ght_writer_new_mem(&writer));
+        GB_TIME(report, GHT_TRY(ght_tree_write(tree, writer)));
+        GHT_TRY(ght_writer_get_size(writer, &size));
+        ght_writer_free(writer);
+    }
+    gb_report(&report, name, "tree_write", numpoints, report.best, size);
+
+    /* Reading back what was written */
+    GHT_TRY(ght_writer_new_mem(&writer));
+    GHT_TRY(ght_tree_write(tree, writer));
+    GHT_TRY(ght_writer_get_size(writer, &size));
+    bytes = malloc(size);
+    GHT_TRY(ght_writer_get_bytes(writer, bytes));
+    ght_writer_free(writer);
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GhtReaderPtr reader;
+        GhtTreePtr tree_read;
+        GHT_TRY(ght_reader_new_mem(bytes, size, schema, &reader));
+        GB_TIME(report, GHT_TRY(ght_tree_read(reader, &tree_read)));
+        ght_reader_free(reader);
+        ght_tree_free(tree_read);
+    }
+    free(bytes);
+    gb_report(&report, name, "tree_read", numpoints, report.best, size);
+
+    /* Filtering into a new tree, about half the points pass */
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GhtTreePtr tree_filtered;
+        GB_TIME(report, GHT_TRY(ght_tree_filter_greater_than(tree, "Z", 105.0, &tree_filtered)));
+        if ( tree_filtered )
+            ght_tree_free(tree_filtered);
+    }
+    gb_report(&report, name, "tree_filter_greater_than", numpoints, report.best, 0);
+
+    /* and in place */
+    GHT_TRY(ght_predicate_new_greater_than("Z", 105.0, &predicate));
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GB_TIME(report, GHT_TRY(ght_tree_filter_count(tree, predicate, &count)));
+    }
+    ght_predicate_free(predicate);
+    gb_report(&report, name, "tree_filter_count", numpoints, report.best, 0);
+
+    /* Copying every point back out */
+    report.best = -1.0;
+    for ( r = 0; r < config->repeat; r++ )
+    {
+        GhtNodeListPtr nodelist;
+        GHT_TRY(ght_nodelist_new(numpoints, &nodelist));
+        GB_TIME(report, GHT_TRY(ght_tree_to_nodelist(tree, nodelist)));
+        ght_nodelist_free_deep(nodelist);
+    }
+    gb_report(&report, name, "tree_to_nodelist", numpoints, report.best, 0);
+
+    ght_tree_free(tree);
+    gb_points_free(&pts);
+    out->num_results = report.num_results;
+    return GHT_OK;
+}
+
+int
+main(int argc, char **argv)
+{
+    GbConfig config;
+    GbReport report;
+    GhtSchemaPtr schema;
+    int p;
+
+    ght_init();
+
+    /* Parse command line options and set configuration */
+    if ( ! gb_getopts(argc, argv, &config) )
+    {
+        gb_usage();
+        return 1;
+    }
+
+    if ( GHT_OK != gb_build_schema(&schema) )
+    {
+        ght_error("%s: unable to build schema!", EXENAME);
+        return 1;
+    }
+
+    memset(&report, 0, sizeof(GbReport));
+    printf("{\n  \"version\": \"%s\",\n  \"points\": %d,\n  \"repeat\": %d,\n  \"seed\": %llu,\n  \"results\": [",
+           ght_version(), config.num_points, config.repeat, (unsigned long long)config.seed);
+    for ( p = 0; p < GB_NUM_PATTERNS; p++ )
+    {
+        if ( ! config.patterns[p] )
+            continue;
+        if ( GHT_OK != gb_run_pattern(&config, p, schema, &report) )
+        {
+            ght_error("%s: benchmark failed on the %s cloud", EXENAME, GbPatternNames[p]);
+            return 1;
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    ght_schema_free(schema);
+    return 0;
+}
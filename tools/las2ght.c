@@ -11,13 +11,21 @@
 #include "proj_api.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include "ght.h" /* We use the public GHT API to promote good practices */
 
 #define EXENAME "las2ght"
 #define MAXPOINTS 2000000
 #define STRSIZE 1024
 #define LOG_NUM_POINTS 100000
+#define BATCHSIZE 4096     /* Points handed between stages at a time */
+#define NUMBATCHES 32      /* Batches in flight, which bounds memory use */
+#define NUMTREES 1         /* Finished trees waiting to be written */
+#define MAXTHREADS 64
 
 #ifdef HAVE_GETOPT_H
 /* System implementation */
@@ -36,6 +44,7 @@ void ght_init(void);
 void ght_info(const char *fmt, ...);
 void ght_warn(const char *fmt, ...);
 void ght_error(const char *fmt, ...);
+GhtErr ght_node_free(GhtNodePtr node);
 
 typedef enum
 {
@@ -90,6 +99,12 @@ typedef struct
     int validpoints;  /* Should we only convert valid points? */
     int resolution;   /* How many digits of the GeoHash to build? */
     int maxpoints;    /* How many points to save in each GHT file? */
+    GhtCodec codec;   /* Compress output in blocks with this codec */
+    int summaries;    /* Should we keep min/max summaries on interior nodes? */
+    int delta;        /* Should we write integer attributes as deltas? */
+    int archive;      /* Should we write all the trees into one archive file? */
+    int verbose;      /* Should we report the work done when we finish? */
+    int threads;      /* How many threads reproject and hash points? */
 } Las2GhtConfig;
 
 typedef struct 
@@ -97,11 +112,92 @@ typedef struct
     LASReaderH reader;
     LASHeaderH header;
     int fileno;
-    projPJ pj_input;
-    projPJ pj_output;
+    char *proj4_input;
     GhtSchemaPtr schema;
+    GhtArchiveWriterPtr archive;
 } Las2GhtState;
 
+/* Proj objects are not thread safe, so each worker has its own */
+typedef struct
+{
+    projCtx ctx;
+    projPJ pj_input;
+    projPJ pj_output;
+} Las2GhtProjection;
+
+/* Point as read from the LAS file, before reprojection */
+typedef struct
+{
+    double x;
+    double y;
+    double z;
+    double vals[NUM_LAS_ATTRIBUTES];
+} Las2GhtPoint;
+
+/* Run of points passed from stage to stage together */
+typedef struct
+{
+    int seq;
+    int num_points;
+    Las2GhtPoint points[BATCHSIZE];
+    int num_nodes;
+    GhtNodePtr nodes[BATCHSIZE];
+} Las2GhtBatch;
+
+/* Bounded queue between two stages, pushing blocks while it is full */
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    void **items;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+} Las2GhtQueue;
+
+/* Throughput of one stage, timed while busy rather than waiting on queues */
+typedef struct
+{
+    const char *name;
+    int num_threads;
+    long num_points;
+    double seconds;
+} Las2GhtStage;
+
+typedef enum
+{
+    L2G_STAGE_READ = 0,
+    L2G_STAGE_HASH,
+    L2G_STAGE_BUILD,
+    L2G_STAGE_WRITE,
+    L2G_NUM_STAGES
+} Las2GhtStageId;
+
+/*
+* Reader -> workers -> builder -> writer. Batches come from a fixed
+* pool and go back to it once their nodes are in a tree, so at most
+* NUMBATCHES are ever in flight, plus NUMTREES trees waiting to be
+* written, the tree being built and the tree being written.
+*/
+typedef struct
+{
+    const Las2GhtConfig *config;
+    Las2GhtState *state;
+    Las2GhtBatch *batches;
+    Las2GhtQueue free_queue;   /* empty batches, for the reader */
+    Las2GhtQueue point_queue;  /* batches of points, for the workers */
+    Las2GhtQueue node_queue;   /* batches of nodes, for the builder */
+    Las2GhtQueue tree_queue;   /* finished trees, for the writer */
+    pthread_mutex_t lock;      /* guards everything below */
+    int num_workers;
+    int error;
+    Las2GhtStage stages[L2G_NUM_STAGES];
+    int stats_available;
+    GhtStats stats;
+} Las2GhtPipeline;
+
 static void
 l2g_config_printf(const Las2GhtConfig *config)
 {
@@ -111,6 +207,31 @@ l2g_config_printf(const Las2GhtConfig *config)
     ght_info("    num_attrs: %d", config->num_attrs);
     ght_info("  validpoints: %d", config->validpoints);
     ght_info("   resolution: %d", config->resolution);
+    ght_info("        codec: %d", config->codec);
+    ght_info("    summaries: %d", config->summaries);
+    ght_info("        delta: %d", config->delta);
+    ght_info("      archive: %d", config->archive);
+    ght_info("      verbose: %d", config->verbose);
+    ght_info("      threads: %d", config->threads);
+}
+
+static void
+l2g_stats_printf(const GhtStats *s)
+{
+    GhtStats stats = *s;
+    ght_info("GhtStats");
+    ght_info("       nodes allocated: %zu", stats.nodes_allocated);
+    ght_info("                splits: %zu", stats.splits);
+    ght_info("              descents: %zu", stats.descents);
+    ght_info("            duplicates: %zu", stats.duplicates);
+    ght_info("            bytes read: %zu", stats.bytes_read);
+    ght_info("         bytes written: %zu", stats.bytes_written);
+    ght_info("  attributes compacted: %zu", stats.attributes_compacted);
+    ght_info("          hash seconds: %.3f", stats.hash_seconds);
+    ght_info("        insert seconds: %.3f", stats.insert_seconds);
+    ght_info("       compact seconds: %.3f", stats.compact_seconds);
+    ght_info("         write seconds: %.3f", stats.write_seconds);
+    ght_info("          read seconds: %.3f", stats.read_seconds);
 }
 
 static void
@@ -122,6 +243,12 @@ l2g_usage()
     printf("  --lasfile FILENAME            Read file as input.\n");
     printf("  --ghtfile FILENAME            Write file as output.\n");
     printf("  --validpoints                 Only convert valid points.\n");
+    printf("  --codec [none|zlib|zstd|lz4]  Compress output in blocks.\n");
+    printf("  --summaries                   Store value ranges for fast filtering.\n");
+    printf("  --delta                       Store integer attributes as deltas.\n");
+    printf("  --archive                     Write all trees into the one GHT file.\n");
+    printf("  --verbose                     Report work done, if built with GHT_ENABLE_STATS.\n");
+    printf("  --threads N                   Reproject and hash points on N threads.\n");
     printf("  --attrs [irndecapRGB]         Convert selected attributes.\n");
     printf("                                X,Y,Z are always converted.\n");
     printf("      i - intensity\n");
@@ -199,15 +326,10 @@ l2g_state_free(Las2GhtState *state)
         LASReader_Destroy(state->reader);
         state->reader = NULL;
     }
-    if ( state->pj_input )
+    if ( state->proj4_input )
     {
-        pj_free(state->pj_input);
-        state->pj_input = NULL;
-    }
-    if ( state->pj_output )
-    {
-        pj_free(state->pj_output);
-        state->pj_output = NULL;
+        free(state->proj4_input);
+        state->proj4_input = NULL;
     }
     if ( state->schema )
     {
@@ -250,12 +372,19 @@ l2g_getopts(int argc, char **argv, Las2GhtConfig *config)
         { "ghtfile", required_argument, NULL, 'g' },
         { "attrs", required_argument, NULL, 'a' },
         { "validpoints", no_argument, NULL, 'p' },
+        { "codec", required_argument, NULL, 'c' },
+        { "summaries", no_argument, NULL, 's' },
+        { "delta", no_argument, NULL, 'd' },
+        { "archive", no_argument, NULL, 'r' },
+        { "verbose", no_argument, NULL, 'v' },
+        { "threads", required_argument, NULL, 't' },
         { NULL, 0, NULL, 0 }
     };
 
     memset(config, 0, sizeof(Las2GhtConfig));
+    config->threads = sysconf(_SC_NPROCESSORS_ONLN);
 
-    while ( (ch = getopt_long(argc, argv, "g:l:a:p", longopts, NULL)) != -1)
+    while ( (ch = getopt_long(argc, argv, "g:l:a:pc:sdrvt:", longopts, NULL)) != -1)
     {
         switch (ch) 
         {
@@ -279,6 +408,44 @@ l2g_getopts(int argc, char **argv, Las2GhtConfig *config)
                 config->validpoints = 1;
                 break;
             }
+            case 'r':
+            {
+                config->archive = 1;
+                break;
+            }
+            case 'd':
+            {
+                config->delta = 1;
+                break;
+            }
+            case 'v':
+            {
+                config->verbose = 1;
+                break;
+            }
+            case 't':
+            {
+                config->threads = atoi(optarg);
+                break;
+            }
+            case 's':
+            {
+                config->summaries = 1;
+                break;
+            }
+            case 'c':
+            {
+                int available = 0;
+                if ( ght_codec_from_str(optarg, &(config->codec)) == GHT_OK )
+                    ght_codec_available(config->codec, &available);
+                if ( ! available )
+                {
+                    ght_warn("codec '%s' is not available", optarg);
+                    l2g_config_free(config);
+                    return 0;
+                }
+                break;
+            }
             default:
             {
                 l2g_config_free(config);
@@ -287,6 +454,11 @@ l2g_getopts(int argc, char **argv, Las2GhtConfig *config)
         }
     }
     
+    if ( config->threads < 1 )
+        config->threads = 1;
+    if ( config->threads > MAXTHREADS )
+        config->threads = MAXTHREADS;
+
     if ( ! (config->lasfile && config->ghtfile) )
     {
         l2g_config_free(config);
@@ -426,118 +598,102 @@ l2g_coordinate_to_dec(GhtCoordinate *coord)
 }
 
 static GhtErr
-l2g_coordinate_reproject(const Las2GhtState *state, GhtCoordinate *coord)
+l2g_coordinate_reproject(const Las2GhtProjection *proj, GhtCoordinate *coord)
 {
-
-    int *pj_errno_ref;
+    int pj_errno;
     GhtCoordinate origcoord;
 
     /* Make a copy of the input point so we can report the original should an error occur */
     origcoord = *coord;
 
-    if (pj_is_latlong(state->pj_input)) l2g_coordinate_to_rad(coord);
+    if (pj_is_latlong(proj->pj_input)) l2g_coordinate_to_rad(coord);
 
     /* Perform the transform */
-    pj_transform(state->pj_input, state->pj_output, 1, 0, &(coord->x), &(coord->y), NULL);
+    pj_transform(proj->pj_input, proj->pj_output, 1, 0, &(coord->x), &(coord->y), NULL);
 
     /* For NAD grid-shift errors, display an error message with an additional hint */
-    pj_errno_ref = pj_get_errno_ref();
+    pj_errno = pj_ctx_get_errno(proj->ctx);
 
-    if (*pj_errno_ref != 0)
+    if (pj_errno != 0)
     {
-        if (*pj_errno_ref == -38)
+        if (pj_errno == -38)
         {
             ght_warn("No no grid shift files were found, or point out of range.");
         }
         ght_error("%s: could not project point (%g %g): %s (%d)", 
                   __func__, 
                   origcoord.x, origcoord.y,
-                  pj_strerrno(*pj_errno_ref), *pj_errno_ref
+                  pj_strerrno(pj_errno), pj_errno
                   );
         return GHT_ERROR;
     }
 
-    if (pj_is_latlong(state->pj_output)) l2g_coordinate_to_dec(coord);
+    if (pj_is_latlong(proj->pj_output)) l2g_coordinate_to_dec(coord);
     return GHT_OK;
 }
 
+/** Copy what we need out of the LAS point, which the reader reuses */
+static void
+l2g_read_point(const Las2GhtConfig *config, LASPointH laspoint, Las2GhtPoint *point)
+{
+    int i;
+    point->x = LASPoint_GetX(laspoint);
+    point->y = LASPoint_GetY(laspoint);
+    point->z = LASPoint_GetZ(laspoint);
+    for ( i = 0; i < config->num_attrs; i++ )
+        point->vals[i] = l2g_attribute_value(laspoint, config->attrs[i]);
+}
+
 static GhtErr
-l2g_build_node(const Las2GhtConfig *config, const Las2GhtState *state, LASPointH laspoint, GhtNodePtr *node)
+l2g_build_node(const Las2GhtConfig *config, const Las2GhtState *state, const Las2GhtProjection *proj, const Las2GhtPoint *point, GhtNodePtr *node)
 {
     int i;
-    double z;
     GhtDimensionPtr ghtdim;
     GhtAttributePtr attribute;
     GhtCoordinate coord;
-    GhtErr err;
     
     assert(config);
     assert(state->schema);
     
-    /* Skip invalid points, if so configured */
-    if ( config->validpoints && ! LASPoint_IsValid(laspoint) )
-        return GHT_ERROR;
-
-    coord.x = LASPoint_GetX(laspoint);
-    coord.y = LASPoint_GetY(laspoint);
+    coord.x = point->x;
+    coord.y = point->y;
     
-    if ( l2g_coordinate_reproject(state, &coord) != GHT_OK )
+    if ( l2g_coordinate_reproject(proj, &coord) != GHT_OK )
         return GHT_ERROR;
     
     if ( ght_node_new_from_coordinate(&coord, config->resolution, node) != GHT_OK )
         return GHT_ERROR;
 
     /* We know that 'Z' is always dimension 2 */
-    z = LASPoint_GetZ(laspoint);
-    GHT_TRY(ght_schema_get_dimension_by_index(state->schema, 2, &ghtdim));
+    if ( ght_schema_get_dimension_by_index(state->schema, 2, &ghtdim) != GHT_OK )
+        goto fail;
     
-    if ( ght_attribute_new_from_double(ghtdim, z, &attribute) != GHT_OK )
-        return GHT_ERROR;
+    if ( ght_attribute_new_from_double(ghtdim, point->z, &attribute) != GHT_OK )
+        goto fail;
 
     if ( ght_node_add_attribute(*node, attribute) != GHT_OK )
-        return GHT_ERROR;
+        goto fail;
     
     for ( i = 0; i < config->num_attrs; i++ )
     {
-        LasAttribute lasattr = config->attrs[i];
-        double val = l2g_attribute_value(laspoint, lasattr);
-
         /* Magic number 3: X,Y,Z are first three dimensions */
-        GHT_TRY(ght_schema_get_dimension_by_index(state->schema, 3+i, &ghtdim));
+        if ( ght_schema_get_dimension_by_index(state->schema, 3+i, &ghtdim) != GHT_OK )
+            goto fail;
         
-        if ( ght_attribute_new_from_double(ghtdim, val, &attribute) != GHT_OK )
-            return GHT_ERROR;
+        if ( ght_attribute_new_from_double(ghtdim, point->vals[i], &attribute) != GHT_OK )
+            goto fail;
 
         if ( ght_node_add_attribute(*node, attribute) != GHT_OK )
-            return GHT_ERROR;
+            goto fail;
     }
 
     return GHT_OK;
-}
-
-static int
-l2g_build_tree(const Las2GhtConfig *config, Las2GhtState *state, GhtTreePtr *tree)
-{
-    int num_points = 0;
-    int i;
-    LASPointH laspoint;
-    GhtNodePtr node;
-    GhtErr err;
-
-    ght_info("starting a new tree");
-    ght_tree_new(state->schema, tree);
 
-    while( (laspoint = LASReader_GetNextPoint(state->reader)) && num_points <= config->maxpoints )
-    {
-        err = l2g_build_node(config, state, laspoint, &node);
-        // LASPoint_Destroy(laspoint); /* Don't need this, it's not allocated on the heap? */
-        err = ght_tree_insert_node(*tree, node);
-        num_points++;
-        if ( ! (num_points % LOG_NUM_POINTS) )
-            ght_info("inserted point %d into the tree...", num_points);
-    }
-
-    return num_points;
+fail:
+    /* The attributes added so far go with the node */
+    ght_node_free(*node);
+    *node = NULL;
+    return GHT_ERROR;
 }
 
 static void
@@ -585,6 +741,15 @@ l2g_save_tree(const Las2GhtConfig *config, Las2GhtState *state, const GhtTreePtr
     assert(state);
     assert(tree);
 
+    /* Archives hold all the trees, with one copy of the schema */
+    if ( state->archive )
+    {
+        ght_info("adding tree %d to archive %s", state->fileno, config->ghtfile);
+        GHT_TRY(ght_archive_writer_add_tree(state->archive, tree));
+        state->fileno++;
+        return GHT_OK;
+    }
+
     ght_tree_get_hash(tree, &hash);
 
     l2g_ght_file(config, state, hash, ght_filename);
@@ -606,6 +771,8 @@ l2g_save_tree(const Las2GhtConfig *config, Las2GhtState *state, const GhtTreePtr
     GHT_TRY(ght_tree_get_schema(tree, &schema));
     GHT_TRY(ght_schema_to_xml_file(schema, xml_filename));
     GHT_TRY(ght_writer_new_file(ght_filename, &writer));
+    GHT_TRY(ght_writer_set_codec(writer, config->codec));
+    GHT_TRY(ght_writer_set_delta(writer, config->delta));
     GHT_TRY(ght_tree_write(tree, writer));
     GHT_TRY(ght_writer_free(writer));
     
@@ -616,7 +783,7 @@ l2g_save_tree(const Las2GhtConfig *config, Las2GhtState *state, const GhtTreePtr
 }
 
 static projPJ
-l2g_proj_from_string(const char *str1)
+l2g_proj_from_string(projCtx ctx, const char *str1)
 {
     int t;
     char *params[1024];  /* one for each parameter */
@@ -645,7 +812,7 @@ l2g_proj_from_string(const char *str1)
         }
     }
 
-    if (!(result=pj_init(t, params)))
+    if (!(result=pj_init_ctx(ctx, t, params)))
     {
         free(str);
         return NULL;
@@ -654,12 +821,55 @@ l2g_proj_from_string(const char *str1)
     return result;
 }
     
+static void
+l2g_projection_free(Las2GhtProjection *proj)
+{
+    if ( proj->pj_input )
+        pj_free(proj->pj_input);
+    if ( proj->pj_output )
+        pj_free(proj->pj_output);
+    if ( proj->ctx )
+        pj_ctx_free(proj->ctx);
+    memset(proj, 0, sizeof(Las2GhtProjection));
+}
+
+static GhtErr
+l2g_projection_new(const char *proj4_input, Las2GhtProjection *proj)
+{
+    static char *proj4_output = "+proj=longlat +datum=WGS84 +no_defs";
+
+    memset(proj, 0, sizeof(Las2GhtProjection));
+    proj->ctx = pj_ctx_alloc();
+    if ( ! proj->ctx )
+    {
+        ght_error("%s: unable to allocate projection context", __func__);
+        return GHT_ERROR;
+    }
+
+    proj->pj_input = l2g_proj_from_string(proj->ctx, proj4_input);
+    if ( ! proj->pj_input )
+    {
+        ght_error("%s: unable to parse proj4 string '%s'", __func__, proj4_input);
+        l2g_projection_free(proj);
+        return GHT_ERROR;
+    }
+
+    proj->pj_output = l2g_proj_from_string(proj->ctx, proj4_output);
+    if ( ! proj->pj_output )
+    {
+        ght_error("%s: unable to parse proj4 string '%s'", __func__, proj4_output);
+        l2g_projection_free(proj);
+        return GHT_ERROR;
+    }
+    return GHT_OK;
+}
+
 static GhtErr
 l2g_read_projection(const Las2GhtConfig *config, Las2GhtState *state)
 {
     LASSRSH lassrs;    
     char *proj4_input = NULL;
-    static char *proj4_output = "+proj=longlat +datum=WGS84 +no_defs";
+    Las2GhtProjection proj;
 
     assert(state);
     assert(state->header);
@@ -682,23 +892,416 @@ l2g_read_projection(const Las2GhtConfig *config, Las2GhtState *state)
     
     ght_info("Got LAS file projection information '%s'", proj4_input);
 
-    state->pj_input = l2g_proj_from_string(proj4_input);
+    /* Each worker sets up its own projections from the string */
+    state->proj4_input = strdup(proj4_input);
     LASString_Free(proj4_input);
+
+    /* Check now that they can, before starting any */
+    GHT_TRY(l2g_projection_new(state->proj4_input, &proj));
+    l2g_projection_free(&proj);
     
-    if ( ! state->pj_input )
+    return GHT_OK;
+}
+
+static double
+l2g_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+l2g_queue_init(Las2GhtQueue *q, int capacity)
+{
+    memset(q, 0, sizeof(Las2GhtQueue));
+    q->items = malloc(capacity * sizeof(void*));
+    if ( ! q->items )
+        return 0;
+    q->capacity = capacity;
+    pthread_mutex_init(&(q->lock), NULL);
+    pthread_cond_init(&(q->not_empty), NULL);
+    pthread_cond_init(&(q->not_full), NULL);
+    return 1;
+}
+
+static void
+l2g_queue_free(Las2GhtQueue *q)
+{
+    if ( ! q->items )
+        return;
+    pthread_mutex_destroy(&(q->lock));
+    pthread_cond_destroy(&(q->not_empty));
+    pthread_cond_destroy(&(q->not_full));
+    free(q->items);
+    q->items = NULL;
+}
+
+static void
+l2g_queue_push(Las2GhtQueue *q, void *item)
+{
+    pthread_mutex_lock(&(q->lock));
+    while ( q->count == q->capacity )
+        pthread_cond_wait(&(q->not_full), &(q->lock));
+    q->items[(q->head + q->count) % q->capacity] = item;
+    q->count++;
+    pthread_cond_signal(&(q->not_empty));
+    pthread_mutex_unlock(&(q->lock));
+}
+
+/** Next item, waiting for one if need be, or NULL once the queue is closed and empty */
+static void *
+l2g_queue_pop(Las2GhtQueue *q)
+{
+    void *item = NULL;
+    pthread_mutex_lock(&(q->lock));
+    while ( q->count == 0 && ! q->closed )
+        pthread_cond_wait(&(q->not_empty), &(q->lock));
+    if ( q->count )
     {
-        ght_error("%s: unable to parse proj4 string '%s'", __func__, proj4_input);
-        return GHT_ERROR;
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&(q->not_full));
     }
+    pthread_mutex_unlock(&(q->lock));
+    return item;
+}
 
-    state->pj_output = l2g_proj_from_string(proj4_output);
-    if ( ! state->pj_output )
+/** No more items will be pushed, wake everyone waiting to pop */
+static void
+l2g_queue_close(Las2GhtQueue *q)
+{
+    pthread_mutex_lock(&(q->lock));
+    q->closed = 1;
+    pthread_cond_broadcast(&(q->not_empty));
+    pthread_mutex_unlock(&(q->lock));
+}
+
+/** Fold the work of one thread into the pipeline totals */
+static void
+l2g_pipeline_add(Las2GhtPipeline *pipe, Las2GhtStageId stage, long num_points, double seconds)
+{
+    GhtStats stats;
+    pthread_mutex_lock(&(pipe->lock));
+    pipe->stages[stage].num_points += num_points;
+    pipe->stages[stage].seconds += seconds;
+
+    /* Library counters are kept per thread */
+    if ( ght_stats_get(&stats) == GHT_OK )
     {
-        ght_error("%s: unable to parse proj4 string '%s'", __func__, proj4_input);
+        pipe->stats_available = 1;
+        pipe->stats.nodes_allocated += stats.nodes_allocated;
+        pipe->stats.splits += stats.splits;
+        pipe->stats.descents += stats.descents;
+        pipe->stats.duplicates += stats.duplicates;
+        pipe->stats.bytes_read += stats.bytes_read;
+        pipe->stats.bytes_written += stats.bytes_written;
+        pipe->stats.attributes_compacted += stats.attributes_compacted;
+        pipe->stats.hash_seconds += stats.hash_seconds;
+        pipe->stats.insert_seconds += stats.insert_seconds;
+        pipe->stats.compact_seconds += stats.compact_seconds;
+        pipe->stats.write_seconds += stats.write_seconds;
+        pipe->stats.read_seconds += stats.read_seconds;
+    }
+    pthread_mutex_unlock(&(pipe->lock));
+}
+
+/** Flag the pipeline as failed, so the reader stops and the result is an error */
+static void
+l2g_pipeline_fail(Las2GhtPipeline *pipe)
+{
+    pthread_mutex_lock(&(pipe->lock));
+    pipe->error = 1;
+    pthread_mutex_unlock(&(pipe->lock));
+}
+
+static int
+l2g_pipeline_failed(Las2GhtPipeline *pipe)
+{
+    int error;
+    pthread_mutex_lock(&(pipe->lock));
+    error = pipe->error;
+    pthread_mutex_unlock(&(pipe->lock));
+    return error;
+}
+
+/** Decode LAS points into batches, stopping at the end of the file */
+static void *
+l2g_reader_run(void *arg)
+{
+    Las2GhtPipeline *pipe = arg;
+    const Las2GhtConfig *config = pipe->config;
+    long num_points = 0;
+    double seconds = 0.0;
+    int seq = 0, done = 0;
+
+    while ( ! done && ! l2g_pipeline_failed(pipe) )
+    {
+        Las2GhtBatch *batch = l2g_queue_pop(&(pipe->free_queue));
+        LASPointH laspoint;
+        double start = l2g_now();
+
+        batch->seq = seq;
+        batch->num_points = 0;
+        while ( batch->num_points < BATCHSIZE )
+        {
+            laspoint = LASReader_GetNextPoint(pipe->state->reader);
+            if ( ! laspoint )
+            {
+                done = 1;
+                break;
+            }
+            /* Skip invalid points, if so configured */
+            if ( config->validpoints && ! LASPoint_IsValid(laspoint) )
+                continue;
+            l2g_read_point(config, laspoint, &(batch->points[batch->num_points++]));
+        }
+        seconds += l2g_now() - start;
+        num_points += batch->num_points;
+
+        if ( batch->num_points )
+        {
+            l2g_queue_push(&(pipe->point_queue), batch);
+            seq++;
+        }
+        else
+        {
+            l2g_queue_push(&(pipe->free_queue), batch);
+        }
+    }
+
+    l2g_queue_close(&(pipe->point_queue));
+    l2g_pipeline_add(pipe, L2G_STAGE_READ, num_points, seconds);
+    return NULL;
+}
+
+/** Reproject and hash batches of points into nodes */
+static void *
+l2g_worker_run(void *arg)
+{
+    Las2GhtPipeline *pipe = arg;
+    Las2GhtProjection proj;
+    Las2GhtBatch *batch;
+    long num_points = 0;
+    double seconds = 0.0;
+    int projected, ok;
+
+    projected = ok = (l2g_projection_new(pipe->state->proj4_input, &proj) == GHT_OK);
+    while ( (batch = l2g_queue_pop(&(pipe->point_queue))) )
+    {
+        double start = l2g_now();
+        int i;
+        batch->num_nodes = 0;
+        for ( i = 0; ok && i < batch->num_points; i++ )
+        {
+            GhtNodePtr node;
+            /* A point that cannot be reprojected or hashed fails the whole run */
+            if ( l2g_build_node(pipe->config, pipe->state, &proj, &(batch->points[i]), &node) == GHT_OK )
+                batch->nodes[batch->num_nodes++] = node;
+            else
+                ok = 0;
+        }
+        seconds += l2g_now() - start;
+        num_points += batch->num_nodes;
+        /* Passed on even if empty, the builder is waiting for it in sequence */
+        l2g_queue_push(&(pipe->node_queue), batch);
+    }
+    if ( projected )
+        l2g_projection_free(&proj);
+    if ( ! ok )
+        l2g_pipeline_fail(pipe);
+
+    l2g_pipeline_add(pipe, L2G_STAGE_HASH, num_points, seconds);
+
+    /* Last worker out tells the builder */
+    pthread_mutex_lock(&(pipe->lock));
+    if ( --(pipe->num_workers) == 0 )
+        l2g_queue_close(&(pipe->node_queue));
+    pthread_mutex_unlock(&(pipe->lock));
+    return NULL;
+}
+
+/** Write finished trees out, while the next ones are built */
+static void *
+l2g_writer_run(void *arg)
+{
+    Las2GhtPipeline *pipe = arg;
+    GhtTreePtr tree;
+    long num_points = 0;
+    double seconds = 0.0;
+
+    while ( (tree = l2g_queue_pop(&(pipe->tree_queue))) )
+    {
+        double start = l2g_now();
+        int tree_points = 0;
+        ght_tree_get_numpoints(tree, &tree_points);
+        /* Keep taking trees after a failure, so the builder never blocks */
+        if ( ! l2g_pipeline_failed(pipe) && l2g_save_tree(pipe->config, pipe->state, tree) != GHT_OK )
+            l2g_pipeline_fail(pipe);
+        ght_tree_free(tree);
+        seconds += l2g_now() - start;
+        num_points += tree_points;
+    }
+
+    l2g_pipeline_add(pipe, L2G_STAGE_WRITE, num_points, seconds);
+    return NULL;
+}
+
+static void
+l2g_builder_finish_tree(Las2GhtPipeline *pipe, GhtTreePtr tree)
+{
+    ght_tree_compact_attributes(tree);
+    l2g_queue_push(&(pipe->tree_queue), tree);
+}
+
+/**
+* Insert the nodes into trees in the order they were read, so the
+* output does not depend on how the workers were scheduled. Batches
+* that arrive early wait in pending, and there can never be more of
+* them than there are batches in flight.
+*/
+static void
+l2g_builder_run(Las2GhtPipeline *pipe)
+{
+    const Las2GhtConfig *config = pipe->config;
+    Las2GhtBatch *pending[NUMBATCHES];
+    Las2GhtBatch *batch;
+    GhtTreePtr tree = NULL;
+    long num_points = 0;
+    double seconds = 0.0;
+    int tree_points = 0, next = 0;
+
+    memset(pending, 0, sizeof(pending));
+    while ( (batch = l2g_queue_pop(&(pipe->node_queue))) )
+    {
+        pending[batch->seq % NUMBATCHES] = batch;
+        while ( (batch = pending[next % NUMBATCHES]) && batch->seq == next )
+        {
+            double start = l2g_now();
+            int i;
+
+            pending[next % NUMBATCHES] = NULL;
+            next++;
+            for ( i = 0; i < batch->num_nodes; i++ )
+            {
+                if ( ! tree )
+                {
+                    ght_info("starting a new tree");
+                    ght_tree_new(pipe->state->schema, &tree);
+                    ght_tree_set_summaries(tree, config->summaries);
+                    tree_points = 0;
+                }
+                if ( ght_tree_insert_node(tree, batch->nodes[i]) != GHT_OK )
+                {
+                    ght_error("%s: unable to insert point into tree", EXENAME);
+                    ght_node_free(batch->nodes[i]);
+                    l2g_pipeline_fail(pipe);
+                    continue;
+                }
+                num_points++;
+                if ( ! (num_points % LOG_NUM_POINTS) )
+                    ght_info("inserted point %ld into the tree...", num_points);
+                /* Big enough, hand it to the writer and start another */
+                if ( ++tree_points >= config->maxpoints )
+                {
+                    l2g_builder_finish_tree(pipe, tree);
+                    tree = NULL;
+                }
+            }
+            seconds += l2g_now() - start;
+            l2g_queue_push(&(pipe->free_queue), batch);
+        }
+    }
+    if ( tree )
+        l2g_builder_finish_tree(pipe, tree);
+    l2g_queue_close(&(pipe->tree_queue));
+
+    l2g_pipeline_add(pipe, L2G_STAGE_BUILD, num_points, seconds);
+}
+
+static void
+l2g_stage_printf(const Las2GhtStage *stage)
+{
+    /* Threads of a stage work side by side, so divide their busy time between them */
+    double seconds = stage->seconds / stage->num_threads;
+    ght_info("%8s: %ld points in %.2fs on %d thread(s), %.0f points/s", stage->name, stage->num_points, 
+             seconds, stage->num_threads, seconds > 0.0 ? stage->num_points / seconds : 0.0);
+}
+
+/**
+* Convert the whole LAS file. A reader thread decodes points, worker
+* threads reproject and hash them, this thread builds trees from
+* them in order, and a writer thread saves each tree as it is done.
+*/
+static GhtErr
+l2g_pipeline_run(const Las2GhtConfig *config, Las2GhtState *state)
+{
+    Las2GhtPipeline pipe;
+    pthread_t reader, writer, workers[MAXTHREADS];
+    double start = l2g_now();
+    int i, ok;
+
+    memset(&pipe, 0, sizeof(Las2GhtPipeline));
+    pipe.config = config;
+    pipe.state = state;
+    pipe.num_workers = config->threads;
+    pipe.stages[L2G_STAGE_READ].name = "read";
+    pipe.stages[L2G_STAGE_HASH].name = "hash";
+    pipe.stages[L2G_STAGE_BUILD].name = "build";
+    pipe.stages[L2G_STAGE_WRITE].name = "write";
+    for ( i = 0; i < L2G_NUM_STAGES; i++ )
+        pipe.stages[i].num_threads = 1;
+    pipe.stages[L2G_STAGE_HASH].num_threads = config->threads;
+    pthread_mutex_init(&(pipe.lock), NULL);
+
+    /* Every batch fits in any queue, so only the free queue and trees ever block */
+    pipe.batches = malloc(NUMBATCHES * sizeof(Las2GhtBatch));
+    ok = pipe.batches &&
+         l2g_queue_init(&(pipe.free_queue), NUMBATCHES) &&
+         l2g_queue_init(&(pipe.point_queue), NUMBATCHES) &&
+         l2g_queue_init(&(pipe.node_queue), NUMBATCHES) &&
+         l2g_queue_init(&(pipe.tree_queue), NUMTREES);
+    if ( ! ok )
+    {
+        ght_error("%s: unable to allocate ingest pipeline", EXENAME);
         return GHT_ERROR;
     }
-    
-    return GHT_OK;
+    for ( i = 0; i < NUMBATCHES; i++ )
+        l2g_queue_push(&(pipe.free_queue), &(pipe.batches[i]));
+
+    ght_info("converting with %d worker threads", config->threads);
+    pthread_create(&reader, NULL, l2g_reader_run, &pipe);
+    for ( i = 0; i < config->threads; i++ )
+        pthread_create(&(workers[i]), NULL, l2g_worker_run, &pipe);
+    pthread_create(&writer, NULL, l2g_writer_run, &pipe);
+
+    l2g_builder_run(&pipe);
+
+    pthread_join(reader, NULL);
+    for ( i = 0; i < config->threads; i++ )
+        pthread_join(workers[i], NULL);
+    pthread_join(writer, NULL);
+
+    for ( i = 0; i < L2G_NUM_STAGES; i++ )
+        l2g_stage_printf(&(pipe.stages[i]));
+    ght_info("   total: %.2fs", l2g_now() - start);
+    if ( config->verbose )
+    {
+        if ( pipe.stats_available )
+            l2g_stats_printf(&(pipe.stats));
+        else
+            ght_info("statistics not available, rebuild with GHT_ENABLE_STATS");
+    }
+
+    l2g_queue_free(&(pipe.free_queue));
+    l2g_queue_free(&(pipe.point_queue));
+    l2g_queue_free(&(pipe.node_queue));
+    l2g_queue_free(&(pipe.tree_queue));
+    pthread_mutex_destroy(&(pipe.lock));
+    free(pipe.batches);
+
+    return pipe.error ? GHT_ERROR : GHT_OK;
 }
 
 int
@@ -706,8 +1309,6 @@ main (int argc, char **argv)
 {
     Las2GhtConfig config;
     Las2GhtState state;
-    GhtTreePtr tree;
-    int num_points;
 
     /* Set up to use the GHT system memory management / logging */
     ght_init();
@@ -738,7 +1339,7 @@ main (int argc, char **argv)
      
     /* Hard code resolution for now */
     config.resolution = GHT_MAX_HASH_LENGTH;
-    config.maxpoints = 2000000;
+    config.maxpoints = MAXPOINTS;
     
     /* Temporary info printout */
     l2g_config_printf(&config);
@@ -792,6 +1393,19 @@ main (int argc, char **argv)
         return 1;
     }
 
+    /* All the trees go into one archive file */
+    if ( config.archive )
+    {
+        if ( GHT_OK != ght_archive_writer_new(config.ghtfile, state.schema, &(state.archive)) ||
+             GHT_OK != ght_archive_writer_set_codec(state.archive, config.codec) ||
+             GHT_OK != ght_archive_writer_set_delta(state.archive, config.delta) )
+        {
+            l2g_state_free(&state);
+            ght_error("%s: unable to create archive '%s'", EXENAME, config.ghtfile);
+            return 1;
+        }
+    }
+
     // char *xmlstr;
     // size_t xmlsize;
     // ght_schema_to_xml_str(schema, &xmlstr, &xmlsize);
@@ -799,22 +1413,21 @@ main (int argc, char **argv)
 
 
     /* Break the problem into chunks. We might get a really really */
-    /* big LAS file, and we don't want to blow out memory, so we need to */
-    /* do this a few million records at a file */
-    do 
+    /* big LAS file, and we don't want to blow out memory, so we */
+    /* stream it through in batches, a few million records to a tree */
+    if ( GHT_OK != l2g_pipeline_run(&config, &state) )
     {
-        num_points = l2g_build_tree(&config, &state, &tree);
-        if ( num_points )
-        {
-            GhtErr err;
-            ght_tree_compact_attributes(tree);
-            err = l2g_save_tree(&config, &state, tree);
-            ght_tree_free(tree);
-            if ( err != GHT_OK )
-                return 1;
-        }
-    } 
-    while ( num_points > 0 );
+        l2g_state_free(&state);
+        ght_error("%s: conversion failed", EXENAME);
+        return 1;
+    }
+
+    if ( state.archive && GHT_OK != ght_archive_writer_close(state.archive) )
+    {
+        ght_error("%s: unable to write archive directory to '%s'", EXENAME, config.ghtfile);
+        return 1;
+    }
+    state.archive = NULL;
 
     l2g_state_free(&state);
     l2g_config_free(&config);